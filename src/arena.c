@@ -0,0 +1,102 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+// needed for MAP_HUGETLB and MADV_HUGEPAGE
+#define _GNU_SOURCE
+
+#include "arena.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include "config.h"
+
+// Reserves an arena of `size` bytes, backed by the pages of `pages`. Explicit huge pages fall
+// back to transparent ones when the system has none reserved. Exits on errors.
+arena_t *arena_create(size_t size, page_mode_t pages) {
+	arena_t *arena = (arena_t *)malloc(sizeof(arena_t));
+	if (!arena) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	// the mappings of huge pages are made of whole pages
+	if (pages != PAGES_DEFAULT) {
+		size = (size + ARENA_HUGE_PAGE - 1) & ~(ARENA_HUGE_PAGE - 1);
+	}
+	size = size ? size : ARENA_ALIGNMENT;
+
+	void *base = MAP_FAILED;
+	arena->backing = pages;
+	if (pages == PAGES_HUGETLB) {
+		base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB,
+					-1, 0);
+		if (base == MAP_FAILED) {
+			arena->backing = PAGES_THP;
+		}
+	}
+
+	if (base == MAP_FAILED) {
+		base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if (base == MAP_FAILED) {
+			fprintf(stderr, "Unable to allocate memory\n");
+			exit(1);
+		}
+
+		// the kernel may still refuse, the arena then stays on small pages
+		if (arena->backing == PAGES_THP && madvise(base, size, MADV_HUGEPAGE)) {
+			arena->backing = PAGES_DEFAULT;
+		}
+	}
+
+	arena->base = (unsigned char *)base;
+	arena->size = size;
+	arena->used = 0;
+
+	return arena;
+}
+
+void arena_destroy(arena_t *arena) {
+	munmap(arena->base, arena->size);
+	free(arena);
+}
+
+// Hands out a block of `size` bytes, aligned to ARENA_ALIGNMENT. The content of the block is
+// undefined. Exits when the arena is full.
+void *arena_alloc(arena_t *arena, size_t size) {
+	size = arena_block_size(size);
+	if (size > arena->size - arena->used) {
+		fprintf(stderr, "Arena of %zu bytes exhausted\n", arena->size);
+		exit(1);
+	}
+
+	void *block = arena->base + arena->used;
+	arena->used += size;
+
+	return block;
+}
+
+// Hands out a block of `size` bytes set to 0, like `arena_alloc`.
+void *arena_calloc(arena_t *arena, size_t size) {
+	void *block = arena_alloc(arena, size);
+	memset(block, 0, size);
+
+	return block;
+}
+
+// Releases every block of the arena, which can then be used again.
+void arena_reset(arena_t *arena) {
+	arena->used = 0;
+}
+
+// Name of a page mode, as printed by the statistics.
+const char *arena_page_name(page_mode_t pages) {
+	switch (pages) {
+	case PAGES_THP:
+		return "transparent huge pages";
+	case PAGES_HUGETLB:
+		return "huge pages";
+	default:
+		return "small pages";
+	}
+}
@@ -0,0 +1,48 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include <stddef.h>
+
+#include "config.h"
+
+// Alignment of the blocks of an arena (a cache line).
+#define ARENA_ALIGNMENT 64
+
+// Size of the huge pages the arenas are rounded to when they are backed by huge pages.
+#define ARENA_HUGE_PAGE (2UL << 20)
+
+// Memory reserved once and then handed out in blocks, which are all released together. The
+// blocks are never freed one by one.
+typedef struct {
+	unsigned char *base;
+	size_t size, used;
+	// the pages which back the arena, which may differ from the ones requested
+	page_mode_t backing;
+} arena_t;
+
+// Reserves an arena of `size` bytes, backed by the pages of `pages`. Explicit huge pages fall
+// back to transparent ones when the system has none reserved. Exits on errors.
+arena_t *arena_create(size_t size, page_mode_t pages);
+
+void arena_destroy(arena_t *arena);
+
+// Hands out a block of `size` bytes, aligned to ARENA_ALIGNMENT. The content of the block is
+// undefined. Exits when the arena is full.
+void *arena_alloc(arena_t *arena, size_t size);
+
+// Hands out a block of `size` bytes set to 0, like `arena_alloc`.
+void *arena_calloc(arena_t *arena, size_t size);
+
+// Releases every block of the arena, which can then be used again.
+void arena_reset(arena_t *arena);
+
+// Size `size` takes in an arena, with its alignment.
+static inline size_t arena_block_size(size_t size) {
+	return (size + ARENA_ALIGNMENT - 1) & ~(size_t)(ARENA_ALIGNMENT - 1);
+}
+
+// Name of a page mode, as printed by the statistics.
+const char *arena_page_name(page_mode_t pages);
+
+#endif  // ARENA_H_
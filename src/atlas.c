@@ -0,0 +1,238 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#include "atlas.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "helpers.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+
+// Copies a tile line, or several ones. `line_size` is a constant in the specializations of
+// `stamp_row`, so single lines are copied with a fixed size, which the compiler turns into a
+// couple of wide loads and stores.
+static inline __attribute__((always_inline))
+void copy_lines(unsigned char *dst, const unsigned char *src, size_t size, size_t line_size) {
+	if (size == line_size) {
+		memcpy(dst, src, line_size);
+	} else {
+		memcpy(dst, src, size);
+	}
+}
+
+static void *aligned_alloc_or_die(size_t size) {
+	// aligned_alloc needs a size which is a multiple of the alignment
+	size = (size + ATLAS_ALIGNMENT - 1) / ATLAS_ALIGNMENT * ATLAS_ALIGNMENT;
+
+	void *ptr = aligned_alloc(ATLAS_ALIGNMENT, size);
+	if (!ptr) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	return ptr;
+}
+
+// Resizes a contour image to size x size pixels, taking the nearest pixel.
+static ppm_image *resize_contour(ppm_image *contour, int size) {
+	ppm_image *resized = (ppm_image *)malloc(sizeof(ppm_image));
+	if (!resized) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	resized->x = resized->y = size;
+	resized->data = (ppm_pixel *)malloc((size_t)size * size * sizeof(ppm_pixel));
+	if (!resized->data) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	for (int i = 0; i < size; i++) {
+		for (int j = 0; j < size; j++) {
+			resized->data[i * size + j] = contour->data[(i * contour->y / size) * contour->x +
+														j * contour->x / size];
+		}
+	}
+
+	free(contour->data);
+	free(contour);
+
+	return resized;
+}
+
+// Repeats every line of the tile of configuration `k` ATLAS_RUN_TILES times.
+static void fill_runs(contour_atlas_t *atlas, int k) {
+	const unsigned char *tile = atlas_tile(atlas, k);
+
+	for (int r = 0; r < atlas->height; r++) {
+		unsigned char *run = atlas->runs +
+							 (k * atlas->height + r) * atlas->line_size * ATLAS_RUN_TILES;
+
+		for (int t = 0; t < ATLAS_RUN_TILES; t++) {
+			memcpy(run + t * atlas->line_size, tile + r * atlas->line_size, atlas->line_size);
+		}
+	}
+}
+
+// Builds the tile of a joined saddle from the tile of the other saddle, whose lines cut off the
+// same corners: the background (white, above the level) and the filled areas (grey, below the
+// level) are swapped, the lines are kept.
+static void derive_joined_saddle(contour_atlas_t *atlas, int k, int other) {
+	unsigned char *tile = atlas->tiles + k * atlas->tile_size;
+	const unsigned char *src = atlas_tile(atlas, other);
+	const unsigned char *below = atlas_tile(atlas, 15);
+	const unsigned char *above = atlas_tile(atlas, 0);
+
+	for (size_t b = 0; b < atlas->line_size * atlas->height; b++) {
+		if (src[b] == above[b]) {
+			tile[b] = below[b];
+		} else if (src[b] == below[b]) {
+			tile[b] = above[b];
+		} else {
+			tile[b] = src[b];
+		}
+	}
+
+	fill_runs(atlas, k);
+}
+
+// Loads the contour images of the CONTOUR_CONFIG_COUNT configurations from `dir`, resized to
+// size x size pixels if they have a different size, then derives the joined saddles.
+contour_atlas_t *atlas_load(const char *dir, int size) {
+	contour_atlas_t *atlas = (contour_atlas_t *)malloc(sizeof(contour_atlas_t));
+	if (!atlas) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	for (int k = 0; k < CONTOUR_CONFIG_COUNT; k++) {
+		char filename[FILENAME_MAX_SIZE];
+		snprintf(filename, sizeof(filename), "%s/%d.ppm", dir, k);
+		ppm_image *contour = read_ppm(filename);
+		if (contour->x != size || contour->y != size) {
+			contour = resize_contour(contour, size);
+		}
+
+		if (k == 0) {
+			atlas->width = contour->x;
+			atlas->height = contour->y;
+			atlas->line_size = 3 * (size_t)contour->x;
+			atlas->tile_size = (atlas->line_size * contour->y + ATLAS_ALIGNMENT - 1) /
+							   ATLAS_ALIGNMENT * ATLAS_ALIGNMENT;
+			atlas->tiles = aligned_alloc_or_die(ATLAS_TILE_COUNT * atlas->tile_size);
+			atlas->runs = aligned_alloc_or_die(ATLAS_TILE_COUNT * atlas->height *
+											   atlas->line_size * ATLAS_RUN_TILES);
+		}
+
+		// the contour images are stored line by line, `x` pixels each
+		unsigned char *tile = atlas->tiles + k * atlas->tile_size;
+		memcpy(tile, contour->data, atlas->line_size * atlas->height);
+		fill_runs(atlas, k);
+
+		free(contour->data);
+		free(contour);
+	}
+
+	derive_joined_saddle(atlas, ATLAS_JOINED_SADDLE_5, 10);
+	derive_joined_saddle(atlas, ATLAS_JOINED_SADDLE_10, 5);
+
+	return atlas;
+}
+
+void atlas_destroy(contour_atlas_t *atlas) {
+	free(atlas->tiles);
+	free(atlas->runs);
+	free(atlas);
+}
+
+// Updates a particular section of an image with the contour of a configuration. The tile is
+// copied one line at a time.
+void atlas_stamp_tile(const contour_atlas_t *atlas, ppm_image *image, int config, int x, int y) {
+	const unsigned char *tile = atlas_tile(atlas, config);
+
+	for (int i = 0; i < atlas->height; i++) {
+		copy_lines((unsigned char *)&image->data[(size_t)(x + i) * image->y + y],
+				   tile + i * atlas->line_size, atlas->line_size, atlas->line_size);
+	}
+}
+
+// Draws the contour of a configuration over a section of an image, keeping the darker value of
+// every component, so that the lines already drawn there stay visible.
+void atlas_blend_tile(const contour_atlas_t *atlas, ppm_image *image, int config, int x, int y) {
+	const unsigned char *tile = atlas_tile(atlas, config);
+
+	for (int i = 0; i < atlas->height; i++) {
+		unsigned char *dst = (unsigned char *)&image->data[(size_t)(x + i) * image->y + y];
+		const unsigned char *line = tile + i * atlas->line_size;
+
+		for (size_t b = 0; b < atlas->line_size; b++) {
+			dst[b] = MIN(dst[b], line[b]);
+		}
+	}
+}
+
+// Stamps runs of squares with the same configuration as whole lines. `step` is the size of the
+// tiles; it is a constant in the specializations below, so the sizes of the copies are known at
+// compile time.
+static inline __attribute__((always_inline))
+void stamp_row(const contour_atlas_t *atlas, ppm_image *image, int x, int y,
+			   const unsigned char *cases, int n, int step) {
+	size_t line_size = 3 * (size_t)step;
+	size_t run_size = line_size * ATLAS_RUN_TILES;
+
+	for (int j = 0; j < n;) {
+		int config = cases[j];
+		int length = 1;
+		while (j + length < n && cases[j + length] == config) {
+			length++;
+		}
+
+		const unsigned char *runs = atlas->runs + config * step * run_size;
+
+		for (int i = 0; i < step; i++) {
+			unsigned char *dst = (unsigned char *)&image->data[(size_t)(x + i) * image->y + y +
+															  (size_t)j * step];
+			const unsigned char *line = runs + i * run_size;
+
+			for (int left = length; left > 0; left -= ATLAS_RUN_TILES) {
+				size_t size = MIN(left, ATLAS_RUN_TILES) * line_size;
+				copy_lines(dst, line, size, line_size);
+				dst += size;
+			}
+		}
+
+		j += length;
+	}
+}
+
+// Stamps the contours of a row of `n` squares, whose first square starts on line `x` and
+// column `y` of the image. The squares are `step` pixels apart. Runs of squares with the same
+// configuration are copied as whole lines when the tiles are exactly `step` pixels wide.
+void atlas_stamp_row(const contour_atlas_t *atlas, ppm_image *image, int x, int y,
+					 const unsigned char *cases, int n, int step) {
+	if (atlas->width != step || atlas->height != step) {
+		for (int j = 0; j < n; j++) {
+			atlas_stamp_tile(atlas, image, cases[j], x, y + j * step);
+		}
+		return;
+	}
+
+	// specializations for the common grid steps
+	switch (step) {
+	case 4:
+		stamp_row(atlas, image, x, y, cases, n, 4);
+		break;
+	case 8:
+		stamp_row(atlas, image, x, y, cases, n, 8);
+		break;
+	case 16:
+		stamp_row(atlas, image, x, y, cases, n, 16);
+		break;
+	case 32:
+		stamp_row(atlas, image, x, y, cases, n, 32);
+		break;
+	default:
+		stamp_row(atlas, image, x, y, cases, n, step);
+	}
+}
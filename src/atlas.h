@@ -0,0 +1,61 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#ifndef ATLAS_H_
+#define ATLAS_H_
+
+#include <stddef.h>
+
+#include "helpers.h"
+
+// Alignment of the tiles in the atlas (a cache line).
+#define ATLAS_ALIGNMENT 64
+
+// Number of copies of a tile line stored next to each other, used to stamp runs of squares
+// with the same configuration.
+#define ATLAS_RUN_TILES 16
+
+// Configurations of the saddles (5 and 10) whose centre is below the level, so that the two
+// corners below it are joined. Their tiles are the tiles of the other saddle, with the areas
+// below and above the level swapped.
+#define ATLAS_JOINED_SADDLE_5 CONTOUR_CONFIG_COUNT
+#define ATLAS_JOINED_SADDLE_10 (CONTOUR_CONFIG_COUNT + 1)
+
+// Number of tiles in the atlas: the contour images and the joined saddles.
+#define ATLAS_TILE_COUNT (CONTOUR_CONFIG_COUNT + 2)
+
+// The contour images of all the configurations, stored in a single buffer. Each tile starts
+// on a cache line, its lines being stored one after the other.
+typedef struct {
+	int width, height;
+	size_t line_size;
+	size_t tile_size;
+	unsigned char *tiles;
+
+	// line `r` of configuration `k` repeated ATLAS_RUN_TILES times, for each `k` and `r`
+	unsigned char *runs;
+} contour_atlas_t;
+
+// Loads the contour images of the CONTOUR_CONFIG_COUNT configurations from `dir`, resized to
+// size x size pixels if they have a different size, then derives the joined saddles.
+contour_atlas_t *atlas_load(const char *dir, int size);
+
+void atlas_destroy(contour_atlas_t *atlas);
+
+static inline const unsigned char *atlas_tile(const contour_atlas_t *atlas, int config) {
+	return atlas->tiles + config * atlas->tile_size;
+}
+
+// Updates a particular section of an image with the contour of a configuration. The tile is
+// copied one line at a time.
+void atlas_stamp_tile(const contour_atlas_t *atlas, ppm_image *image, int config, int x, int y);
+
+// Draws the contour of a configuration over a section of an image, keeping the darker value of
+// every component, so that the lines already drawn there stay visible.
+void atlas_blend_tile(const contour_atlas_t *atlas, ppm_image *image, int config, int x, int y);
+
+// Stamps the contours of a row of `n` squares, whose first square starts on line `x` and
+// column `y` of the image. The squares are `step` pixels apart. Runs of squares with the same
+// configuration are copied as whole lines when the tiles are exactly `step` pixels wide.
+void atlas_stamp_row(const contour_atlas_t *atlas, ppm_image *image, int x, int y,
+					 const unsigned char *cases, int n, int step);
+
+#endif  // ATLAS_H_
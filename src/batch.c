@@ -0,0 +1,276 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#include "batch.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "arena.h"
+#include "atlas.h"
+#include "config.h"
+#include "helpers.h"
+#include "parallel_march.h"
+#include "pool.h"
+#include "ppm_io.h"
+#include "types.h"
+#include "utils.h"
+
+// Number of images in flight: one being read, one being processed and one being written.
+#define BATCH_SLOTS 3
+
+// An image of the batch, from reading it until it is written. The buffers of the job are carved
+// out of the arena of the slot, which is reset for every image.
+typedef struct {
+	char *in_file;
+	char *out_file;
+	ppm_image *image;
+	image_job_t job;
+	arena_t *arena;
+	const config_t *config;
+} batch_slot_t;
+
+// List of the input files.
+typedef struct {
+	char **files;
+	int nr_files;
+	int capacity;
+} file_list_t;
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static char *copy_string(const char *str) {
+	char *copy = strdup(str);
+	if (!copy) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	return copy;
+}
+
+static void add_file(file_list_t *list, char *file) {
+	if (list->nr_files == list->capacity) {
+		list->capacity = list->capacity ? 2 * list->capacity : 16;
+		list->files = (char **)realloc(list->files, list->capacity * sizeof(char *));
+		if (!list->files) {
+			fprintf(stderr, "Unable to allocate memory\n");
+			exit(1);
+		}
+	}
+
+	list->files[list->nr_files++] = file;
+}
+
+static char *join_path(const char *dir, const char *name) {
+	char *path = (char *)malloc(strlen(dir) + strlen(name) + 2);
+	if (!path) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	sprintf(path, "%s/%s", dir, name);
+	return path;
+}
+
+static int is_ppm(const struct dirent *entry) {
+	size_t len = strlen(entry->d_name);
+
+	return len > 4 && !strcmp(entry->d_name + len - 4, ".ppm");
+}
+
+// Adds the .ppm files of a directory, sorted by name.
+static void list_directory(file_list_t *list, const char *dir) {
+	struct dirent **entries;
+	int nr_entries = scandir(dir, &entries, is_ppm, alphasort);
+	if (nr_entries < 0) {
+		perror(dir);
+		exit(1);
+	}
+
+	for (int i = 0; i < nr_entries; i++) {
+		add_file(list, join_path(dir, entries[i]->d_name));
+		free(entries[i]);
+	}
+	free(entries);
+}
+
+// Adds the files of a manifest, one per line. Empty lines and lines starting with '#' are
+// skipped.
+static void list_manifest(file_list_t *list, const char *manifest) {
+	FILE *fp = fopen(manifest, "r");
+	if (!fp) {
+		fprintf(stderr, "Unable to open file '%s'\n", manifest);
+		exit(1);
+	}
+
+	char *line = NULL;
+	size_t size = 0;
+	while (getline(&line, &size, fp) != -1) {
+		line[strcspn(line, "\r\n")] = '\0';
+		if (line[0] == '\0' || line[0] == '#') {
+			continue;
+		}
+
+		add_file(list, copy_string(line));
+	}
+
+	free(line);
+	fclose(fp);
+}
+
+// Names the output file after the input file, in the output directory.
+static char *output_path(const char *out_dir, const char *in_file) {
+	const char *name = strrchr(in_file, '/');
+
+	return join_path(out_dir, name ? name + 1 : in_file);
+}
+
+static void read_slot(void *arg) {
+	batch_slot_t *slot = (batch_slot_t *)arg;
+
+	slot->image = ppm_map(slot->in_file);
+	image_from_file(slot->config, slot->image);
+}
+
+// Writes the result and frees the memory of the image.
+static void write_slot(void *arg) {
+	batch_slot_t *slot = (batch_slot_t *)arg;
+	ppm_image file = image_to_file(slot->config, slot->job.scaled_image);
+
+	write_ppm(&file, slot->out_file);
+	job_destroy(&slot->job);
+}
+
+static void process_slot(void *arg) {
+	process_image((thread_arg_t *)arg);
+}
+
+// Processes every image listed in `config->in_file`, which is either a directory (all its
+// .ppm files) or a manifest with one path per line, writing the results with the same names
+// in the directory `config->out_file`. The threads and the contour atlas are shared by all
+// the images and the next image is read while the previous one is written. Returns the exit
+// status of the program.
+int batch_run(const config_t *config) {
+	file_list_t inputs = {NULL, 0, 0};
+	struct stat st;
+
+	if (stat(config->in_file, &st)) {
+		perror(config->in_file);
+		exit(1);
+	}
+	if (S_ISDIR(st.st_mode)) {
+		list_directory(&inputs, config->in_file);
+	} else {
+		list_manifest(&inputs, config->in_file);
+	}
+
+	if (mkdir(config->out_file, 0755) && errno != EEXIST) {
+		perror(config->out_file);
+		exit(1);
+	}
+
+	// load the contours of all the configurations, once for all the images
+	contour_atlas_t *atlas = atlas_load("./contours", config->step);
+
+	int max_threads = config->nr_threads;
+	if (max_threads == CONFIG_AUTO_THREADS) {
+		max_threads = available_cpus();
+	}
+
+	worker_pool_t *workers = pool_create("worker", max_threads);
+	worker_pool_t *reader = pool_create("reader", 1);
+	worker_pool_t *writer = pool_create("writer", 1);
+
+	thread_arg_t *thread_args = (thread_arg_t *)malloc(max_threads * sizeof(thread_arg_t));
+	if (!thread_args) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	// the arenas are large enough for any image of the batch
+	batch_slot_t slots[BATCH_SLOTS];
+	for (int i = 0; i < BATCH_SLOTS; i++) {
+		slots[i].arena = arena_create(job_arena_size(config, NULL, max_threads), config->pages);
+		slots[i].config = config;
+	}
+	if (config->stats) {
+		fprintf(stderr, "arenas: %d x %.1f MiB, %s\n", BATCH_SLOTS,
+				slots[0].arena->size / 1048576.0, arena_page_name(slots[0].arena->backing));
+	}
+
+	pthread_barrier_t barrier;
+	double start = now();
+
+	if (inputs.nr_files > 0) {
+		slots[0].in_file = inputs.files[0];
+		pool_start(reader, 1, read_slot, &slots[0], sizeof(batch_slot_t));
+	}
+
+	for (int k = 0; k < inputs.nr_files; k++) {
+		batch_slot_t *slot = &slots[k % BATCH_SLOTS];
+
+		// wait for the image, then start reading the next one
+		pool_wait(reader);
+		if (k + 1 < inputs.nr_files) {
+			batch_slot_t *next = &slots[(k + 1) % BATCH_SLOTS];
+
+			next->in_file = inputs.files[k + 1];
+			pool_start(reader, 1, read_slot, next, sizeof(batch_slot_t));
+		}
+
+		job_init(&slot->job, config, slot->image, max_threads, &barrier, slot->arena);
+		pthread_barrier_init(&barrier, NULL, slot->job.nr_threads);
+		job_set_args(&slot->job, config, atlas, &barrier, thread_args);
+
+		pool_run(workers, slot->job.nr_threads, process_slot, thread_args,
+				 sizeof(thread_arg_t));
+		pthread_barrier_destroy(&barrier);
+
+		// the previous image must be written before starting to write this one
+		if (k > 0) {
+			pool_wait(writer);
+		}
+		slot->out_file = output_path(config->out_file, slot->in_file);
+		pool_start(writer, 1, write_slot, slot, sizeof(batch_slot_t));
+
+		// the output path of the previous image is no longer used
+		if (k > 0) {
+			free(slots[(k - 1) % BATCH_SLOTS].out_file);
+		}
+	}
+
+	if (inputs.nr_files > 0) {
+		pool_wait(writer);
+		free(slots[(inputs.nr_files - 1) % BATCH_SLOTS].out_file);
+	}
+
+	double elapsed = now() - start;
+	fprintf(stderr, "%d images in %.3f s (%.1f images/s)\n", inputs.nr_files, elapsed,
+			elapsed > 0 ? inputs.nr_files / elapsed : 0.0);
+
+	pool_destroy(workers);
+	pool_destroy(reader);
+	pool_destroy(writer);
+	atlas_destroy(atlas);
+	free(thread_args);
+
+	for (int i = 0; i < BATCH_SLOTS; i++) {
+		arena_destroy(slots[i].arena);
+	}
+
+	for (int i = 0; i < inputs.nr_files; i++) {
+		free(inputs.files[i]);
+	}
+	free(inputs.files);
+
+	return 0;
+}
@@ -0,0 +1,14 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#ifndef BATCH_H_
+#define BATCH_H_
+
+#include "config.h"
+
+// Processes every image listed in `config->in_file`, which is either a directory (all its
+// .ppm files) or a manifest with one path per line, writing the results with the same names
+// in the directory `config->out_file`. The threads and the contour atlas are shared by all
+// the images and the next image is read while the previous one is written. Returns the exit
+// status of the program.
+int batch_run(const config_t *config);
+
+#endif  // BATCH_H_
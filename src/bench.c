@@ -0,0 +1,1039 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "atlas.h"
+#include "config.h"
+#include "filter.h"
+#include "grid.h"
+#include "helpers.h"
+#include "parallel_march.h"
+#include "pool.h"
+#include "ppm_io.h"
+#include "resample.h"
+#include "types.h"
+#include "utils.h"
+
+// Bounds of the sides of the synthetic images.
+#define BENCH_MIN_SIDE 16
+#define BENCH_MAX_SIDE 16384
+
+#define BENCH_MAX_SIZES 32
+#define BENCH_MAX_THREAD_COUNTS 32
+
+// Ways of scaling compared by `compare_filters`: every filter, then the bicubic one with the
+// fixed-point kernels, in the reference view and row by row.
+#define NR_VARIANTS (NR_FILTERS + 2)
+#define VARIANT_FIXED NR_FILTERS
+#define VARIANT_FIXED_ROW_MAJOR (NR_FILTERS + 1)
+
+// Phases of the program which are timed, in the order in which they run.
+enum {
+	PHASE_READ,
+	PHASE_RESCALE,
+	PHASE_GRID,
+	PHASE_MARCH,
+	PHASE_WRITE,
+	PHASE_TOTAL,
+	NR_PHASES,
+};
+
+static const char *const phase_names[NR_PHASES] = {
+	"read", "rescale", "grid", "march", "write", "total",
+};
+
+typedef enum {
+	FORMAT_CSV,
+	FORMAT_JSON,
+} format_t;
+
+typedef struct {
+	int nr_sizes;
+	int widths[BENCH_MAX_SIZES], heights[BENCH_MAX_SIZES];
+	int nr_thread_counts;
+	int thread_counts[BENCH_MAX_THREAD_COUNTS];
+	int repeat;
+	const char *dir;
+	const char *reference;
+	format_t format;
+	simd_isa_t isa;
+	int fixed_point;
+	filter_t filter;
+	// directory of the images on which the fixed-point kernels are checked, or NULL
+	const char *corpus;
+} bench_options_t;
+
+// Best time of every phase, for a size and a number of threads.
+typedef struct {
+	int nr_threads;
+	double seconds[NR_PHASES];
+} bench_run_t;
+
+// Best time of scaling the whole image in one way, on one thread, and how far its pixels and
+// the points of its grid are from the ones of the float bicubic kernels.
+typedef struct {
+	double seconds;
+	int max_error;
+	long nr_errors;
+	double psnr;
+	long flipped_points;
+} bench_filter_t;
+
+// Results for a size: the runs of the program, then the sequential reference, whose I/O
+// functions are timed on their own and whose whole run is timed as a separate process.
+typedef struct {
+	int width, height;
+	int scaled;
+	bench_run_t runs[BENCH_MAX_THREAD_COUNTS];
+	double read_ppm, write_ppm;
+	// wall time of the reference, negative when it was not run
+	double reference;
+	int matches_reference;
+
+	// the ways of scaling the image, and the number of points of its grid
+	bench_filter_t filters[NR_VARIANTS];
+	long nr_points;
+} bench_size_t;
+
+// Arguments of a thread which writes its band of rows.
+typedef struct {
+	ppm_writer_t *writer;
+	ppm_image *image;
+	int first_row, end_row;
+} write_arg_t;
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void print_usage(const char *prog) {
+	fprintf(stderr, "Usage: %s [options]\n", prog);
+	fprintf(stderr, "Run from the directory of ./contours. Options:\n");
+	fprintf(stderr, "  --sizes=<WxH,..>   sizes of the synthetic inputs, from %d to %d pixels\n",
+			BENCH_MIN_SIDE, BENCH_MAX_SIDE);
+	fprintf(stderr, "                     (default 512x512,1024x768,2048x2048,4096x3072)\n");
+	fprintf(stderr, "  --threads=<a,b,..> numbers of threads (default powers of 2 up to the "
+			"CPUs)\n");
+	fprintf(stderr, "  --repeat=<n>       runs of every measure, the best one is kept "
+			"(default 3)\n");
+	fprintf(stderr, "  --dir=<d>          directory of the inputs and outputs (default "
+			"bench_data)\n");
+	fprintf(stderr, "  --reference=<p>    sequential reference, none to skip it (default "
+			"./tema1)\n");
+	fprintf(stderr, "  --format=<f>       csv (default) or json\n");
+	fprintf(stderr, "  --simd=<isa>       vector kernels: auto, avx2, sse or scalar\n");
+	fprintf(stderr, "  --fixed-point      run the program with the fixed-point kernels\n");
+	fprintf(stderr, "  --filter=<f>       run the program with this rescale filter: bicubic\n");
+	fprintf(stderr, "                     (default), nearest, area, bilinear or lanczos\n");
+	fprintf(stderr, "  --corpus=<d>       images on which the fixed-point kernels are checked,\n");
+	fprintf(stderr, "                     none to skip them (default inputs)\n");
+}
+
+// Parses a number of an option, in [min, max]. Exits on invalid values.
+static int parse_number(const char *arg, int min, int max, const char *what) {
+	char *end;
+	errno = 0;
+	long value = strtol(arg, &end, 10);
+	if (errno || end == arg || *end || value < min || value > max) {
+		fprintf(stderr, "Invalid %s '%s'\n", what, arg);
+		exit(1);
+	}
+
+	return (int)value;
+}
+
+// Splits a comma separated list in place, calling `fn` for each item. Exits if there are more
+// than `max` items.
+static int split_list(char *list, int max, const char *what,
+					  void (*fn)(const char *item, int index, void *ctx), void *ctx) {
+	char *saveptr;
+	int n = 0;
+
+	for (char *item = strtok_r(list, ",", &saveptr); item;
+		 item = strtok_r(NULL, ",", &saveptr)) {
+		if (n == max) {
+			fprintf(stderr, "Too many %s\n", what);
+			exit(1);
+		}
+		fn(item, n++, ctx);
+	}
+
+	if (!n) {
+		fprintf(stderr, "Invalid %s\n", what);
+		exit(1);
+	}
+	return n;
+}
+
+static void parse_size(const char *item, int index, void *ctx) {
+	bench_options_t *options = (bench_options_t *)ctx;
+	char buf[32];
+	const char *sep = strchr(item, 'x');
+	if (!sep || (size_t)(sep - item) >= sizeof(buf)) {
+		fprintf(stderr, "Invalid size '%s'\n", item);
+		exit(1);
+	}
+
+	memcpy(buf, item, sep - item);
+	buf[sep - item] = '\0';
+	options->widths[index] = parse_number(buf, BENCH_MIN_SIDE, BENCH_MAX_SIDE, "size");
+	options->heights[index] = parse_number(sep + 1, BENCH_MIN_SIDE, BENCH_MAX_SIDE, "size");
+}
+
+static void parse_thread_count(const char *item, int index, void *ctx) {
+	bench_options_t *options = (bench_options_t *)ctx;
+
+	options->thread_counts[index] = parse_number(item, 1, CONFIG_MAX_THREADS,
+												 "number of threads");
+}
+
+static char *copy_string(const char *str) {
+	char *copy = strdup(str);
+	if (!copy) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	return copy;
+}
+
+// Parses the command line arguments into `options`. Exits on invalid arguments.
+static void parse_options(int argc, char *argv[], bench_options_t *options) {
+	static const struct option long_options[] = {
+		{"sizes", required_argument, NULL, 'z'},
+		{"threads", required_argument, NULL, 'n'},
+		{"repeat", required_argument, NULL, 'r'},
+		{"dir", required_argument, NULL, 'd'},
+		{"reference", required_argument, NULL, 'e'},
+		{"format", required_argument, NULL, 'f'},
+		{"simd", required_argument, NULL, 's'},
+		{"fixed-point", no_argument, NULL, 'x'},
+		{"filter", required_argument, NULL, 'l'},
+		{"corpus", required_argument, NULL, 'c'},
+		{NULL, 0, NULL, 0}
+	};
+	char *sizes = copy_string("512x512,1024x768,2048x2048,4096x3072");
+	char *threads = NULL;
+
+	memset(options, 0, sizeof(*options));
+	options->repeat = 3;
+	options->dir = "bench_data";
+	options->reference = "./tema1";
+	options->corpus = "inputs";
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'z':
+			free(sizes);
+			sizes = copy_string(optarg);
+			break;
+		case 'n':
+			free(threads);
+			threads = copy_string(optarg);
+			break;
+		case 'r':
+			options->repeat = parse_number(optarg, 1, 1000, "repeat count");
+			break;
+		case 'd':
+			options->dir = optarg;
+			break;
+		case 'e':
+			options->reference = strcmp(optarg, "none") ? optarg : NULL;
+			break;
+		case 'f':
+			if (!strcmp(optarg, "csv")) {
+				options->format = FORMAT_CSV;
+			} else if (!strcmp(optarg, "json")) {
+				options->format = FORMAT_JSON;
+			} else {
+				fprintf(stderr, "Unknown format '%s'\n", optarg);
+				exit(1);
+			}
+			break;
+		case 's':
+			if (simd_isa_from_name(optarg, &options->isa)) {
+				fprintf(stderr, "Unknown instruction set '%s'\n", optarg);
+				exit(1);
+			}
+			break;
+		case 'x':
+			options->fixed_point = 1;
+			break;
+		case 'c':
+			options->corpus = strcmp(optarg, "none") ? optarg : NULL;
+			break;
+		case 'l':
+			if (filter_from_name(optarg, &options->filter)) {
+				fprintf(stderr, "Unknown filter '%s'\n", optarg);
+				exit(1);
+			}
+			break;
+		default:
+			print_usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	if (optind != argc) {
+		print_usage(argv[0]);
+		exit(1);
+	}
+
+	options->nr_sizes = split_list(sizes, BENCH_MAX_SIZES, "sizes", parse_size, options);
+	free(sizes);
+
+	if (threads) {
+		options->nr_thread_counts = split_list(threads, BENCH_MAX_THREAD_COUNTS,
+											   "numbers of threads", parse_thread_count,
+											   options);
+		free(threads);
+	} else {
+		// the powers of 2 below the number of CPUs, then the number of CPUs
+		int cpus = available_cpus();
+		for (int p = 1; p < cpus && options->nr_thread_counts < BENCH_MAX_THREAD_COUNTS - 1;
+			 p *= 2) {
+			options->thread_counts[options->nr_thread_counts++] = p;
+		}
+		options->thread_counts[options->nr_thread_counts++] = cpus;
+	}
+
+	// the speedups are computed from the first count
+	if (options->thread_counts[0] != 1) {
+		fprintf(stderr, "The first number of threads must be 1\n");
+		exit(1);
+	}
+
+	if (options->fixed_point && options->filter != FILTER_BICUBIC) {
+		fprintf(stderr, "--filter cannot be used with --fixed-point\n");
+		exit(1);
+	}
+}
+
+static char *make_path(const char *dir, const char *name, int width, int height, int threads) {
+	char *path = (char *)malloc(strlen(dir) + strlen(name) + 64);
+	if (!path) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	if (threads) {
+		sprintf(path, "%s/%s_%dx%d_%d.ppm", dir, name, width, height, threads);
+	} else {
+		sprintf(path, "%s/%s_%dx%d.ppm", dir, name, width, height);
+	}
+	return path;
+}
+
+// Mixes the bits of a counter, to get the same noise on every machine.
+static uint32_t hash32(uint32_t v) {
+	v ^= v >> 16;
+	v *= 0x7feb352d;
+	v ^= v >> 15;
+	v *= 0x846ca68b;
+	v ^= v >> 16;
+	return v;
+}
+
+// Value of a triangle wave of period 1024 and amplitude 512 at `v`, which may be negative.
+static int triangle(int v) {
+	return abs(((v % 1024) + 1024) % 1024 - 512);
+}
+
+// Scales a wave value in [0, 512] with 4 bits of noise to a channel, clamped to 255.
+static unsigned char wave_channel(int wave, uint32_t noise) {
+	int value = (wave * 255 / 512 + (int)(noise & 15)) * 15 / 16;
+
+	return value > RGB_COMPONENT_COLOR ? RGB_COMPONENT_COLOR : value;
+}
+
+// Writes a synthetic image of width x height pixels: smooth waves whose period depends on the
+// size, so that the isolines cross the scaled image at every size, with a little noise. Only
+// integer arithmetic is used, so the image is the same everywhere.
+static void generate_image(const char *path, int width, int height) {
+	FILE *fp = fopen(path, "wb");
+	if (!fp) {
+		fprintf(stderr, "Unable to open file '%s'\n", path);
+		exit(1);
+	}
+
+	ppm_pixel *row = (ppm_pixel *)malloc((size_t)width * sizeof(ppm_pixel));
+	if (!row) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	fprintf(fp, "P6\n%d %d\n%d\n", width, height, RGB_COMPONENT_COLOR);
+
+	// a wave is a triangle of period 1024 in units of 1/64 of the side
+	for (int y = 0; y < height; y++) {
+		int wy = (int)((int64_t)y * 64 * 1024 * 7 / height);
+
+		for (int x = 0; x < width; x++) {
+			int wx = (int)((int64_t)x * 64 * 1024 * 5 / width);
+			int a = triangle(wx + wy / 2);
+			int b = triangle(wy - wx / 3);
+			uint32_t noise = hash32((uint32_t)y * 65537u + (uint32_t)x);
+
+			row[x].red = wave_channel(a, noise);
+			row[x].green = wave_channel(b, noise >> 4);
+			row[x].blue = wave_channel((a + b) / 2, noise >> 8);
+		}
+
+		if (fwrite(row, sizeof(ppm_pixel), width, fp) != (size_t)width) {
+			fprintf(stderr, "Unable to write file '%s'\n", path);
+			exit(1);
+		}
+	}
+
+	free(row);
+	if (fclose(fp)) {
+		fprintf(stderr, "Unable to write file '%s'\n", path);
+		exit(1);
+	}
+}
+
+static void rescale_phase(void *arg) {
+	bicubic_interpolation((thread_arg_t *)arg);
+}
+
+static void grid_phase(void *arg) {
+	bulid_grid_of_points((thread_arg_t *)arg);
+}
+
+static void march_phase(void *arg) {
+	march((thread_arg_t *)arg);
+}
+
+static void write_phase(void *arg) {
+	write_arg_t *w = (write_arg_t *)arg;
+
+	ppm_writer_write_rows(w->writer, w->image, w->first_row, w->end_row);
+}
+
+// Runs `fn` on the threads and returns the time it took.
+static double time_phase(worker_pool_t *pool, int nr_threads, pool_fn fn, void *args,
+						 size_t arg_size) {
+	double start = now();
+
+	pool_run(pool, nr_threads, fn, args, arg_size);
+	return now() - start;
+}
+
+static void keep_best(double *best, double seconds) {
+	if (*best < 0 || seconds < *best) {
+		*best = seconds;
+	}
+}
+
+// Processes `in_file` with `config->nr_threads` threads, phase by phase, like the static
+// schedule, keeping the best time of every phase over the repeats. The result is written in
+// `out_file`.
+static void run_program(const config_t *config, contour_atlas_t *atlas,
+						worker_pool_t *pool, const char *in_file, const char *out_file,
+						int repeat, bench_run_t *run) {
+	for (int k = 0; k < NR_PHASES; k++) {
+		run->seconds[k] = -1;
+	}
+
+	for (int r = 0; r < repeat; r++) {
+		double seconds[NR_PHASES] = {0};
+		pthread_barrier_t barrier;
+		image_job_t job;
+
+		// the pixels are mapped, so reading them is paid by the first phase which reads them
+		double start = now();
+		ppm_image *image = ppm_map(in_file);
+		seconds[PHASE_READ] = now() - start;
+
+		job_init(&job, config, image, config->nr_threads, &barrier, NULL);
+		run->nr_threads = job.nr_threads;
+		pthread_barrier_init(&barrier, NULL, job.nr_threads);
+
+		thread_arg_t *args = (thread_arg_t *)malloc(job.nr_threads * sizeof(thread_arg_t));
+		write_arg_t *write_args = (write_arg_t *)malloc(job.nr_threads * sizeof(write_arg_t));
+		if (!args || !write_args) {
+			fprintf(stderr, "Unable to allocate memory\n");
+			exit(1);
+		}
+		job_set_args(&job, config, atlas, &barrier, args);
+
+		if (job.image != job.scaled_image) {
+			seconds[PHASE_RESCALE] = time_phase(pool, job.nr_threads, rescale_phase, args,
+												sizeof(thread_arg_t));
+		}
+		seconds[PHASE_GRID] = time_phase(pool, job.nr_threads, grid_phase, args,
+										 sizeof(thread_arg_t));
+		seconds[PHASE_MARCH] = time_phase(pool, job.nr_threads, march_phase, args,
+										  sizeof(thread_arg_t));
+
+		// every thread writes an equal band of rows
+		start = now();
+		ppm_image file = image_to_file(config, job.scaled_image);
+		ppm_writer_t *writer = ppm_writer_open(out_file, &file);
+		for (int i = 0; i < job.nr_threads; i++) {
+			write_args[i].writer = writer;
+			write_args[i].image = job.scaled_image;
+			write_args[i].first_row = (int64_t)i * job.scaled_image->x / job.nr_threads;
+			write_args[i].end_row = (int64_t)(i + 1) * job.scaled_image->x / job.nr_threads;
+		}
+		pool_run(pool, job.nr_threads, write_phase, write_args, sizeof(write_arg_t));
+		ppm_writer_close(writer);
+		seconds[PHASE_WRITE] = now() - start;
+
+		for (int k = 0; k < PHASE_TOTAL; k++) {
+			seconds[PHASE_TOTAL] += seconds[k];
+		}
+		for (int k = 0; k < NR_PHASES; k++) {
+			keep_best(&run->seconds[k], seconds[k]);
+		}
+
+		pthread_barrier_destroy(&barrier);
+		free(write_args);
+		free(args);
+		job_destroy(&job);
+	}
+}
+
+// Times `read_ppm` and `write_ppm`, the I/O functions of the sequential reference, keeping the
+// best times over the repeats.
+static void run_reference_io(const char *in_file, const char *out_file, int repeat,
+							 bench_size_t *size) {
+	size->read_ppm = -1;
+	size->write_ppm = -1;
+
+	for (int r = 0; r < repeat; r++) {
+		double start = now();
+		ppm_image *image = read_ppm(in_file);
+		keep_best(&size->read_ppm, now() - start);
+
+		start = now();
+		write_ppm(image, out_file);
+		keep_best(&size->write_ppm, now() - start);
+
+		free(image->data);
+		free(image);
+	}
+}
+
+// Runs the sequential reference on `in_file` as a separate process and returns its best wall
+// time over the repeats, or a negative value if it failed.
+static double run_reference(const char *reference, const char *in_file, const char *out_file,
+							int repeat) {
+	double best = -1;
+
+	for (int r = 0; r < repeat; r++) {
+		double start = now();
+		pid_t pid = fork();
+		if (pid < 0) {
+			fprintf(stderr, "Unable to run '%s'\n", reference);
+			return -1;
+		}
+		if (!pid) {
+			execl(reference, reference, in_file, out_file, (char *)NULL);
+			_exit(127);
+		}
+
+		int status;
+		if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status)) {
+			fprintf(stderr, "'%s' failed on '%s'\n", reference, in_file);
+			return -1;
+		}
+		keep_best(&best, now() - start);
+	}
+
+	return best;
+}
+
+// Compares `actual` with `expected`, the float bicubic result, pixel by pixel and on the
+// points of the grid, whose value depends on the side of the threshold they fall on.
+static void compare_images(const config_t *config, const ppm_image *expected,
+						   const ppm_image *actual, bench_filter_t *result) {
+	const unsigned char *first = (const unsigned char *)expected->data;
+	const unsigned char *second = (const unsigned char *)actual->data;
+	size_t n = (size_t)3 * expected->x * expected->y;
+	double squares = 0;
+
+	result->max_error = 0;
+	result->nr_errors = 0;
+	for (size_t k = 0; k < n; k++) {
+		int error = abs(first[k] - second[k]);
+
+		if (error) {
+			result->nr_errors++;
+			result->max_error = error > result->max_error ? error : result->max_error;
+			squares += (double)error * error;
+		}
+	}
+	result->psnr = squares > 0 ? 10 * log10(255.0 * 255.0 * n / squares) : INFINITY;
+
+	result->flipped_points = 0;
+	for (int i = 0; i < expected->x; i += config->step) {
+		for (int j = 0; j < expected->y; j += config->step) {
+			size_t k = (size_t)i * expected->y + j;
+
+			if (grid_threshold(expected->data[k], config->sigma) !=
+				grid_threshold(actual->data[k], config->sigma)) {
+				result->flipped_points++;
+			}
+		}
+	}
+}
+
+// Scales the whole of `image`, given in the view of the files, to the size of the options,
+// on one thread, keeping the best time over the repeats in `seconds` if it is not NULL. With
+// `row_major`, the image is scaled row by row, the result being in the row-major view.
+static ppm_image *scale_whole(const config_t *config, const ppm_image *image, int row_major,
+							  int fixed, filter_t filter, int repeat, double *seconds) {
+	// the row-major view swaps the sides, like `image_from_file`
+	ppm_image view = *image;
+	int dst_x = config->rescale_x;
+	int dst_y = config->rescale_y;
+	if (row_major) {
+		view.x = image->y;
+		view.y = image->x;
+		dst_x = config->rescale_y;
+		dst_y = config->rescale_x;
+	}
+
+	int *cols = (int *)malloc(dst_y * sizeof(int));
+	int *rows = (int *)malloc(dst_x * sizeof(int));
+	if (!cols || !rows) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	for (int j = 0; j < dst_y; j++) {
+		cols[j] = j;
+	}
+	for (int i = 0; i < dst_x; i++) {
+		rows[i] = i;
+	}
+
+	resample_plan_t *plan = resample_plan_create(&view, dst_x, dst_y, cols, dst_y, row_major,
+												 fixed, filter, config->isa);
+	ppm_image *scaled = ppm_alloc(dst_x, dst_y);
+
+	if (seconds) {
+		*seconds = -1;
+	}
+	for (int r = 0; r < repeat; r++) {
+		double start = now();
+		resample_rows(plan, &view, scaled, rows, dst_x);
+		if (seconds) {
+			keep_best(seconds, now() - start);
+		}
+	}
+
+	resample_plan_destroy(plan);
+	free(rows);
+	free(cols);
+
+	return scaled;
+}
+
+// Scales the whole of `in_file` with every filter and with the fixed-point bicubic kernels, in
+// both views, on one thread, keeping the best times over the repeats, and compares the results
+// with the ones of the float bicubic kernels of the same view.
+static void compare_filters(const config_t *config, const char *in_file, int repeat,
+							bench_size_t *size) {
+	ppm_image *image = ppm_map(in_file);
+	ppm_image *scaled[NR_VARIANTS];
+
+	for (int v = 0; v < NR_VARIANTS; v++) {
+		int fixed = v == VARIANT_FIXED || v == VARIANT_FIXED_ROW_MAJOR;
+		filter_t filter = fixed ? FILTER_BICUBIC : (filter_t)v;
+
+		scaled[v] = scale_whole(config, image, v == VARIANT_FIXED_ROW_MAJOR, fixed, filter,
+								repeat, &size->filters[v].seconds);
+	}
+	ppm_image *row_major = scale_whole(config, image, 1, 0, FILTER_BICUBIC, 1, NULL);
+
+	for (int v = 0; v < NR_VARIANTS; v++) {
+		compare_images(config, v == VARIANT_FIXED_ROW_MAJOR ? row_major : scaled[FILTER_BICUBIC],
+					   scaled[v], &size->filters[v]);
+	}
+
+	for (int v = 0; v < NR_VARIANTS; v++) {
+		ppm_unmap(scaled[v]);
+	}
+	ppm_unmap(row_major);
+	ppm_unmap(image);
+}
+
+// Checks if a file starts like a P6 image, so that the pointers of git-lfs and the other files
+// of the corpus are skipped instead of failing `ppm_map`.
+static int is_ppm_file(const char *path) {
+	char magic[2];
+	FILE *fp = fopen(path, "rb");
+	int ppm = fp && fread(magic, 1, sizeof(magic), fp) == sizeof(magic) && magic[0] == 'P' &&
+			  magic[1] == '6';
+
+	if (fp) {
+		fclose(fp);
+	}
+	return ppm;
+}
+
+// Scales the images of `dir` which are larger than the scaled size with the float and the
+// fixed-point bicubic kernels, in both views, and prints the largest difference. Returns 1 if a
+// fixed-point pixel is more than one off, 0 otherwise.
+static int check_corpus(const config_t *config, const char *dir) {
+	DIR *corpus = opendir(dir);
+	if (!corpus) {
+		return 0;
+	}
+
+	int status = 0;
+	struct dirent *entry;
+	while ((entry = readdir(corpus))) {
+		size_t length = strlen(entry->d_name);
+		if (length < 4 || strcmp(entry->d_name + length - 4, ".ppm")) {
+			continue;
+		}
+
+		char *path = (char *)malloc(strlen(dir) + length + 2);
+		if (!path) {
+			fprintf(stderr, "Unable to allocate memory\n");
+			exit(1);
+		}
+		sprintf(path, "%s/%s", dir, entry->d_name);
+		if (!is_ppm_file(path)) {
+			free(path);
+			continue;
+		}
+
+		ppm_image *image = ppm_map(path);
+		if (image->x > config->rescale_x || image->y > config->rescale_y) {
+			int errors[2];
+			for (int row_major = 0; row_major <= 1; row_major++) {
+				ppm_image *expected = scale_whole(config, image, row_major, 0, FILTER_BICUBIC, 1,
+												  NULL);
+				ppm_image *actual = scale_whole(config, image, row_major, 1, FILTER_BICUBIC, 1,
+												NULL);
+				bench_filter_t result;
+
+				compare_images(config, expected, actual, &result);
+				errors[row_major] = result.max_error;
+				ppm_unmap(actual);
+				ppm_unmap(expected);
+			}
+
+			fprintf(stderr, "%s: the fixed-point kernels are %d off, %d off row by row\n", path,
+					errors[0], errors[1]);
+			status |= errors[0] > 1 || errors[1] > 1;
+		}
+
+		ppm_unmap(image);
+		free(path);
+	}
+
+	closedir(corpus);
+	return status;
+}
+
+static const char *variant_name(int variant) {
+	if (variant == VARIANT_FIXED_ROW_MAJOR) {
+		return "bicubic_fixed_row_major";
+	}
+	return variant == VARIANT_FIXED ? "bicubic_fixed" : filter_name((filter_t)variant);
+}
+
+// Checks if two files have the same content.
+static int same_files(const char *first, const char *second) {
+	FILE *a = fopen(first, "rb");
+	FILE *b = fopen(second, "rb");
+	int same = a && b;
+	char buf_a[65536], buf_b[65536];
+
+	while (same) {
+		size_t n = fread(buf_a, 1, sizeof(buf_a), a);
+		if (fread(buf_b, 1, sizeof(buf_b), b) != n || memcmp(buf_a, buf_b, n)) {
+			same = 0;
+		}
+		if (n < sizeof(buf_a)) {
+			break;
+		}
+	}
+
+	if (a) {
+		fclose(a);
+	}
+	if (b) {
+		fclose(b);
+	}
+	return same;
+}
+
+static double speedup(const bench_size_t *size, int run, int phase) {
+	double base = size->runs[0].seconds[phase];
+	double seconds = size->runs[run].seconds[phase];
+
+	return seconds > 0 ? base / seconds : NAN;
+}
+
+static void print_csv(FILE *fp, const bench_size_t *sizes, int nr_sizes, int nr_runs) {
+	fprintf(fp, "width,height,threads,phase,seconds,speedup,efficiency,vs_reference,max_error,"
+			"psnr,flipped_points\n");
+
+	for (int s = 0; s < nr_sizes; s++) {
+		const bench_size_t *size = &sizes[s];
+
+		for (int r = 0; r < nr_runs; r++) {
+			const bench_run_t *run = &size->runs[r];
+
+			for (int k = 0; k < NR_PHASES; k++) {
+				// the phase does not run when the image is not scaled
+				if (k == PHASE_RESCALE && !size->scaled) {
+					continue;
+				}
+
+				double up = speedup(size, r, k);
+				fprintf(fp, "%d,%d,%d,%s,%.6f,%.3f,%.3f,", size->width, size->height,
+						run->nr_threads, phase_names[k], run->seconds[k], up,
+						up / run->nr_threads);
+				if (k == PHASE_TOTAL && size->reference > 0) {
+					fprintf(fp, "%.3f", size->reference / run->seconds[k]);
+				}
+				fprintf(fp, ",,,\n");
+			}
+		}
+
+		fprintf(fp, "%d,%d,1,read_ppm,%.6f,,,,,,\n", size->width, size->height,
+				size->read_ppm);
+		fprintf(fp, "%d,%d,1,write_ppm,%.6f,,,,,,\n", size->width, size->height,
+				size->write_ppm);
+		if (size->reference > 0) {
+			fprintf(fp, "%d,%d,1,reference,%.6f,,,,,,\n", size->width, size->height,
+					size->reference);
+		}
+
+		// the speedups of the filters are over the float bicubic kernels, the identical
+		// results having no psnr
+		if (!size->scaled) {
+			continue;
+		}
+		for (int v = 0; v < NR_VARIANTS; v++) {
+			const bench_filter_t *filter = &size->filters[v];
+
+			fprintf(fp, "%d,%d,1,rescale_%s,%.6f,%.3f,,,%d,", size->width, size->height,
+					variant_name(v), filter->seconds,
+					size->filters[FILTER_BICUBIC].seconds / filter->seconds, filter->max_error);
+			if (isfinite(filter->psnr)) {
+				fprintf(fp, "%.2f", filter->psnr);
+			}
+			fprintf(fp, ",%ld\n", filter->flipped_points);
+		}
+	}
+}
+
+static void print_json(FILE *fp, const bench_options_t *options, const bench_size_t *sizes,
+					   int nr_runs) {
+	fprintf(fp, "{\n  \"cpus\": %d,\n  \"repeat\": %d,\n  \"sizes\": [\n", available_cpus(),
+			options->repeat);
+
+	for (int s = 0; s < options->nr_sizes; s++) {
+		const bench_size_t *size = &sizes[s];
+
+		fprintf(fp, "    {\n      \"width\": %d,\n      \"height\": %d,\n      \"scaled\": %s,\n",
+				size->width, size->height, size->scaled ? "true" : "false");
+		fprintf(fp, "      \"read_ppm\": %.6f,\n      \"write_ppm\": %.6f,\n", size->read_ppm,
+				size->write_ppm);
+		if (size->reference > 0 && !options->fixed_point && options->filter == FILTER_BICUBIC) {
+			fprintf(fp, "      \"reference\": %.6f,\n      \"matches_reference\": %s,\n",
+					size->reference, size->matches_reference ? "true" : "false");
+		} else if (size->reference > 0) {
+			fprintf(fp, "      \"reference\": %.6f,\n      \"matches_reference\": null,\n",
+					size->reference);
+		} else {
+			fprintf(fp, "      \"reference\": null,\n      \"matches_reference\": null,\n");
+		}
+		if (size->scaled) {
+			fprintf(fp, "      \"points\": %ld,\n      \"filters\": [\n", size->nr_points);
+			for (int v = 0; v < NR_VARIANTS; v++) {
+				const bench_filter_t *filter = &size->filters[v];
+
+				fprintf(fp, "        {\"filter\": \"%s\", \"seconds\": %.6f, \"speedup\": %.3f, "
+						"\"max_error\": %d, \"errors\": %ld, \"psnr\": ", variant_name(v),
+						filter->seconds, size->filters[FILTER_BICUBIC].seconds / filter->seconds,
+						filter->max_error, filter->nr_errors);
+				if (isfinite(filter->psnr)) {
+					fprintf(fp, "%.2f", filter->psnr);
+				} else {
+					fprintf(fp, "null");
+				}
+				fprintf(fp, ", \"flipped_points\": %ld}%s\n", filter->flipped_points,
+						v + 1 < NR_VARIANTS ? "," : "");
+			}
+			fprintf(fp, "      ],\n");
+		}
+		fprintf(fp, "      \"runs\": [\n");
+
+		for (int r = 0; r < nr_runs; r++) {
+			const bench_run_t *run = &size->runs[r];
+
+			fprintf(fp, "        {\"threads\": %d, \"phases\": {", run->nr_threads);
+			for (int k = 0, first = 1; k < NR_PHASES; k++) {
+				if (k == PHASE_RESCALE && !size->scaled) {
+					continue;
+				}
+
+				double up = speedup(size, r, k);
+				fprintf(fp, "%s\"%s\": {\"seconds\": %.6f, \"speedup\": %.3f, "
+						"\"efficiency\": %.3f}", first ? "" : ", ", phase_names[k],
+						run->seconds[k], up, up / run->nr_threads);
+				first = 0;
+			}
+			fprintf(fp, "}");
+			if (size->reference > 0) {
+				fprintf(fp, ", \"vs_reference\": %.3f",
+						size->reference / run->seconds[PHASE_TOTAL]);
+			}
+			fprintf(fp, "}%s\n", r + 1 < nr_runs ? "," : "");
+		}
+
+		fprintf(fp, "      ]\n    }%s\n", s + 1 < options->nr_sizes ? "," : "");
+	}
+
+	fprintf(fp, "  ]\n}\n");
+}
+
+// Generates the synthetic inputs, times the phases of the program for every number of threads
+// and the sequential reference, then prints the times with the speedups and the efficiencies
+// over one thread, and the tradeoff between the speed and the quality of every filter. The
+// outputs of every number of threads must be the same as the output of the reference, and the
+// pixels scaled by the fixed-point kernels at most one off from the float ones, otherwise the
+// exit status is 1.
+int main(int argc, char *argv[]) {
+	bench_options_t options;
+	parse_options(argc, argv, &options);
+
+	if (mkdir(options.dir, 0755) && errno != EEXIST) {
+		fprintf(stderr, "Unable to create directory '%s'\n", options.dir);
+		exit(1);
+	}
+
+	config_t config;
+	memset(&config, 0, sizeof(config));
+	config.step = STEP;
+	config.sigma = SIGMA;
+	config.rescale_x = RESCALE_X;
+	config.rescale_y = RESCALE_Y;
+	config.isa = options.isa;
+	config.fixed_point = options.fixed_point;
+	config.filter = options.filter;
+
+	int max_threads = 1;
+	for (int i = 0; i < options.nr_thread_counts; i++) {
+		max_threads = options.thread_counts[i] > max_threads ? options.thread_counts[i]
+															 : max_threads;
+	}
+
+	contour_atlas_t *atlas = atlas_load("./contours", config.step);
+	worker_pool_t *pool = pool_create("worker", max_threads);
+	bench_size_t *sizes = (bench_size_t *)calloc(options.nr_sizes, sizeof(bench_size_t));
+	if (!sizes) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	int status = 0;
+
+	for (int s = 0; s < options.nr_sizes; s++) {
+		bench_size_t *size = &sizes[s];
+		size->width = options.widths[s];
+		size->height = options.heights[s];
+		size->scaled = size->width > config.rescale_x || size->height > config.rescale_y;
+
+		char *in_file = make_path(options.dir, "input", size->width, size->height, 0);
+		char *ref_file = make_path(options.dir, "reference", size->width, size->height, 0);
+		char *io_file = make_path(options.dir, "io", size->width, size->height, 0);
+		generate_image(in_file, size->width, size->height);
+
+		size->reference = -1;
+		size->matches_reference = 1;
+		if (options.reference) {
+			size->reference = run_reference(options.reference, in_file, ref_file,
+											options.repeat);
+		}
+		run_reference_io(in_file, io_file, options.repeat, size);
+		unlink(io_file);
+		free(io_file);
+
+		// a first run, which is not timed, brings the input in the page cache
+		char *warm_file = make_path(options.dir, "warmup", size->width, size->height, 0);
+		bench_run_t warmup;
+		config.nr_threads = 1;
+		run_program(&config, atlas, pool, in_file, warm_file, 1, &warmup);
+		unlink(warm_file);
+		free(warm_file);
+
+		for (int r = 0; r < options.nr_thread_counts; r++) {
+			char *out_file = make_path(options.dir, "output", size->width, size->height,
+									   options.thread_counts[r]);
+
+			config.nr_threads = options.thread_counts[r];
+			run_program(&config, atlas, pool, in_file, out_file, options.repeat,
+						&size->runs[r]);
+
+			// the pixels of the fixed-point kernels and of the other filters may fall on the
+			// other side of the threshold, they are compared with the float bicubic ones below
+			// instead
+			if (size->reference > 0 && !options.fixed_point &&
+				options.filter == FILTER_BICUBIC && !same_files(out_file, ref_file)) {
+				fprintf(stderr, "The output of %d threads on %dx%d differs from the "
+						"reference\n", options.thread_counts[r], size->width, size->height);
+				size->matches_reference = 0;
+				status = 1;
+			}
+
+			unlink(out_file);
+			free(out_file);
+		}
+
+		if (size->scaled) {
+			compare_filters(&config, in_file, options.repeat, size);
+			for (int v = VARIANT_FIXED; v <= VARIANT_FIXED_ROW_MAJOR; v++) {
+				if (size->filters[v].max_error > 1) {
+					fprintf(stderr, "The %s kernels are %d off on %dx%d\n", variant_name(v),
+							size->filters[v].max_error, size->width, size->height);
+					status = 1;
+				}
+			}
+		}
+
+		fprintf(stderr, "%dx%d done\n", size->width, size->height);
+		unlink(in_file);
+		unlink(ref_file);
+		free(in_file);
+		free(ref_file);
+	}
+
+	// the fixed-point kernels are also checked on real images, such as the inputs of the checker
+	if (options.corpus && check_corpus(&config, options.corpus)) {
+		status = 1;
+	}
+
+	if (options.format == FORMAT_CSV) {
+		print_csv(stdout, sizes, options.nr_sizes, options.nr_thread_counts);
+	} else {
+		print_json(stdout, &options, sizes, options.nr_thread_counts);
+	}
+
+	free(sizes);
+	pool_destroy(pool);
+	atlas_destroy(atlas);
+	rmdir(options.dir);
+
+	return status;
+}
@@ -0,0 +1,397 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#include "config.h"
+
+#include <errno.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "helpers.h"
+
+// Environment variables which switch the tracing on, like --trace and --trace-counters.
+#define TRACE_ENV "TEMA1_TRACE"
+#define TRACE_COUNTERS_ENV "TEMA1_TRACE_COUNTERS"
+
+static void print_usage(const char *prog) {
+	fprintf(stderr, "Usage: %s <in_file> <out_file> <P> [options]\n", prog);
+	fprintf(stderr, "  P is the number of threads, or auto to pick it from the image size\n");
+	fprintf(stderr, "Options:\n");
+	fprintf(stderr, "  --full-rescale   compute every pixel of the scaled image\n");
+	fprintf(stderr, "  --fixed-point    scale with integer weights (pixels off by at most 1)\n");
+	fprintf(stderr, "  --filter=<f>     rescale filter: bicubic, nearest, area, bilinear or\n");
+	fprintf(stderr, "                   lanczos\n");
+	fprintf(stderr, "  --row-major      walk the images along their rows, as stored in the file\n");
+	fprintf(stderr, "  --fused          process bands of rows in a single pass\n");
+	fprintf(stderr, "  --schedule=<s>   split of the work: static or steal (tiles)\n");
+	fprintf(stderr, "  --serial-write   write the result after all the threads finish\n");
+	fprintf(stderr, "  --step=<n>       distance between the grid points (default %d)\n", STEP);
+	fprintf(stderr, "  --sigma=<n>      threshold of the grid points (default %d)\n", SIGMA);
+	fprintf(stderr, "  --levels=<a,b,..> draw the isolines of several thresholds\n");
+	fprintf(stderr, "  --layers         write each level in its own file\n");
+	fprintf(stderr, "  --saddle         resolve the saddles from the average of their corners\n");
+	fprintf(stderr, "  --vector=<f>     write the isolines as polylines: svg, geojson or bin\n");
+	fprintf(stderr, "  --size=<x>x<y>   size of the scaled image (default %dx%d)\n", RESCALE_X,
+			RESCALE_Y);
+	fprintf(stderr, "  --stream=<MiB>   read the input in windows of at most MiB mebibytes\n");
+	fprintf(stderr, "  --batch          in_file is a manifest or a directory of images and\n");
+	fprintf(stderr, "                   out_file the directory of the results\n");
+	fprintf(stderr, "  --frames         in_file and out_file are streams of frames (- for the\n");
+	fprintf(stderr, "                   standard input and output)\n");
+	fprintf(stderr, "  --incremental=<cache>\n");
+	fprintf(stderr, "                   update out_file from the cache of the previous run\n");
+	fprintf(stderr, "  --huge-pages=<m> pages of the buffers: off, thp or hugetlb\n");
+	fprintf(stderr, "  --numa=<m>       pin the threads and place their buffers on the NUMA\n");
+	fprintf(stderr, "                   nodes: off, compact or scatter\n");
+	fprintf(stderr, "  --trace=<file>   write a Chrome trace of the phases and of the waits\n");
+	fprintf(stderr, "                   (or set %s)\n", TRACE_ENV);
+	fprintf(stderr, "  --trace-counters add the hardware counters to the trace (or set %s)\n",
+			TRACE_COUNTERS_ENV);
+	fprintf(stderr, "  --stats          print scheduling statistics\n");
+	fprintf(stderr, "  --simd=<isa>     vector kernels: auto, avx2, sse or scalar\n");
+}
+
+// Parses a number of an option, in [min, max]. Exits on invalid values.
+static int parse_number(const char *arg, int min, int max, const char *what) {
+	char *end;
+	errno = 0;
+	long value = strtol(arg, &end, 10);
+	if (errno || end == arg || *end || value < min || value > max) {
+		fprintf(stderr, "Invalid %s '%s'\n", what, arg);
+		exit(1);
+	}
+
+	return (int)value;
+}
+
+// Parses the number of threads, which is either a positive number or "auto" (returned as
+// CONFIG_AUTO_THREADS). Exits on invalid values.
+static int parse_threads(const char *arg) {
+	if (!strcmp(arg, "auto")) {
+		return CONFIG_AUTO_THREADS;
+	}
+
+	return parse_number(arg, 1, CONFIG_MAX_THREADS, "number of threads");
+}
+
+// Parses a size given as <x>x<y>, whose pixels must fit in an int. Exits on invalid values.
+static void parse_size(const char *arg, int *x, int *y) {
+	char buf[32];
+	const char *sep = strchr(arg, 'x');
+	if (!sep || (size_t)(sep - arg) >= sizeof(buf)) {
+		fprintf(stderr, "Invalid size '%s'\n", arg);
+		exit(1);
+	}
+
+	memcpy(buf, arg, sep - arg);
+	buf[sep - arg] = '\0';
+	*x = parse_number(buf, 1, 1 << 16, "size");
+	*y = parse_number(sep + 1, 1, 1 << 16, "size");
+
+	// the offsets of the pixels and of their bytes are computed in int
+	if ((long long)*x * *y * sizeof(ppm_pixel) > INT_MAX) {
+		fprintf(stderr, "Invalid size '%s', the scaled image must have at most %d pixels\n", arg,
+				(int)(INT_MAX / sizeof(ppm_pixel)));
+		exit(1);
+	}
+}
+
+// Parses a comma separated list of levels, in [0, CONFIG_MAX_LEVELS), which are stored sorted
+// and without duplicates. Exits on invalid values.
+static void parse_levels(const char *arg, config_t *config) {
+	unsigned char used[CONFIG_MAX_LEVELS] = {0};
+	char *list = strdup(arg);
+	if (!list) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	char *saveptr;
+	for (char *level = strtok_r(list, ",", &saveptr); level;
+		 level = strtok_r(NULL, ",", &saveptr)) {
+		used[parse_number(level, 0, CONFIG_MAX_LEVELS - 1, "level")] = 1;
+	}
+	free(list);
+
+	config->nr_levels = 0;
+	for (int v = 0; v < CONFIG_MAX_LEVELS; v++) {
+		if (used[v]) {
+			config->levels[config->nr_levels++] = v;
+		}
+	}
+
+	if (!config->nr_levels) {
+		fprintf(stderr, "Invalid levels '%s'\n", arg);
+		exit(1);
+	}
+}
+
+// Parses the command line arguments into `config`. Exits on invalid arguments.
+void parse_config(int argc, char *argv[], config_t *config) {
+	static const struct option long_options[] = {
+		{"full-rescale", no_argument, NULL, 'f'},
+		{"simd", required_argument, NULL, 's'},
+		{"fused", no_argument, NULL, 'u'},
+		{"schedule", required_argument, NULL, 'c'},
+		{"stats", no_argument, NULL, 't'},
+		{"batch", no_argument, NULL, 'b'},
+		{"serial-write", no_argument, NULL, 'w'},
+		{"stream", required_argument, NULL, 'm'},
+		{"step", required_argument, NULL, 'p'},
+		{"sigma", required_argument, NULL, 'g'},
+		{"size", required_argument, NULL, 'z'},
+		{"levels", required_argument, NULL, 'l'},
+		{"layers", no_argument, NULL, 'y'},
+		{"vector", required_argument, NULL, 'v'},
+		{"saddle", no_argument, NULL, 'a'},
+		{"incremental", required_argument, NULL, 'i'},
+		{"frames", no_argument, NULL, 'r'},
+		{"huge-pages", required_argument, NULL, 'h'},
+		{"row-major", no_argument, NULL, 'o'},
+		{"fixed-point", no_argument, NULL, 'q'},
+		{"filter", required_argument, NULL, 'e'},
+		{"numa", required_argument, NULL, 'n'},
+		{"trace", required_argument, NULL, 'x'},
+		{"trace-counters", no_argument, NULL, 'k'},
+		{NULL, 0, NULL, 0}
+	};
+
+	memset(config, 0, sizeof(*config));
+	config->step = STEP;
+	config->sigma = SIGMA;
+	config->rescale_x = RESCALE_X;
+	config->rescale_y = RESCALE_Y;
+
+	// the options given on the command line take precedence
+	char *env = getenv(TRACE_ENV);
+	if (env && *env) {
+		config->trace = env;
+	}
+	env = getenv(TRACE_COUNTERS_ENV);
+	config->trace_counters = env && *env && strcmp(env, "0");
+
+	int opt;
+	while ((opt = getopt_long(argc, argv, "", long_options, NULL)) != -1) {
+		switch (opt) {
+		case 'f':
+			config->full_rescale = 1;
+			break;
+		case 'u':
+			config->fused = 1;
+			break;
+		case 'c':
+			if (!strcmp(optarg, "static")) {
+				config->schedule = SCHEDULE_STATIC;
+			} else if (!strcmp(optarg, "steal")) {
+				config->schedule = SCHEDULE_STEAL;
+			} else {
+				fprintf(stderr, "Unknown schedule '%s'\n", optarg);
+				exit(1);
+			}
+			break;
+		case 'p':
+			config->step = parse_number(optarg, CONFIG_MIN_STEP, CONFIG_MAX_STEP, "step");
+			break;
+		case 'g':
+			config->sigma = parse_number(optarg, 0, RGB_COMPONENT_COLOR, "sigma");
+			break;
+		case 'z':
+			parse_size(optarg, &config->rescale_x, &config->rescale_y);
+			break;
+		case 'l':
+			parse_levels(optarg, config);
+			break;
+		case 'y':
+			config->layers = 1;
+			break;
+		case 'i':
+			config->incremental = optarg;
+			break;
+		case 'a':
+			config->saddle = 1;
+			break;
+		case 'v':
+			if (!strcmp(optarg, "svg")) {
+				config->vector = VECTOR_SVG;
+			} else if (!strcmp(optarg, "geojson")) {
+				config->vector = VECTOR_GEOJSON;
+			} else if (!strcmp(optarg, "bin")) {
+				config->vector = VECTOR_BINARY;
+			} else {
+				fprintf(stderr, "Unknown vector format '%s'\n", optarg);
+				exit(1);
+			}
+			break;
+		case 'm': {
+			char *end;
+			errno = 0;
+			long budget = strtol(optarg, &end, 10);
+			if (errno || end == optarg || *end || budget < 1) {
+				fprintf(stderr, "Invalid stream budget '%s'\n", optarg);
+				exit(1);
+			}
+			config->stream_budget = (size_t)budget << 20;
+			break;
+		}
+		case 'w':
+			config->serial_write = 1;
+			break;
+		case 'b':
+			config->batch = 1;
+			break;
+		case 'r':
+			config->frames = 1;
+			break;
+		case 'o':
+			config->row_major = 1;
+			break;
+		case 'q':
+			config->fixed_point = 1;
+			break;
+		case 'e':
+			if (filter_from_name(optarg, &config->filter)) {
+				fprintf(stderr, "Unknown filter '%s'\n", optarg);
+				exit(1);
+			}
+			break;
+		case 'x':
+			config->trace = optarg;
+			break;
+		case 'k':
+			config->trace_counters = 1;
+			break;
+		case 'h':
+			if (!strcmp(optarg, "off")) {
+				config->pages = PAGES_DEFAULT;
+			} else if (!strcmp(optarg, "thp")) {
+				config->pages = PAGES_THP;
+			} else if (!strcmp(optarg, "hugetlb")) {
+				config->pages = PAGES_HUGETLB;
+			} else {
+				fprintf(stderr, "Unknown huge pages '%s'\n", optarg);
+				exit(1);
+			}
+			break;
+		case 'n':
+			if (!strcmp(optarg, "off")) {
+				config->numa = NUMA_OFF;
+			} else if (!strcmp(optarg, "compact")) {
+				config->numa = NUMA_COMPACT;
+			} else if (!strcmp(optarg, "scatter")) {
+				config->numa = NUMA_SCATTER;
+			} else {
+				fprintf(stderr, "Unknown NUMA mode '%s'\n", optarg);
+				exit(1);
+			}
+			break;
+		case 't':
+			config->stats = 1;
+			break;
+		case 's':
+			if (simd_isa_from_name(optarg, &config->isa)) {
+				fprintf(stderr, "Unknown instruction set '%s'\n", optarg);
+				exit(1);
+			}
+			break;
+		default:
+			print_usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	// the positional arguments are moved at the end by getopt
+	if (argc - optind < 3) {
+		print_usage(argv[0]);
+		exit(1);
+	}
+
+	config->in_file = argv[optind];
+	config->out_file = argv[optind + 1];
+	config->nr_threads = parse_threads(argv[optind + 2]);
+
+	if (config->trace_counters && !config->trace) {
+		fprintf(stderr, "--trace-counters needs --trace\n");
+		exit(1);
+	}
+
+	// the size is given as width x height, the number of rows being the height
+	if (config->row_major) {
+		int rows = config->rescale_y;
+		config->rescale_y = config->rescale_x;
+		config->rescale_x = rows;
+	}
+
+	// the scaled image must hold at least a square
+	if (config->rescale_x < config->step || config->rescale_y < config->step) {
+		fprintf(stderr, "The scaled image must be at least %dx%d\n", config->step, config->step);
+		exit(1);
+	}
+
+	// the layers are written next to `out_file`, so there must be a single output
+	if (config->layers && (!config->nr_levels || config->batch || config->stream_budget)) {
+		fprintf(stderr, "--layers needs --levels and cannot be used with --batch or --stream\n");
+		exit(1);
+	}
+
+	// the cache holds the grid of a single image
+	if (config->incremental && (config->nr_levels || config->vector || config->saddle ||
+								config->batch || config->stream_budget)) {
+		fprintf(stderr, "--incremental cannot be used with --levels, --vector, --saddle, --batch "
+				"or --stream\n");
+		exit(1);
+	}
+
+	// the plans of the windows and of the cache follow the lines read by the reference view
+	if (config->row_major && (config->stream_budget || config->incremental)) {
+		fprintf(stderr, "--row-major cannot be used with --stream or --incremental\n");
+		exit(1);
+	}
+
+	// the fixed-point kernels are bicubic, and the windows and the cache follow the footprints
+	// of the bicubic taps
+	if (config->filter != FILTER_BICUBIC && (config->fixed_point || config->stream_budget ||
+											 config->incremental)) {
+		fprintf(stderr, "--filter cannot be used with --fixed-point, --stream or --incremental\n");
+		exit(1);
+	}
+
+	// the stages of the pipeline run the phases of the static split of the rows
+	if (config->frames && (config->nr_levels || config->vector || config->saddle ||
+						   config->fused || config->schedule == SCHEDULE_STEAL ||
+						   config->batch || config->stream_budget || config->incremental)) {
+		fprintf(stderr, "--frames cannot be used with --levels, --vector, --saddle, --fused, "
+				"--schedule=steal, --batch, --stream or --incremental\n");
+		exit(1);
+	}
+
+	// the threads of the other modes process several images, or windows of one, or do not own
+	// the pixel rows of the static bands of the grid rows
+	if (config->numa && (config->batch || config->frames || config->stream_budget ||
+						 config->schedule == SCHEDULE_STEAL || config->fused ||
+						 config->nr_levels || config->vector)) {
+		fprintf(stderr, "--numa cannot be used with --batch, --frames, --stream, "
+				"--schedule=steal, --fused, --levels or --vector\n");
+		exit(1);
+	}
+
+	if (config->vector && (config->layers || config->batch || config->stream_budget)) {
+		fprintf(stderr, "--vector cannot be used with --layers, --batch or --stream\n");
+		exit(1);
+	}
+
+	// the polylines and the saddles need the luminance of the points, which is compared with
+	// the levels, so `sigma` becomes the only level
+	if (config->vector || config->saddle) {
+		if (!config->nr_levels) {
+			if (config->sigma >= CONFIG_MAX_LEVELS) {
+				fprintf(stderr, "--vector and --saddle need a sigma below %d\n", CONFIG_MAX_LEVELS);
+				exit(1);
+			}
+			config->levels[config->nr_levels++] = config->sigma;
+		}
+	}
+
+	// pick the kernels once, for all the threads
+	config->isa = simd_resolve_isa(config->isa);
+}
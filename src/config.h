@@ -0,0 +1,143 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#ifndef CONFIG_H_
+#define CONFIG_H_
+
+#include <stddef.h>
+
+#include "filter.h"
+#include "simd.h"
+
+// Value of `nr_threads` when the number of threads is picked from the size of the image.
+#define CONFIG_AUTO_THREADS 0
+
+// Bounds of the distance between the points of the grid.
+#define CONFIG_MIN_STEP 2
+#define CONFIG_MAX_STEP 64
+
+// Number of values an isoline level can take, [0, RGB_COMPONENT_COLOR - 1].
+#define CONFIG_MAX_LEVELS 255
+
+// Upper bound for the number of threads given on the command line.
+#define CONFIG_MAX_THREADS 4096
+
+// How the work of a phase is split between the threads.
+typedef enum {
+	SCHEDULE_STATIC,
+	SCHEDULE_STEAL,
+} schedule_t;
+
+// Format of the isolines, when they are written as vectors instead of stamped on the image.
+typedef enum {
+	VECTOR_NONE,
+	VECTOR_SVG,
+	VECTOR_GEOJSON,
+	VECTOR_BINARY,
+} vector_format_t;
+
+// Pages which back the buffers of an image.
+typedef enum {
+	PAGES_DEFAULT,
+	PAGES_THP,
+	PAGES_HUGETLB,
+} page_mode_t;
+
+// How the threads are pinned to the CPUs of the NUMA nodes, which also places the buffers of
+// their bands on their nodes.
+typedef enum {
+	NUMA_OFF,
+	NUMA_COMPACT,
+	NUMA_SCATTER,
+} numa_mode_t;
+
+// Options which control how an image is processed. They are read from the command line, the
+// defaults giving the same behaviour as the sequential implementation.
+typedef struct {
+	char *in_file;
+	char *out_file;
+	// number of threads, or CONFIG_AUTO_THREADS
+	int nr_threads;
+
+	// distance between the points of the grid, in pixels, which is also the size of the
+	// contours, and the value compared with the average of the components of a point
+	int step;
+	int sigma;
+
+	// levels of the isolines drawn instead of the single `sigma` one, sorted and distinct, and
+	// whether each level is written in its own file instead of all of them in `out_file`
+	int nr_levels;
+	unsigned char levels[CONFIG_MAX_LEVELS];
+	int layers;
+
+	// resolve the saddles from the average of their corners, which needs the luminance of the
+	// grid points, so `sigma` becomes the only level if there are no others
+	int saddle;
+
+	// write the isolines of the levels (or of `sigma`) as polylines in `out_file`, in this
+	// format, instead of stamping their contours
+	vector_format_t vector;
+
+	// size of the image on which the contours are drawn, when the input is larger
+	int rescale_x, rescale_y;
+
+	// compute every pixel of the scaled image instead of only the ones read by the grid
+	int full_rescale;
+
+	// scale with the fixed-point kernels, whose pixels may be off by one from the reference
+	int fixed_point;
+
+	// filter of the rescale stage, bicubic being the one of the reference
+	filter_t filter;
+
+	// keep the images as rows of pixels, the way they are stored in the files, instead of the
+	// transposed view of the reference implementation; `rescale_x` is then the number of rows
+	int row_major;
+
+	// scale, sample and march bands of rows in a single pass, without barriers
+	int fused;
+
+	// static split of the rows, or tiles taken from per-thread deques with work stealing
+	schedule_t schedule;
+
+	// write the result from the main thread after all the others finish, instead of letting
+	// each thread write its band
+	int serial_write;
+
+	// read the input in windows of at most this many bytes instead of loading it, 0 to load it
+	size_t stream_budget;
+
+	// process the images listed in `in_file` (a manifest or a directory), writing the results
+	// in the directory `out_file`
+	int batch;
+
+	// `in_file` is a stream of frames of the same size and `out_file` gets the results, one
+	// after the other, the frames going through a pipeline of stages
+	int frames;
+
+	// cache of the previous run: with a cache written for the same sizes and options, only the
+	// squares whose samples read changed blocks of the input are stamped again on `out_file`
+	char *incremental;
+
+	// pages of the arenas which hold the buffers of the images
+	page_mode_t pages;
+
+	// pin the threads to the CPUs of the NUMA nodes, filling one node after the other or
+	// spreading them over the nodes, with the bands of the scaled image and of the grid of each
+	// thread on its node and the input interleaved over the nodes
+	numa_mode_t numa;
+
+	// write the spans of the phases and of the waits of every thread in this file, as Chrome
+	// trace events, reading the hardware counters of every span with `trace_counters`
+	char *trace;
+	int trace_counters;
+
+	// print statistics about the threads at the end
+	int stats;
+
+	// instruction set used by the vector kernels
+	simd_isa_t isa;
+} config_t;
+
+// Parses the command line arguments into `config`. Exits on invalid arguments.
+void parse_config(int argc, char *argv[], config_t *config);
+
+#endif  // CONFIG_H_
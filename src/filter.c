@@ -0,0 +1,663 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#include "filter.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef SIMD_X86
+#include <immintrin.h>
+#endif
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+
+// Number of inner outputs interpolated together by the vector kernels.
+#define FILTER_LANES 8
+
+// Lobes of the Lanczos kernel.
+#define LANCZOS_LOBES 3
+
+// Taps of a filter along one axis, for every coordinate of the scaled image: coordinate `i`
+// reads the source pixels taps[nr_taps * i ..] with the same weights. For the area filter,
+// coordinate `i` averages the widths[i] source pixels starting with taps[i] instead.
+typedef struct {
+	int nr_taps;
+	int *taps;
+	float *weights;
+	int *widths;
+} filter_axis_t;
+
+// Computes the taps of an axis of `src` source pixels and `dst` scaled ones.
+typedef void (*axis_fn)(filter_axis_t *axis, int src, int dst);
+
+// Interpolates the scaled pixels, see `filter_resample`.
+typedef void (*resample_fn)(const filter_plan_t *plan, const ppm_pixel *source,
+							const int *inner, int nr_inner, const int *outer, int nr_outer,
+							ppm_image *dst, int transposed);
+
+// An entry of the registry of filters.
+typedef struct {
+	const char *name;
+	axis_fn init_axis;
+	resample_fn resample;
+} filter_desc_t;
+
+struct filter_plan {
+	const filter_desc_t *desc;
+	int line_size;
+	filter_axis_t inner, outer;
+	simd_isa_t isa;
+};
+
+// Rounds `n` up to a multiple of FILTER_LANES.
+static int round_lanes(int n) {
+	return (n + FILTER_LANES - 1) / FILTER_LANES * FILTER_LANES;
+}
+
+static int clamp_index(int index, int size) {
+	if (index < 0) {
+		return 0;
+	}
+	if (index > size - 1) {
+		return size - 1;
+	}
+	return index;
+}
+
+// Position of scaled pixel `i` on an axis of `src` source pixels, from the edge of the first
+// one: `sample_bicubic` samples it at u = i / (dst - 1), the centre of the first pixel being at
+// 0.5.
+static double sample_position(int i, int src, int dst) {
+	float u = (float)i / (float)(dst - 1);
+	return u * src;
+}
+
+static void axis_alloc(filter_axis_t *axis, int dst, int nr_taps) {
+	axis->nr_taps = nr_taps;
+	axis->taps = (int *)malloc((size_t)dst * nr_taps * sizeof(int));
+	axis->weights = (float *)malloc((size_t)dst * nr_taps * sizeof(float));
+	if (!axis->taps || !axis->weights) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	axis->widths = NULL;
+}
+
+// The nearest source pixel.
+static void nearest_axis(filter_axis_t *axis, int src, int dst) {
+	axis_alloc(axis, dst, 1);
+
+	for (int i = 0; i < dst; i++) {
+		axis->taps[i] = clamp_index((int)sample_position(i, src, dst), src);
+		axis->weights[i] = 1.0f;
+	}
+}
+
+// The source pixels covered by the scaled one, a box as wide as the scale factor (at least one
+// pixel) around the sampled position.
+static void area_axis(filter_axis_t *axis, int src, int dst) {
+	double scale = MAX(1.0, (double)src / dst);
+
+	axis_alloc(axis, dst, 1);
+	axis->widths = (int *)malloc(dst * sizeof(int));
+	if (!axis->widths) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	for (int i = 0; i < dst; i++) {
+		double position = sample_position(i, src, dst);
+		int first = clamp_index((int)floor(position - scale / 2 + 0.5), src);
+		int end = (int)floor(position + scale / 2 + 0.5);
+
+		end = MAX(first + 1, MIN(end, src));
+		axis->taps[i] = first;
+		axis->widths[i] = end - first;
+		axis->weights[i] = 1.0f;
+	}
+}
+
+// The source pixels closer than `radius` to the sampled position, weighted by `kernel`. With
+// `widened`, the kernel is stretched by the downscale factor, so that every source pixel
+// contributes to the scaled ones. The weights are normalized, so the taps clamped to the edges
+// keep their share.
+static void weighted_axis(filter_axis_t *axis, int src, int dst, double (*kernel)(double),
+						  double radius, int widened) {
+	double scale = widened ? MAX(1.0, (double)src / dst) : 1.0;
+	double support = radius * scale;
+	int nr_taps = 2 * (int)ceil(support);
+
+	axis_alloc(axis, dst, nr_taps);
+
+	for (int i = 0; i < dst; i++) {
+		double centre = sample_position(i, src, dst) - 0.5;
+		int first = (int)floor(centre - support) + 1;
+		int *taps = axis->taps + (size_t)nr_taps * i;
+		float *weights = axis->weights + (size_t)nr_taps * i;
+		double sum = 0;
+
+		for (int t = 0; t < nr_taps; t++) {
+			double weight = kernel((first + t - centre) / scale);
+
+			taps[t] = clamp_index(first + t, src);
+			weights[t] = (float)weight;
+			sum += weight;
+		}
+		for (int t = 0; t < nr_taps; t++) {
+			weights[t] = (float)(weights[t] / sum);
+		}
+	}
+}
+
+static double triangle(double x) {
+	return MAX(0.0, 1.0 - fabs(x));
+}
+
+static double lanczos(double x) {
+	if (x == 0.0) {
+		return 1.0;
+	}
+	if (fabs(x) >= LANCZOS_LOBES) {
+		return 0.0;
+	}
+
+	double pi_x = M_PI * x;
+	return LANCZOS_LOBES * sin(pi_x) * sin(pi_x / LANCZOS_LOBES) / (pi_x * pi_x);
+}
+
+static void bilinear_axis(filter_axis_t *axis, int src, int dst) {
+	weighted_axis(axis, src, dst, triangle, 1.0, 0);
+}
+
+static void lanczos_axis(filter_axis_t *axis, int src, int dst) {
+	weighted_axis(axis, src, dst, lanczos, LANCZOS_LOBES, 1);
+}
+
+// Interpolates source line `line` at the inner outputs, whose taps and weights are stored as
+// [block of FILTER_LANES outputs][tap][lane], into `h` as [channel][output], with `stride`
+// outputs per channel.
+typedef void (*weighted_line_fn)(const ppm_pixel *line, const int *taps, const float *weights,
+								 int nr_taps, int stride, float *h);
+
+// Adds the `n` values of the lines h[0] .. h[nr_taps - 1] multiplied with the weights `w`
+// into `value`, `n` being a multiple of FILTER_LANES.
+typedef void (*weighted_combine_fn)(const float *const *h, const float *w, int nr_taps, int n,
+									float *value);
+
+// Adds `n` bytes (the channels of a run of pixels) to `acc`.
+typedef void (*area_add_fn)(uint32_t *acc, const uint8_t *bytes, int n);
+
+static void weighted_line_scalar(const ppm_pixel *line, const int *taps, const float *weights,
+								 int nr_taps, int stride, float *h) {
+	for (int b = 0; b < stride; b += FILTER_LANES) {
+		const int *block_taps = taps + (size_t)b * nr_taps;
+		const float *block_weights = weights + (size_t)b * nr_taps;
+
+		for (int l = 0; l < FILTER_LANES; l++) {
+			float red = 0.0f, green = 0.0f, blue = 0.0f;
+
+			for (int t = 0; t < nr_taps; t++) {
+				const ppm_pixel *pixel = &line[block_taps[t * FILTER_LANES + l]];
+				float w = block_weights[t * FILTER_LANES + l];
+
+				red += pixel->red * w;
+				green += pixel->green * w;
+				blue += pixel->blue * w;
+			}
+
+			h[b + l] = red;
+			h[stride + b + l] = green;
+			h[2 * stride + b + l] = blue;
+		}
+	}
+}
+
+static void weighted_combine_scalar(const float *const *h, const float *w, int nr_taps, int n,
+									float *value) {
+	for (int k = 0; k < n; k++) {
+		float sum = 0.0f;
+
+		for (int t = 0; t < nr_taps; t++) {
+			sum += w[t] * h[t][k];
+		}
+		value[k] = sum;
+	}
+}
+
+static void area_add_scalar(uint32_t *acc, const uint8_t *bytes, int n) {
+	for (int k = 0; k < n; k++) {
+		acc[k] += bytes[k];
+	}
+}
+
+#ifdef SIMD_X86
+
+// Gathers the pixels of tap `t` of a block of outputs, as [channel][lane]. The taps of
+// neighbouring outputs are too far apart for wide loads, only the arithmetic is vectorized.
+static inline __attribute__((always_inline))
+void gather_block(const ppm_pixel *line, const int *tap, float p[3][FILTER_LANES]) {
+	for (int l = 0; l < FILTER_LANES; l++) {
+		const ppm_pixel *pixel = &line[tap[l]];
+
+		p[0][l] = pixel->red;
+		p[1][l] = pixel->green;
+		p[2][l] = pixel->blue;
+	}
+}
+
+static void weighted_line_sse(const ppm_pixel *line, const int *taps, const float *weights,
+							  int nr_taps, int stride, float *h) {
+	float p[3][FILTER_LANES] __attribute__((aligned(16)));
+
+	for (int b = 0; b < stride; b += FILTER_LANES) {
+		const int *block_taps = taps + (size_t)b * nr_taps;
+		const float *block_weights = weights + (size_t)b * nr_taps;
+		__m128 lo[3], hi[3];
+
+		for (int c = 0; c < 3; c++) {
+			lo[c] = _mm_setzero_ps();
+			hi[c] = _mm_setzero_ps();
+		}
+
+		for (int t = 0; t < nr_taps; t++) {
+			__m128 w_lo = _mm_load_ps(block_weights + t * FILTER_LANES);
+			__m128 w_hi = _mm_load_ps(block_weights + t * FILTER_LANES + 4);
+
+			gather_block(line, block_taps + t * FILTER_LANES, p);
+			for (int c = 0; c < 3; c++) {
+				lo[c] = _mm_add_ps(lo[c], _mm_mul_ps(_mm_load_ps(p[c]), w_lo));
+				hi[c] = _mm_add_ps(hi[c], _mm_mul_ps(_mm_load_ps(p[c] + 4), w_hi));
+			}
+		}
+
+		for (int c = 0; c < 3; c++) {
+			_mm_store_ps(h + c * stride + b, lo[c]);
+			_mm_store_ps(h + c * stride + b + 4, hi[c]);
+		}
+	}
+}
+
+static void weighted_combine_sse(const float *const *h, const float *w, int nr_taps, int n,
+								 float *value) {
+	for (int k = 0; k < n; k += 4) {
+		__m128 sum = _mm_setzero_ps();
+
+		for (int t = 0; t < nr_taps; t++) {
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(w[t]), _mm_load_ps(h[t] + k)));
+		}
+		_mm_store_ps(value + k, sum);
+	}
+}
+
+static void area_add_sse(uint32_t *acc, const uint8_t *bytes, int n) {
+	const __m128i zero = _mm_setzero_si128();
+	int k = 0;
+
+	for (; k + 16 <= n; k += 16) {
+		__m128i b = _mm_loadu_si128((const __m128i *)(bytes + k));
+		__m128i words[2] = {_mm_unpacklo_epi8(b, zero), _mm_unpackhi_epi8(b, zero)};
+
+		for (int w = 0; w < 2; w++) {
+			__m128i *lo = (__m128i *)(acc + k + 8 * w);
+			__m128i *hi = (__m128i *)(acc + k + 8 * w + 4);
+
+			_mm_storeu_si128(lo, _mm_add_epi32(_mm_loadu_si128(lo),
+											   _mm_unpacklo_epi16(words[w], zero)));
+			_mm_storeu_si128(hi, _mm_add_epi32(_mm_loadu_si128(hi),
+											   _mm_unpackhi_epi16(words[w], zero)));
+		}
+	}
+
+	area_add_scalar(acc + k, bytes + k, n - k);
+}
+
+__attribute__((target("avx2")))
+static void weighted_line_avx2(const ppm_pixel *line, const int *taps, const float *weights,
+							   int nr_taps, int stride, float *h) {
+	float p[3][FILTER_LANES] __attribute__((aligned(32)));
+
+	for (int b = 0; b < stride; b += FILTER_LANES) {
+		const int *block_taps = taps + (size_t)b * nr_taps;
+		const float *block_weights = weights + (size_t)b * nr_taps;
+		__m256 sum[3];
+
+		for (int c = 0; c < 3; c++) {
+			sum[c] = _mm256_setzero_ps();
+		}
+
+		for (int t = 0; t < nr_taps; t++) {
+			__m256 w = _mm256_load_ps(block_weights + t * FILTER_LANES);
+
+			gather_block(line, block_taps + t * FILTER_LANES, p);
+			for (int c = 0; c < 3; c++) {
+				sum[c] = _mm256_add_ps(sum[c], _mm256_mul_ps(_mm256_load_ps(p[c]), w));
+			}
+		}
+
+		for (int c = 0; c < 3; c++) {
+			_mm256_store_ps(h + c * stride + b, sum[c]);
+		}
+	}
+}
+
+__attribute__((target("avx2")))
+static void weighted_combine_avx2(const float *const *h, const float *w, int nr_taps, int n,
+								  float *value) {
+	for (int k = 0; k < n; k += 8) {
+		__m256 sum = _mm256_setzero_ps();
+
+		for (int t = 0; t < nr_taps; t++) {
+			sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(w[t]),
+												   _mm256_load_ps(h[t] + k)));
+		}
+		_mm256_store_ps(value + k, sum);
+	}
+}
+
+__attribute__((target("avx2")))
+static void area_add_avx2(uint32_t *acc, const uint8_t *bytes, int n) {
+	int k = 0;
+
+	for (; k + 8 <= n; k += 8) {
+		__m256i b = _mm256_cvtepu8_epi32(_mm_loadl_epi64((const __m128i *)(bytes + k)));
+		__m256i *a = (__m256i *)(acc + k);
+
+		_mm256_storeu_si256(a, _mm256_add_epi32(_mm256_loadu_si256(a), b));
+	}
+
+	area_add_scalar(acc + k, bytes + k, n - k);
+}
+
+#endif  // SIMD_X86
+
+// The kernels of the instruction set of a plan.
+typedef struct {
+	weighted_line_fn line;
+	weighted_combine_fn combine;
+	area_add_fn add;
+} filter_kernels_t;
+
+static filter_kernels_t filter_kernels(simd_isa_t isa) {
+	filter_kernels_t kernels = {weighted_line_scalar, weighted_combine_scalar, area_add_scalar};
+
+#ifdef SIMD_X86
+	if (isa == SIMD_ISA_SSE) {
+		kernels.line = weighted_line_sse;
+		kernels.combine = weighted_combine_sse;
+		kernels.add = area_add_sse;
+	} else if (isa == SIMD_ISA_AVX2) {
+		kernels.line = weighted_line_avx2;
+		kernels.combine = weighted_combine_avx2;
+		kernels.add = area_add_avx2;
+	}
+#else
+	(void)isa;
+#endif
+
+	return kernels;
+}
+
+static inline ppm_pixel *dst_pixel(ppm_image *dst, int transposed, int inner, int outer) {
+	if (transposed) {
+		return &dst->data[(size_t)outer * dst->y + inner];
+	}
+	return &dst->data[(size_t)inner * dst->y + outer];
+}
+
+// Rounds an interpolated value to the nearest channel value.
+static inline unsigned char to_channel(float value) {
+	value += 0.5f;
+	if (value < 0.0f) {
+		return 0;
+	}
+	if (value > 255.0f) {
+		return 255;
+	}
+	return (unsigned char)value;
+}
+
+static void resample_nearest(const filter_plan_t *plan, const ppm_pixel *source,
+							 const int *inner, int nr_inner, const int *outer, int nr_outer,
+							 ppm_image *dst, int transposed) {
+	for (int o = 0; o < nr_outer; o++) {
+		const ppm_pixel *line = source + (size_t)plan->outer.taps[outer[o]] * plan->line_size;
+
+		for (int q = 0; q < nr_inner; q++) {
+			*dst_pixel(dst, transposed, inner[q], outer[o]) = line[plan->inner.taps[inner[q]]];
+		}
+	}
+}
+
+// Interpolates the outer outputs in order. Every source line read by them is interpolated
+// along its length once, at the inner outputs, into a ring which holds the last lines: the
+// taps of an output are consecutive lines, fewer than the slots of the ring, so they never fall
+// on the same slot.
+static void resample_weighted(const filter_plan_t *plan, const ppm_pixel *source,
+							  const int *inner, int nr_inner, const int *outer, int nr_outer,
+							  ppm_image *dst, int transposed) {
+	const filter_axis_t *in = &plan->inner;
+	const filter_axis_t *out = &plan->outer;
+	filter_kernels_t kernels = filter_kernels(plan->isa);
+	int stride = round_lanes(nr_inner);
+	size_t size = (size_t)3 * stride;
+
+	int ring_size = 1;
+	while (ring_size < out->nr_taps) {
+		ring_size *= 2;
+	}
+
+	// the taps and the weights of the inner outputs, the outputs past `nr_inner` repeating the
+	// last one
+	int *taps = (int *)malloc((size_t)stride * in->nr_taps * sizeof(int));
+	float *weights = (float *)aligned_alloc(32, (size_t)stride * in->nr_taps * sizeof(float));
+	if (!taps || !weights) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	for (int q = 0; q < stride; q++) {
+		int coord = inner[MIN(q, nr_inner - 1)];
+		size_t block = (size_t)(q / FILTER_LANES) * FILTER_LANES * in->nr_taps;
+
+		for (int t = 0; t < in->nr_taps; t++) {
+			size_t index = block + t * FILTER_LANES + q % FILTER_LANES;
+			taps[index] = in->taps[(size_t)in->nr_taps * coord + t];
+			weights[index] = in->weights[(size_t)in->nr_taps * coord + t];
+		}
+	}
+
+	// the lines of the ring, then the values of an output
+	float *ring = (float *)aligned_alloc(32, (ring_size + 1) * size * sizeof(float));
+	int *held = (int *)malloc(ring_size * sizeof(int));
+	const float **h = (const float **)malloc(out->nr_taps * sizeof(float *));
+	if (!ring || !held || !h) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	float *value = ring + ring_size * size;
+	for (int s = 0; s < ring_size; s++) {
+		held[s] = -1;
+	}
+
+	for (int o = 0; o < nr_outer; o++) {
+		const int *line_taps = out->taps + (size_t)out->nr_taps * outer[o];
+
+		for (int t = 0; t < out->nr_taps; t++) {
+			int line = line_taps[t];
+			int slot = line & (ring_size - 1);
+
+			if (held[slot] != line) {
+				kernels.line(source + (size_t)line * plan->line_size, taps, weights,
+							 in->nr_taps, stride, ring + slot * size);
+				held[slot] = line;
+			}
+			h[t] = ring + slot * size;
+		}
+
+		kernels.combine(h, out->weights + (size_t)out->nr_taps * outer[o], out->nr_taps,
+						(int)size, value);
+
+		for (int q = 0; q < nr_inner; q++) {
+			ppm_pixel *pixel = dst_pixel(dst, transposed, inner[q], outer[o]);
+
+			pixel->red = to_channel(value[q]);
+			pixel->green = to_channel(value[stride + q]);
+			pixel->blue = to_channel(value[2 * stride + q]);
+		}
+	}
+
+	free(h);
+	free(held);
+	free(ring);
+	free(weights);
+	free(taps);
+}
+
+// Divides the sum of a box by its area, rounding to the nearest integer, from `inv`, which is
+// 1 / area up to a few ulps. The quotient of n + 0.5 is at least 0.5 / area away from an
+// integer, far more than the error of the product, so it truncates to the exact floor(n / area).
+static inline unsigned char box_average(uint64_t sum, uint64_t area, double inv) {
+	return (unsigned char)(((double)(int64_t)(sum + area / 2) + 0.5) * inv);
+}
+
+// Averages the boxes, in integers. The source lines covered by the box of an outer output are
+// added up first, on the part [lo, hi) which the inner outputs read, with widening vector adds.
+// The prefix sums of this row of sums give then the sum of every box with two lookups, whatever
+// its width.
+static void resample_area(const filter_plan_t *plan, const ppm_pixel *source,
+						  const int *inner, int nr_inner, const int *outer, int nr_outer,
+						  ppm_image *dst, int transposed) {
+	const filter_axis_t *in = &plan->inner;
+	const filter_axis_t *out = &plan->outer;
+	filter_kernels_t kernels = filter_kernels(plan->isa);
+
+	int lo = plan->line_size, hi = 0;
+	for (int q = 0; q < nr_inner; q++) {
+		lo = MIN(lo, in->taps[inner[q]]);
+		hi = MAX(hi, in->taps[inner[q]] + in->widths[inner[q]]);
+	}
+
+	// the channels of the pixels are summed independently, so the rows hold them interleaved
+	int n = 3 * (hi - lo);
+	uint32_t *acc = (uint32_t *)malloc(n * sizeof(uint32_t));
+	uint64_t *prefix = (uint64_t *)malloc((n + 3) * sizeof(uint64_t));
+	double *inv = (double *)malloc(nr_inner * sizeof(double));
+	if (!acc || !prefix || !inv) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	for (int q = 0; q < nr_inner; q++) {
+		inv[q] = 1.0 / in->widths[inner[q]];
+	}
+
+	for (int o = 0; o < nr_outer; o++) {
+		int first = out->taps[outer[o]];
+		int width = out->widths[outer[o]];
+		double inv_width = 1.0 / width;
+
+		memset(acc, 0, n * sizeof(uint32_t));
+		for (int line = first; line < first + width; line++) {
+			kernels.add(acc, (const uint8_t *)(source + (size_t)line * plan->line_size + lo), n);
+		}
+
+		uint64_t red = 0, green = 0, blue = 0;
+		prefix[0] = prefix[1] = prefix[2] = 0;
+		for (int k = 0; k < n; k += 3) {
+			red += acc[k];
+			green += acc[k + 1];
+			blue += acc[k + 2];
+			prefix[k + 3] = red;
+			prefix[k + 4] = green;
+			prefix[k + 5] = blue;
+		}
+
+		for (int q = 0; q < nr_inner; q++) {
+			ppm_pixel *pixel = dst_pixel(dst, transposed, inner[q], outer[o]);
+			const uint64_t *begin = prefix + 3 * (in->taps[inner[q]] - lo);
+			const uint64_t *end = begin + 3 * in->widths[inner[q]];
+			uint64_t area = (uint64_t)in->widths[inner[q]] * width;
+			double inv_area = inv[q] * inv_width;
+
+			pixel->red = box_average(end[0] - begin[0], area, inv_area);
+			pixel->green = box_average(end[1] - begin[1], area, inv_area);
+			pixel->blue = box_average(end[2] - begin[2], area, inv_area);
+		}
+	}
+
+	free(inv);
+	free(prefix);
+	free(acc);
+}
+
+// The filters, in the order of `filter_t`. The bicubic one is only named here.
+static const filter_desc_t filters[NR_FILTERS] = {
+	{"bicubic", NULL, NULL},
+	{"nearest", nearest_axis, resample_nearest},
+	{"area", area_axis, resample_area},
+	{"bilinear", bilinear_axis, resample_weighted},
+	{"lanczos", lanczos_axis, resample_weighted},
+};
+
+// Converts a filter name (bicubic, nearest, area, bilinear, lanczos). Returns 0 on success.
+int filter_from_name(const char *name, filter_t *filter) {
+	for (int i = 0; i < NR_FILTERS; i++) {
+		if (!strcmp(name, filters[i].name)) {
+			*filter = (filter_t)i;
+			return 0;
+		}
+	}
+
+	return -1;
+}
+
+// Returns the name of `filter`.
+const char *filter_name(filter_t filter) {
+	return filters[filter].name;
+}
+
+// Precomputes `filter` for scaling `nr_lines` source lines of `line_size` pixels to `dst_outer`
+// lines of `dst_inner` pixels. Every scaled pixel is sampled at the same place as in
+// `sample_bicubic`.
+filter_plan_t *filter_plan_create(filter_t filter, int line_size, int nr_lines, int dst_inner,
+								  int dst_outer, simd_isa_t isa) {
+	filter_plan_t *plan = (filter_plan_t *)malloc(sizeof(filter_plan_t));
+	if (!plan) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	plan->desc = &filters[filter];
+	plan->line_size = line_size;
+	plan->isa = simd_resolve_isa(isa);
+	plan->desc->init_axis(&plan->inner, line_size, dst_inner);
+	plan->desc->init_axis(&plan->outer, nr_lines, dst_outer);
+
+	return plan;
+}
+
+static void axis_destroy(filter_axis_t *axis) {
+	free(axis->taps);
+	free(axis->weights);
+	free(axis->widths);
+}
+
+void filter_plan_destroy(filter_plan_t *plan) {
+	axis_destroy(&plan->inner);
+	axis_destroy(&plan->outer);
+	free(plan);
+}
+
+// Interpolates the scaled pixels found on the inner coordinates `inner` and on the outer
+// coordinates `outer`, which must be sorted. The pixel of the inner coordinate `i` and of the
+// outer coordinate `o` is stored at (i, o) in `dst`, or at (o, i) when `transposed`.
+void filter_resample(const filter_plan_t *plan, const ppm_pixel *source, const int *inner,
+					 int nr_inner, const int *outer, int nr_outer, ppm_image *dst,
+					 int transposed) {
+	if (nr_inner == 0 || nr_outer == 0) {
+		return;
+	}
+
+	plan->desc->resample(plan, source, inner, nr_inner, outer, nr_outer, dst, transposed);
+}
@@ -0,0 +1,45 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#ifndef FILTER_H_
+#define FILTER_H_
+
+#include "helpers.h"
+#include "simd.h"
+
+// Filters of the rescale stage. The bicubic one is the filter of the reference, computed by the
+// kernels of resample.c; the others are computed here.
+typedef enum {
+	FILTER_BICUBIC,
+	FILTER_NEAREST,
+	FILTER_AREA,
+	FILTER_BILINEAR,
+	FILTER_LANCZOS,
+	NR_FILTERS,
+} filter_t;
+
+// Taps of a filter other than bicubic, for every coordinate of the scaled image. The source is
+// read as lines of `line_size` pixels: the inner axis of the scaled image runs along the
+// lines, the outer axis across them.
+typedef struct filter_plan filter_plan_t;
+
+// Converts a filter name (bicubic, nearest, area, bilinear, lanczos). Returns 0 on success.
+int filter_from_name(const char *name, filter_t *filter);
+
+// Returns the name of `filter`.
+const char *filter_name(filter_t filter);
+
+// Precomputes `filter` for scaling `nr_lines` source lines of `line_size` pixels to `dst_outer`
+// lines of `dst_inner` pixels. Every scaled pixel is sampled at the same place as in
+// `sample_bicubic`.
+filter_plan_t *filter_plan_create(filter_t filter, int line_size, int nr_lines, int dst_inner,
+								  int dst_outer, simd_isa_t isa);
+
+void filter_plan_destroy(filter_plan_t *plan);
+
+// Interpolates the scaled pixels found on the inner coordinates `inner` and on the outer
+// coordinates `outer`, which must be sorted. The pixel of the inner coordinate `i` and of the
+// outer coordinate `o` is stored at (i, o) in `dst`, or at (o, i) when `transposed`.
+void filter_resample(const filter_plan_t *plan, const ppm_pixel *source, const int *inner,
+					 int nr_inner, const int *outer, int nr_outer, ppm_image *dst,
+					 int transposed);
+
+#endif  // FILTER_H_
@@ -0,0 +1,338 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#include "frames.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "atlas.h"
+#include "config.h"
+#include "helpers.h"
+#include "parallel_march.h"
+#include "pool.h"
+#include "ppm_io.h"
+#include "queue.h"
+#include "trace.h"
+#include "types.h"
+#include "utils.h"
+
+// Number of frames in flight: one in every stage of the pipeline. The buffers of the frames
+// are allocated once and recycled.
+#define FRAME_SLOTS 4
+
+// Stages of the pipeline, in the order in which a frame goes through them.
+typedef enum {
+	STAGE_DECODE,
+	STAGE_RESCALE,
+	STAGE_STAMP,
+	STAGE_ENCODE,
+	NR_STAGES,
+} stage_t;
+
+static const char *const stage_names[NR_STAGES] = {"decode", "rescale", "stamp", "encode"};
+
+// Durations measured by a stage, in seconds.
+typedef struct {
+	double total, max;
+	int count;
+} stage_stats_t;
+
+// The buffers of a frame: the input, the scaled image and the grid.
+typedef struct {
+	image_job_t job;
+	// when the frame started to be decoded
+	double started;
+} frame_slot_t;
+
+// Everything shared by the stages. Each statistic is only updated by its own stage.
+typedef struct {
+	const config_t *config;
+	FILE *in, *out;
+	const char *in_name, *out_name;
+	ppm_image header;
+	contour_atlas_t *atlas;
+
+	frame_slot_t slots[FRAME_SLOTS];
+	// free slots, then the frames decoded, scaled and stamped, with NULL after the last one
+	spsc_queue_t free_slots, decoded, rescaled, stamped;
+
+	int nr_threads;
+	worker_pool_t *rescale_pool, *stamp_pool;
+	thread_arg_t *rescale_args, *stamp_args;
+	pthread_barrier_t barrier;
+
+	stage_stats_t stats[NR_STAGES];
+	stage_stats_t latency;
+	double finished;
+} pipeline_t;
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void record(stage_stats_t *stats, double duration) {
+	stats->total += duration;
+	stats->count++;
+	if (duration > stats->max) {
+		stats->max = duration;
+	}
+}
+
+// Opens a file of the stream, or `std` for "-".
+static FILE *open_stream(const char *filename, const char *mode, FILE *std) {
+	if (!strcmp(filename, "-")) {
+		return std;
+	}
+
+	FILE *fp = fopen(filename, mode);
+	if (!fp) {
+		fprintf(stderr, "Unable to open file '%s'\n", filename);
+		exit(1);
+	}
+
+	return fp;
+}
+
+static void rescale_frame(void *arg) {
+	bicubic_interpolation((thread_arg_t *)arg);
+}
+
+static void stamp_frame(void *arg) {
+	thread_arg_t *thread_arg = (thread_arg_t *)arg;
+
+	bulid_grid_of_points(thread_arg);
+	trace_barrier_wait(thread_arg->barrier, "barrier grid");
+	march(thread_arg);
+}
+
+// Reads the pixels of the frames into free slots. The header of the first frame was read
+// before the pipeline started, the header of every other frame is read after the pixels of
+// the previous one.
+static void *decode_stage(void *arg) {
+	pipeline_t *p = (pipeline_t *)arg;
+	int more = 1;
+
+	while (more) {
+		frame_slot_t *slot = (frame_slot_t *)spsc_queue_pop(&p->free_slots);
+		double start = now();
+		ppm_image header;
+
+		slot->started = start;
+		ppm_frame_read_pixels(p->in, p->in_name, slot->job.image);
+
+		more = ppm_frame_read_header(p->in, p->in_name, &header);
+		if (more && (header.x != p->header.x || header.y != p->header.y)) {
+			fprintf(stderr, "All the frames of '%s' must have the same size\n", p->in_name);
+			exit(1);
+		}
+
+		record(&p->stats[STAGE_DECODE], now() - start);
+		spsc_queue_push(&p->decoded, slot);
+	}
+
+	spsc_queue_push(&p->decoded, NULL);
+	return NULL;
+}
+
+// Scales the frames, with the threads of the rescale pool.
+static void *rescale_stage(void *arg) {
+	pipeline_t *p = (pipeline_t *)arg;
+	frame_slot_t *slot;
+
+	while ((slot = (frame_slot_t *)spsc_queue_pop(&p->decoded))) {
+		double start = now();
+
+		if (slot->job.plan) {
+			job_set_args(&slot->job, p->config, p->atlas, &p->barrier, p->rescale_args);
+			pool_run(p->rescale_pool, p->nr_threads, rescale_frame, p->rescale_args,
+					 sizeof(thread_arg_t));
+		}
+
+		record(&p->stats[STAGE_RESCALE], now() - start);
+		spsc_queue_push(&p->rescaled, slot);
+	}
+
+	spsc_queue_push(&p->rescaled, NULL);
+	return NULL;
+}
+
+// Builds the grid of the frames and stamps their contours, with the threads of the stamp pool.
+static void *stamp_stage(void *arg) {
+	pipeline_t *p = (pipeline_t *)arg;
+	frame_slot_t *slot;
+
+	while ((slot = (frame_slot_t *)spsc_queue_pop(&p->rescaled))) {
+		double start = now();
+
+		job_set_args(&slot->job, p->config, p->atlas, &p->barrier, p->stamp_args);
+		pool_run(p->stamp_pool, p->nr_threads, stamp_frame, p->stamp_args, sizeof(thread_arg_t));
+
+		record(&p->stats[STAGE_STAMP], now() - start);
+		spsc_queue_push(&p->stamped, slot);
+	}
+
+	spsc_queue_push(&p->stamped, NULL);
+	return NULL;
+}
+
+// Writes the results and gives the slots back to the decoder. The output is flushed after
+// every frame, for the programs which read it as it is produced.
+static void *encode_stage(void *arg) {
+	pipeline_t *p = (pipeline_t *)arg;
+	frame_slot_t *slot;
+
+	while ((slot = (frame_slot_t *)spsc_queue_pop(&p->stamped))) {
+		double start = now();
+
+		ppm_image file = image_to_file(p->config, slot->job.scaled_image);
+
+		ppm_frame_write(p->out, p->out_name, &file);
+		if (fflush(p->out)) {
+			fprintf(stderr, "Unable to write file '%s'\n", p->out_name);
+			exit(1);
+		}
+
+		double end = now();
+		record(&p->stats[STAGE_ENCODE], end - start);
+		record(&p->latency, end - slot->started);
+		p->finished = end;
+
+		spsc_queue_push(&p->free_slots, slot);
+	}
+
+	return NULL;
+}
+
+static void print_stats(const char *name, const stage_stats_t *stats) {
+	fprintf(stderr, "%-8s mean %8.3f ms, max %8.3f ms\n", name,
+			stats->count ? 1e3 * stats->total / stats->count : 0.0, 1e3 * stats->max);
+}
+
+// Allocates the slots of the frames, the pools of the two parallel stages and the queues.
+static void pipeline_init(pipeline_t *p) {
+	for (int k = 0; k < FRAME_SLOTS; k++) {
+		ppm_image *image = ppm_alloc(p->header.x, p->header.y);
+		image_from_file(p->config, image);
+		job_init(&p->slots[k].job, p->config, image, available_cpus(), &p->barrier, NULL);
+	}
+
+	// the frames have the same size, so the same number of threads
+	p->nr_threads = p->slots[0].job.nr_threads;
+	p->rescale_pool = pool_create("rescale", p->nr_threads);
+	p->stamp_pool = pool_create("stamp", p->nr_threads);
+	p->rescale_args = (thread_arg_t *)malloc(p->nr_threads * sizeof(thread_arg_t));
+	p->stamp_args = (thread_arg_t *)malloc(p->nr_threads * sizeof(thread_arg_t));
+	if (!p->rescale_args || !p->stamp_args) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	pthread_barrier_init(&p->barrier, NULL, p->nr_threads);
+
+	spsc_queue_init(&p->free_slots, FRAME_SLOTS);
+	spsc_queue_init(&p->decoded, FRAME_SLOTS + 1);
+	spsc_queue_init(&p->rescaled, FRAME_SLOTS + 1);
+	spsc_queue_init(&p->stamped, FRAME_SLOTS + 1);
+	for (int k = 0; k < FRAME_SLOTS; k++) {
+		spsc_queue_push(&p->free_slots, &p->slots[k]);
+	}
+}
+
+static void pipeline_destroy(pipeline_t *p) {
+	for (int k = 0; k < FRAME_SLOTS; k++) {
+		job_destroy(&p->slots[k].job);
+	}
+
+	pool_destroy(p->rescale_pool);
+	pool_destroy(p->stamp_pool);
+	free(p->rescale_args);
+	free(p->stamp_args);
+	pthread_barrier_destroy(&p->barrier);
+
+	spsc_queue_destroy(&p->free_slots);
+	spsc_queue_destroy(&p->decoded);
+	spsc_queue_destroy(&p->rescaled);
+	spsc_queue_destroy(&p->stamped);
+}
+
+// Processes the frames of `config->in_file`, a file or a pipe ("-" for the standard input) of
+// concatenated P6 images of the same size, writing the results one after the other in
+// `config->out_file` ("-" for the standard output). Decoding, scaling, stamping and encoding
+// run as the stages of a pipeline, each on a different frame, with a fixed set of frame
+// buffers passed from a stage to the next one through bounded queues. The latency of the
+// stages and the sustained frame rate are printed at the end. Returns the exit status of the
+// program.
+int frames_run(const config_t *config) {
+	static void *(*const stages[])(void *) = {decode_stage, rescale_stage, encode_stage};
+	pipeline_t *p = (pipeline_t *)calloc(1, sizeof(pipeline_t));
+	if (!p) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	p->config = config;
+	p->in_name = config->in_file;
+	p->out_name = config->out_file;
+	p->in = open_stream(config->in_file, "rb", stdin);
+	p->out = open_stream(config->out_file, "wb", stdout);
+
+	// the size of the first frame gives the size of the buffers
+	if (!ppm_frame_read_header(p->in, p->in_name, &p->header)) {
+		fprintf(stderr, "'%s' has no frames\n", p->in_name);
+		exit(1);
+	}
+
+	p->atlas = atlas_load("./contours", config->step);
+	pipeline_init(p);
+
+	int nr_threads = sizeof(stages) / sizeof(stages[0]);
+	pthread_t tid[sizeof(stages) / sizeof(stages[0])];
+	double start = now();
+
+	for (int i = 0; i < nr_threads; i++) {
+		if (pthread_create(&tid[i], NULL, stages[i], p)) {
+			printf("ERROR: failed to create thread number %d\n", i);
+			exit(1);
+		}
+	}
+
+	// the main thread runs the stamp stage
+	stamp_stage(p);
+
+	for (int i = 0; i < nr_threads; i++) {
+		if (pthread_join(tid[i], NULL)) {
+			printf("ERROR: failed to join thread number %d\n", i);
+			exit(1);
+		}
+	}
+
+	if (config->stats) {
+		fprintf(stderr, "threads: %d per parallel stage\n", p->nr_threads);
+	}
+	for (int s = 0; s < NR_STAGES; s++) {
+		print_stats(stage_names[s], &p->stats[s]);
+	}
+	print_stats("latency", &p->latency);
+
+	int nr_frames = p->latency.count;
+	double elapsed = p->finished - start;
+	fprintf(stderr, "%d frames in %.3f s (%.1f frames/s)\n", nr_frames, elapsed,
+			elapsed > 0 ? nr_frames / elapsed : 0.0);
+
+	pipeline_destroy(p);
+	atlas_destroy(p->atlas);
+
+	if (p->in != stdin) {
+		fclose(p->in);
+	}
+	if (p->out != stdout && fclose(p->out)) {
+		fprintf(stderr, "Unable to write file '%s'\n", p->out_name);
+		exit(1);
+	}
+
+	free(p);
+	return 0;
+}
@@ -0,0 +1,16 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#ifndef FRAMES_H_
+#define FRAMES_H_
+
+#include "config.h"
+
+// Processes the frames of `config->in_file`, a file or a pipe ("-" for the standard input) of
+// concatenated P6 images of the same size, writing the results one after the other in
+// `config->out_file` ("-" for the standard output). Decoding, scaling, stamping and encoding
+// run as the stages of a pipeline, each on a different frame, with a fixed set of frame
+// buffers passed from a stage to the next one through bounded queues. The latency of the
+// stages and the sustained frame rate are printed at the end. Returns the exit status of the
+// program.
+int frames_run(const config_t *config);
+
+#endif  // FRAMES_H_
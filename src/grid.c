@@ -0,0 +1,241 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#include "grid.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "helpers.h"
+#include "simd.h"
+
+#ifdef SIMD_X86
+#include <immintrin.h>
+#endif
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+
+static int words_per_row(int cols) {
+	return (cols + GRID_WORD_BITS - 1) / GRID_WORD_BITS;
+}
+
+// Carves a grid with all the points set to 0 out of `arena`.
+grid_t *grid_create(arena_t *arena, int rows, int cols) {
+	grid_t *grid = (grid_t *)arena_alloc(arena, sizeof(grid_t));
+
+	grid->rows = rows;
+	grid->cols = cols;
+	grid->words_per_row = words_per_row(cols);
+	grid->bits = (uint64_t *)arena_calloc(arena, (size_t)rows * grid->words_per_row *
+												 sizeof(uint64_t));
+
+	return grid;
+}
+
+// Size a grid takes in an arena.
+size_t grid_arena_size(int rows, int cols) {
+	return arena_block_size(sizeof(grid_t)) +
+		   arena_block_size((size_t)rows * words_per_row(cols) * sizeof(uint64_t));
+}
+
+// Signature of the threshold kernels.
+typedef uint64_t (*threshold_fn)(const ppm_pixel *first, int stride, int n, int sigma);
+
+// Thresholds at most 64 samples, bit `k` of the result being the value of sample `k`.
+static inline __attribute__((always_inline))
+uint64_t threshold_scalar(const ppm_pixel *first, int stride, int n, int sigma) {
+	uint64_t word = 0;
+
+	for (int k = 0; k < n; k++) {
+		word |= (uint64_t)grid_threshold(first[k * stride], sigma) << k;
+	}
+
+	return word;
+}
+
+#ifdef SIMD_X86
+
+// (r + g + b) / 3 > sigma is the same as r + g + b >= 3 * (sigma + 1), so a point is 1 when the
+// sum of its components is below that limit. The samples are far apart, so their components
+// are copied one by one and only the sums and comparisons are vectorized, 16 at a time.
+static inline __attribute__((always_inline))
+uint64_t threshold_sse(const ppm_pixel *first, int stride, int n, int sigma) {
+	const __m128i limit = _mm_set1_epi16(3 * (sigma + 1));
+	const __m128i zero = _mm_setzero_si128();
+	uint8_t red[16], green[16], blue[16];
+	uint64_t word = 0;
+	int k = 0;
+
+	for (; k + 16 <= n; k += 16) {
+		for (int l = 0; l < 16; l++) {
+			const ppm_pixel *pixel = &first[(k + l) * stride];
+			red[l] = pixel->red;
+			green[l] = pixel->green;
+			blue[l] = pixel->blue;
+		}
+
+		__m128i r = _mm_loadu_si128((const __m128i *)red);
+		__m128i g = _mm_loadu_si128((const __m128i *)green);
+		__m128i b = _mm_loadu_si128((const __m128i *)blue);
+
+		__m128i sum_lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(r, zero),
+													 _mm_unpacklo_epi8(g, zero)),
+									   _mm_unpacklo_epi8(b, zero));
+		__m128i sum_hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(r, zero),
+													 _mm_unpackhi_epi8(g, zero)),
+									   _mm_unpackhi_epi8(b, zero));
+
+		__m128i below = _mm_packs_epi16(_mm_cmplt_epi16(sum_lo, limit),
+										_mm_cmplt_epi16(sum_hi, limit));
+		word |= (uint64_t)(uint16_t)_mm_movemask_epi8(below) << k;
+	}
+
+	if (k < n) {
+		word |= threshold_scalar(first + k * stride, stride, n - k, sigma) << k;
+	}
+
+	return word;
+}
+
+// Loads 8 samples with a gather. Each load reads the 3 components of a sample and the first
+// byte of the next pixel, which is still on the same line since the samples are at least 2
+// pixels apart and do not pass the end of the line.
+static inline __attribute__((always_inline, target("avx2")))
+uint64_t threshold_avx2(const ppm_pixel *first, int stride, int n, int sigma) {
+	if (stride < 2) {
+		return threshold_sse(first, stride, n, sigma);
+	}
+
+	const __m256i limit = _mm256_set1_epi32(3 * (sigma + 1));
+	const __m256i mask = _mm256_set1_epi32(0xff);
+	const __m256i offset = _mm256_mullo_epi32(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7),
+											  _mm256_set1_epi32(3 * stride));
+	uint64_t word = 0;
+	int k = 0;
+
+	for (; k + 8 <= n; k += 8) {
+		__m256i p = _mm256_i32gather_epi32((const int *)&first[k * stride], offset, 1);
+
+		__m256i sum = _mm256_add_epi32(_mm256_and_si256(p, mask),
+									   _mm256_and_si256(_mm256_srli_epi32(p, 8), mask));
+		sum = _mm256_add_epi32(sum, _mm256_and_si256(_mm256_srli_epi32(p, 16), mask));
+
+		__m256i below = _mm256_cmpgt_epi32(limit, sum);
+		word |= (uint64_t)_mm256_movemask_ps(_mm256_castsi256_ps(below)) << k;
+	}
+
+	if (k < n) {
+		word |= threshold_scalar(first + k * stride, stride, n - k, sigma) << k;
+	}
+
+	return word;
+}
+
+#endif  // SIMD_X86
+
+// The kernels are specialized for the common grid steps, so that the distance between the
+// samples is known at compile time; the other steps use the generic kernels. The wrappers are
+// compiled with the `target` attributes of their kernel, so that it is inlined in them.
+#define THRESHOLD_STEP(kernel, target, step)                                                    \
+	static target uint64_t kernel##_##step(const ppm_pixel *first, int stride, int n,           \
+										   int sigma) {                                         \
+		(void)stride;                                                                           \
+		return kernel(first, step, n, sigma);                                                   \
+	}
+
+#define THRESHOLD_KERNEL(kernel, target)                                                        \
+	static target uint64_t kernel##_any(const ppm_pixel *first, int stride, int n, int sigma) { \
+		return kernel(first, stride, n, sigma);                                                 \
+	}                                                                                           \
+	THRESHOLD_STEP(kernel, target, 4)                                                           \
+	THRESHOLD_STEP(kernel, target, 8)                                                           \
+	THRESHOLD_STEP(kernel, target, 16)                                                          \
+	THRESHOLD_STEP(kernel, target, 32)                                                          \
+	static threshold_fn kernel##_for(int stride) {                                              \
+		switch (stride) {                                                                       \
+		case 4:                                                                                 \
+			return kernel##_4;                                                                  \
+		case 8:                                                                                 \
+			return kernel##_8;                                                                  \
+		case 16:                                                                                \
+			return kernel##_16;                                                                 \
+		case 32:                                                                                \
+			return kernel##_32;                                                                 \
+		default:                                                                                \
+			return kernel##_any;                                                                \
+		}                                                                                       \
+	}
+
+THRESHOLD_KERNEL(threshold_scalar, )
+#ifdef SIMD_X86
+THRESHOLD_KERNEL(threshold_sse, )
+THRESHOLD_KERNEL(threshold_avx2, __attribute__((target("avx2"))))
+#endif
+
+// Computes the values of `n` points found on row `i` of the grid, starting with column `col`,
+// which must be a multiple of GRID_WORD_BITS. Their samples are `stride` pixels apart, starting
+// with `first`, and must all be on the same line of the image. The words are overwritten, so
+// the bits after the last point are set to 0.
+void grid_classify(grid_t *grid, int i, int col, const ppm_pixel *first, int stride, int n,
+				   int sigma, simd_isa_t isa) {
+	threshold_fn threshold = threshold_scalar_for(stride);
+
+#ifdef SIMD_X86
+	if (isa == SIMD_ISA_SSE) {
+		threshold = threshold_sse_for(stride);
+	} else if (isa == SIMD_ISA_AVX2) {
+		threshold = threshold_avx2_for(stride);
+	}
+#else
+	(void)isa;
+#endif
+
+	uint64_t *word = grid_row(grid, i) + col / GRID_WORD_BITS;
+
+	for (; n > 0; n -= GRID_WORD_BITS) {
+		*word++ = threshold(first, stride, MIN(n, GRID_WORD_BITS), sigma);
+		first += GRID_WORD_BITS * stride;
+	}
+}
+
+// Spreads the lowest 8 bits of `bits` to the 8 bytes of the result, which are either 0 or 1.
+// Byte `k` receives bit `k` through the multiplication, then adding 128 - 2^k sets the top
+// bit of the byte only if bit `k` is 1.
+static inline uint64_t spread_bits(uint64_t bits) {
+	uint64_t bytes = ((bits & 0xff) * 0x0101010101010101ULL) & 0x8040201008040201ULL;
+
+	return ((bytes + 0x00406070787c7e7fULL) >> 7) & 0x0101010101010101ULL;
+}
+
+// Computes the configuration (8 * top left + 4 * top right + 2 * bottom right + bottom left)
+// of `n` squares formed by rows `i` and `i + 1` of the grid, starting with the square on column
+// `first`, which must be a multiple of GRID_WORD_BITS.
+void grid_row_cases(const grid_t *grid, int i, int first, int n, unsigned char *cases) {
+	const uint64_t *top = grid_row(grid, i) + first / GRID_WORD_BITS;
+	const uint64_t *bottom = grid_row(grid, i + 1) + first / GRID_WORD_BITS;
+	int words = grid->words_per_row - first / GRID_WORD_BITS;
+
+	for (int w = 0; w * GRID_WORD_BITS < n; w++) {
+		// the right corners of the squares are the points shifted by one column
+		int has_next = w + 1 < words;
+		uint64_t top_left = top[w];
+		uint64_t bottom_left = bottom[w];
+		uint64_t top_right = (top_left >> 1) | (has_next ? top[w + 1] << 63 : 0);
+		uint64_t bottom_right = (bottom_left >> 1) | (has_next ? bottom[w + 1] << 63 : 0);
+
+		int count = MIN(GRID_WORD_BITS, n - w * GRID_WORD_BITS);
+		unsigned char *out = cases + w * GRID_WORD_BITS;
+
+		// 8 squares at a time, one per byte
+		for (int k = 0; k < count; k += 8) {
+			uint64_t bytes = (spread_bits(top_left >> k) << 3) |
+							 (spread_bits(top_right >> k) << 2) |
+							 (spread_bits(bottom_right >> k) << 1) |
+							 spread_bits(bottom_left >> k);
+
+			for (int b = 0; b < MIN(8, count - k); b++) {
+				out[k + b] = (unsigned char)(bytes >> (8 * b));
+			}
+		}
+	}
+}
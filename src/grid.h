@@ -0,0 +1,64 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#ifndef GRID_H_
+#define GRID_H_
+
+#include <stdint.h>
+
+#include "arena.h"
+#include "helpers.h"
+#include "simd.h"
+
+// Number of grid points stored in a word.
+#define GRID_WORD_BITS 64
+
+// Grid of points with values which can be either 0 or 1. Every row is stored in `words_per_row`
+// consecutive 64 bit words, point `j` of a row being bit `j % 64` of word `j / 64`. The rows
+// are padded with zero bits.
+typedef struct {
+	int rows, cols;
+	int words_per_row;
+	uint64_t *bits;
+} grid_t;
+
+// Carves a grid with all the points set to 0 out of `arena`.
+grid_t *grid_create(arena_t *arena, int rows, int cols);
+
+// Size a grid takes in an arena.
+size_t grid_arena_size(int rows, int cols);
+
+static inline uint64_t *grid_row(const grid_t *grid, int i) {
+	return grid->bits + (size_t)i * grid->words_per_row;
+}
+
+static inline int grid_get(const grid_t *grid, int i, int j) {
+	return (grid_row(grid, i)[j / GRID_WORD_BITS] >> (j % GRID_WORD_BITS)) & 1;
+}
+
+static inline void grid_set(grid_t *grid, int i, int j, int value) {
+	uint64_t *word = &grid_row(grid, i)[j / GRID_WORD_BITS];
+	uint64_t mask = (uint64_t)1 << (j % GRID_WORD_BITS);
+
+	*word = value ? (*word | mask) : (*word & ~mask);
+}
+
+// Returns the value of a grid point: 0 if the average of the pixel components is above `sigma`,
+// 1 otherwise.
+static inline int grid_threshold(ppm_pixel pixel, int sigma) {
+	unsigned char color = (pixel.red + pixel.green + pixel.blue) / 3;
+
+	return color > sigma ? 0 : 1;
+}
+
+// Computes the values of `n` points found on row `i` of the grid, starting with column `col`,
+// which must be a multiple of GRID_WORD_BITS. Their samples are `stride` pixels apart, starting
+// with `first`, and must all be on the same line of the image. The words are overwritten, so
+// the bits after the last point are set to 0.
+void grid_classify(grid_t *grid, int i, int col, const ppm_pixel *first, int stride, int n,
+				   int sigma, simd_isa_t isa);
+
+// Computes the configuration (8 * top left + 4 * top right + 2 * bottom right + bottom left)
+// of `n` squares formed by rows `i` and `i + 1` of the grid, starting with the square on column
+// `first`, which must be a multiple of GRID_WORD_BITS.
+void grid_row_cases(const grid_t *grid, int i, int first, int n, unsigned char *cases);
+
+#endif  // GRID_H_
@@ -0,0 +1,416 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#include "incremental.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "atlas.h"
+#include "grid.h"
+#include "helpers.h"
+#include "ppm_io.h"
+#include "resample.h"
+#include "types.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+
+#define CACHE_MAGIC "MSQINC1"
+
+// Header of the cache. A cache is used only if it was written for the same sizes and options.
+typedef struct {
+	char magic[8];
+	int src_x, src_y;
+	int dst_x, dst_y;
+	int step, sigma, fixed_point;
+	int block, nr_lines, line_size;
+	int grid_rows, grid_cols, words_per_row;
+} cache_header_t;
+
+// Checksum of `nr_lines` lines of `size` bytes, `stride` bytes apart. The words are mixed in
+// 4 independent sums, so that the multiplications of consecutive words overlap.
+static uint64_t block_checksum(const unsigned char *first, size_t size, size_t stride,
+							   int nr_lines) {
+	uint64_t sums[4] = {0xcbf29ce484222325ull, 0x84222325cbf29ce4ull, 0x9ce484222325cbf2ull,
+						0x2325cbf29ce48422ull};
+
+	for (int l = 0; l < nr_lines; l++) {
+		const unsigned char *line = first + l * stride;
+		size_t b = 0;
+
+		for (; b + 32 <= size; b += 32) {
+			uint64_t words[4];
+			memcpy(words, line + b, sizeof(words));
+			for (int k = 0; k < 4; k++) {
+				sums[k] = (sums[k] ^ words[k]) * 0x9E3779B97F4A7C15ull;
+				sums[k] ^= sums[k] >> 29;
+			}
+		}
+		for (; b < size; b++) {
+			sums[b % 4] = (sums[b % 4] ^ line[b]) * 0x100000001b3ull;
+		}
+	}
+
+	return sums[0] ^ (sums[1] * 3) ^ (sums[2] * 5) ^ (sums[3] * 7);
+}
+
+static void fill_header(const incremental_t *inc, cache_header_t *header) {
+	const image_job_t *job = inc->job;
+
+	memset(header, 0, sizeof(*header));
+	memcpy(header->magic, CACHE_MAGIC, sizeof(CACHE_MAGIC));
+	header->src_x = job->image->x;
+	header->src_y = job->image->y;
+	header->dst_x = job->scaled_image->x;
+	header->dst_y = job->scaled_image->y;
+	header->step = inc->config->step;
+	header->sigma = inc->config->sigma;
+	header->fixed_point = inc->config->fixed_point;
+	header->block = INCREMENTAL_BLOCK;
+	header->nr_lines = inc->nr_lines;
+	header->line_size = inc->line_size;
+	header->grid_rows = job->grid->rows;
+	header->grid_cols = job->grid->cols;
+	header->words_per_row = job->grid->words_per_row;
+}
+
+// Computes the checksums of the blocks of the input of `job`.
+incremental_t *incremental_open(const config_t *config, image_job_t *job) {
+	incremental_t *inc = (incremental_t *)malloc(sizeof(incremental_t));
+	if (!inc) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	ppm_image *image = job->image;
+
+	inc->config = config;
+	inc->job = job;
+
+	// the resampler reads pixel `col` of line `line` at data[col + line * x]; without scaling,
+	// the grid reads the rows of the image
+	if (image != job->scaled_image) {
+		inc->nr_lines = image->y;
+		inc->line_size = image->x;
+	} else {
+		inc->nr_lines = image->x;
+		inc->line_size = image->y;
+	}
+
+	inc->block_rows = (inc->nr_lines + INCREMENTAL_BLOCK - 1) / INCREMENTAL_BLOCK;
+	inc->block_cols = (inc->line_size + INCREMENTAL_BLOCK - 1) / INCREMENTAL_BLOCK;
+	inc->sums = (uint64_t *)malloc((size_t)inc->block_rows * inc->block_cols * sizeof(uint64_t));
+	if (!inc->sums) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	size_t stride = (size_t)inc->line_size * sizeof(ppm_pixel);
+	for (int br = 0; br < inc->block_rows; br++) {
+		int first_line = br * INCREMENTAL_BLOCK;
+		int nr_lines = MIN(INCREMENTAL_BLOCK, inc->nr_lines - first_line);
+
+		for (int bc = 0; bc < inc->block_cols; bc++) {
+			int first_col = bc * INCREMENTAL_BLOCK;
+			int nr_cols = MIN(INCREMENTAL_BLOCK, inc->line_size - first_col);
+			const unsigned char *first = (const unsigned char *)image->data +
+										 first_line * stride + first_col * sizeof(ppm_pixel);
+
+			inc->sums[br * inc->block_cols + bc] =
+				block_checksum(first, nr_cols * sizeof(ppm_pixel), stride, nr_lines);
+		}
+	}
+
+	return inc;
+}
+
+// Reads the checksums of the previous input and its grid, in the grid of the job. Returns the
+// checksums, or NULL if the cache does not exist or was written for other sizes or options.
+static uint64_t *load_cache(incremental_t *inc) {
+	FILE *file = fopen(inc->config->incremental, "rb");
+	if (!file) {
+		return NULL;
+	}
+
+	cache_header_t expected, header;
+	fill_header(inc, &expected);
+	size_t nr_sums = (size_t)inc->block_rows * inc->block_cols;
+	size_t nr_words = (size_t)inc->job->grid->rows * inc->job->grid->words_per_row;
+	uint64_t *sums = (uint64_t *)malloc(nr_sums * sizeof(uint64_t));
+	if (!sums) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	int valid = fread(&header, sizeof(header), 1, file) == 1 &&
+				!memcmp(&header, &expected, sizeof(header)) &&
+				fread(sums, sizeof(uint64_t), nr_sums, file) == nr_sums &&
+				fread(inc->job->grid->bits, sizeof(uint64_t), nr_words, file) == nr_words;
+	fclose(file);
+
+	if (!valid) {
+		free(sums);
+		return NULL;
+	}
+
+	return sums;
+}
+
+// Writes the checksums and the grid of the job in the cache.
+void incremental_save(incremental_t *inc) {
+	FILE *file = fopen(inc->config->incremental, "wb");
+	if (!file) {
+		fprintf(stderr, "Unable to open file '%s'\n", inc->config->incremental);
+		exit(1);
+	}
+
+	cache_header_t header;
+	fill_header(inc, &header);
+	fwrite(&header, sizeof(header), 1, file);
+	fwrite(inc->sums, sizeof(uint64_t), (size_t)inc->block_rows * inc->block_cols, file);
+	fwrite(inc->job->grid->bits, sizeof(uint64_t),
+		   (size_t)inc->job->grid->rows * inc->job->grid->words_per_row, file);
+
+	if (fclose(file)) {
+		fprintf(stderr, "Unable to write file '%s'\n", inc->config->incremental);
+		exit(1);
+	}
+}
+
+void incremental_close(incremental_t *inc) {
+	free(inc->sums);
+	free(inc);
+}
+
+// Pixels read from the input by the samples of the grid points: the grid row `i` reads
+// [first[i], end[i]) on one axis and the grid column `j` reads [first[j], end[j]) on the other.
+typedef struct {
+	int *row_first, *row_end;
+	int *col_first, *col_end;
+} footprint_t;
+
+// Line (or column) of the scaled image on which the samples of grid row (or column) `index`
+// are, like in `classify_grid_row` and `classify_last_grid_row`.
+static int sample_index(const incremental_t *inc, int index, int nr_points) {
+	return index < nr_points ? index * inc->config->step : inc->job->scaled_image->x - 1;
+}
+
+// Finds the pixels of the input read by every grid row and column, including the bicubic
+// filter when the image is scaled.
+static void find_footprint(const incremental_t *inc, footprint_t *fp) {
+	const image_job_t *job = inc->job;
+	int rows = job->grid->rows, cols = job->grid->cols;
+
+	fp->row_first = (int *)malloc(rows * sizeof(int));
+	fp->row_end = (int *)malloc(rows * sizeof(int));
+	fp->col_first = (int *)malloc(cols * sizeof(int));
+	fp->col_end = (int *)malloc(cols * sizeof(int));
+	if (!fp->row_first || !fp->row_end || !fp->col_first || !fp->col_end) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	if (!job->plan) {
+		for (int i = 0; i < rows; i++) {
+			fp->row_first[i] = sample_index(inc, i, rows - 1);
+			fp->row_end[i] = fp->row_first[i] + 1;
+		}
+		for (int j = 0; j < cols; j++) {
+			fp->col_first[j] = sample_index(inc, j, cols - 1);
+			fp->col_end[j] = fp->col_first[j] + 1;
+		}
+		return;
+	}
+
+	for (int i = 0; i < rows; i++) {
+		resample_row_footprint(job->plan, sample_index(inc, i, rows - 1), &fp->row_first[i],
+							   &fp->row_end[i]);
+	}
+	for (int j = 0; j < cols; j++) {
+		int c = sample_index(inc, j, cols - 1);
+		int k, end;
+		resample_find_cols(job->plan, c, c + 1, &k, &end);
+		resample_col_footprint(job->plan, k, &fp->col_first[j], &fp->col_end[j]);
+	}
+}
+
+static void free_footprint(footprint_t *fp) {
+	free(fp->row_first);
+	free(fp->row_end);
+	free(fp->col_first);
+	free(fp->col_end);
+}
+
+// Counts the changed blocks in the blocks [0, br) x [0, bc), from the prefix sums `changed`.
+static int changed_before(const incremental_t *inc, const int *changed, int br, int bc) {
+	return changed[br * (inc->block_cols + 1) + bc];
+}
+
+// Checks if any block with pixels in lines [first_line, end_line) and columns
+// [first_col, end_col) of the input changed.
+static int region_changed(const incremental_t *inc, const int *changed, int first_line,
+						  int end_line, int first_col, int end_col) {
+	int br0 = first_line / INCREMENTAL_BLOCK;
+	int br1 = (end_line - 1) / INCREMENTAL_BLOCK + 1;
+	int bc0 = first_col / INCREMENTAL_BLOCK;
+	int bc1 = (end_col - 1) / INCREMENTAL_BLOCK + 1;
+
+	return changed_before(inc, changed, br1, bc1) - changed_before(inc, changed, br0, bc1) -
+		   changed_before(inc, changed, br1, bc0) + changed_before(inc, changed, br0, bc0) > 0;
+}
+
+// Checks if a sample of grid point (i, j) reads a block which changed.
+static int point_changed(const incremental_t *inc, const footprint_t *fp, const int *changed,
+						 int i, int j) {
+	// the resampler reads the lines of a column and the pixels of a row from each line
+	if (inc->job->plan) {
+		return region_changed(inc, changed, fp->col_first[j], fp->col_end[j], fp->row_first[i],
+							  fp->row_end[i]);
+	}
+
+	return region_changed(inc, changed, fp->row_first[i], fp->row_end[i], fp->col_first[j],
+						  fp->col_end[j]);
+}
+
+// Configuration of square (i, j), like `grid_row_cases`.
+static int square_case(const grid_t *grid, int i, int j) {
+	return 8 * grid_get(grid, i, j) + 4 * grid_get(grid, i, j + 1) +
+		   2 * grid_get(grid, i + 1, j + 1) + grid_get(grid, i + 1, j);
+}
+
+// Updates the output of the previous run, `out_file`, using the cache: the blocks whose
+// checksums changed give the grid points whose samples are scaled and thresholded again, and
+// only the squares with a point which changed are stamped again, in place. Returns 1 if the
+// output was updated, 0 if the cache cannot be used, in which case the job must be run whole.
+int incremental_update(incremental_t *inc, const contour_atlas_t *atlas) {
+	image_job_t *job = inc->job;
+	ppm_image *scaled_image = job->scaled_image;
+	grid_t *grid = job->grid;
+	int step = inc->config->step;
+	int grid_x_points = grid->rows - 1;
+	int grid_y_points = grid->cols - 1;
+
+	// the pixels which are not stamped would have to be computed again
+	if (scaled_image->x % step || scaled_image->y % step) {
+		return 0;
+	}
+
+	// the last column of the grid is sampled at index `x - 1` of its lines, which wraps into
+	// the next lines when the image is wider than high, out of the footprint of the column
+	if (scaled_image->x > scaled_image->y) {
+		return 0;
+	}
+
+	ppm_image *output = ppm_map_update(inc->config->out_file);
+	if (!output) {
+		return 0;
+	}
+	if (output->x != scaled_image->x || output->y != scaled_image->y) {
+		ppm_unmap(output);
+		return 0;
+	}
+
+	uint64_t *old_sums = load_cache(inc);
+	if (!old_sums) {
+		ppm_unmap(output);
+		return 0;
+	}
+
+	// prefix sums of the blocks which changed
+	int *changed = (int *)calloc((size_t)(inc->block_rows + 1) * (inc->block_cols + 1),
+								 sizeof(int));
+	if (!changed) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	int nr_blocks = 0;
+	for (int br = 0; br < inc->block_rows; br++) {
+		for (int bc = 0; bc < inc->block_cols; bc++) {
+			int diff = old_sums[br * inc->block_cols + bc] != inc->sums[br * inc->block_cols + bc];
+			nr_blocks += diff;
+			changed[(br + 1) * (inc->block_cols + 1) + bc + 1] =
+				diff + changed_before(inc, changed, br, bc + 1) +
+				changed_before(inc, changed, br + 1, bc) - changed_before(inc, changed, br, bc);
+		}
+	}
+
+	footprint_t fp;
+	find_footprint(inc, &fp);
+
+	unsigned char *stale = (unsigned char *)calloc((size_t)grid_x_points * grid_y_points, 1);
+	int *cols = (int *)malloc(grid->cols * sizeof(int));
+	if (!stale || !cols) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	int nr_points = 0;
+	for (int i = 0; nr_blocks && i < grid->rows; i++) {
+		// the last point of the grid is always 0
+		int n = i == grid_x_points ? grid_y_points : grid->cols;
+		int r = sample_index(inc, i, grid_x_points);
+
+		int nr_cols = 0;
+		for (int j = 0; j < n; j++) {
+			if (point_changed(inc, &fp, changed, i, j)) {
+				cols[nr_cols++] = j;
+			}
+		}
+		if (!nr_cols) {
+			continue;
+		}
+
+		// scale the samples again, from the first to the last point which changed
+		if (job->plan) {
+			int first_col, end_col;
+			resample_find_cols(job->plan, sample_index(inc, cols[0], grid_y_points),
+							   sample_index(inc, cols[nr_cols - 1], grid_y_points) + 1,
+							   &first_col, &end_col);
+			resample_block(job->plan, job->image, scaled_image, &r, 1, first_col, end_col);
+		}
+
+		for (int c = 0; c < nr_cols; c++) {
+			int j = cols[c];
+			ppm_pixel pixel = scaled_image->data[(size_t)r * scaled_image->y +
+												 sample_index(inc, j, grid_y_points)];
+			int value = grid_threshold(pixel, inc->config->sigma);
+			if (value == grid_get(grid, i, j)) {
+				continue;
+			}
+
+			// the squares around the point change
+			grid_set(grid, i, j, value);
+			nr_points++;
+			for (int si = MAX(i - 1, 0); si <= MIN(i, grid_x_points - 1); si++) {
+				for (int sj = MAX(j - 1, 0); sj <= MIN(j, grid_y_points - 1); sj++) {
+					stale[(size_t)si * grid_y_points + sj] = 1;
+				}
+			}
+		}
+	}
+
+	int nr_squares = 0;
+	for (int i = 0; nr_points && i < grid_x_points; i++) {
+		for (int j = 0; j < grid_y_points; j++) {
+			if (stale[(size_t)i * grid_y_points + j]) {
+				atlas_stamp_tile(atlas, output, square_case(grid, i, j), i * step, j * step);
+				nr_squares++;
+			}
+		}
+	}
+
+	if (inc->config->stats) {
+		fprintf(stderr, "incremental: %d blocks, %d points, %d squares changed\n", nr_blocks,
+				nr_points, nr_squares);
+	}
+
+	free(cols);
+	free(stale);
+	free_footprint(&fp);
+	free(changed);
+	free(old_sums);
+	ppm_unmap(output);
+
+	return 1;
+}
@@ -0,0 +1,41 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#ifndef INCREMENTAL_H_
+#define INCREMENTAL_H_
+
+#include <stdint.h>
+
+#include "atlas.h"
+#include "config.h"
+#include "types.h"
+
+// Side of the blocks of the input whose checksums are compared between runs, in pixels.
+#define INCREMENTAL_BLOCK 64
+
+// State of an incremental run. The input is seen as `nr_lines` lines of `line_size` pixels, the
+// way it is read by the resampler (or by the grid, when it is not scaled), and split in blocks
+// of INCREMENTAL_BLOCK x INCREMENTAL_BLOCK pixels.
+typedef struct {
+	const config_t *config;
+	image_job_t *job;
+	int nr_lines, line_size;
+	int block_rows, block_cols;
+
+	// checksums of the blocks of the input, row by row
+	uint64_t *sums;
+} incremental_t;
+
+// Computes the checksums of the blocks of the input of `job`.
+incremental_t *incremental_open(const config_t *config, image_job_t *job);
+
+// Updates the output of the previous run, `out_file`, using the cache: the blocks whose
+// checksums changed give the grid points whose samples are scaled and thresholded again, and
+// only the squares with a point which changed are stamped again, in place. Returns 1 if the
+// output was updated, 0 if the cache cannot be used, in which case the job must be run whole.
+int incremental_update(incremental_t *inc, const contour_atlas_t *atlas);
+
+// Writes the checksums and the grid of the job in the cache.
+void incremental_save(incremental_t *inc);
+
+void incremental_close(incremental_t *inc);
+
+#endif  // INCREMENTAL_H_
@@ -0,0 +1,258 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#include "levels.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+#include "atlas.h"
+#include "helpers.h"
+#include "simd.h"
+
+#ifdef SIMD_X86
+#include <immintrin.h>
+#endif
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+
+// Carves a grid with all the points above every level out of `arena`. The kernels use the
+// instruction set `isa`.
+level_grid_t *level_grid_create(arena_t *arena, int rows, int cols, const unsigned char *levels,
+								int nr_levels, int saddle, simd_isa_t isa) {
+	level_grid_t *grid = (level_grid_t *)arena_alloc(arena, sizeof(level_grid_t));
+
+	grid->rows = rows;
+	grid->cols = cols;
+	grid->lum = (unsigned char *)arena_alloc(arena, (size_t)rows * cols);
+	memset(grid->lum, RGB_COMPONENT_COLOR, (size_t)rows * cols);
+
+	grid->nr_levels = nr_levels;
+	grid->levels = levels;
+	grid->saddle = saddle;
+	grid->isa = isa;
+
+	int k = 0;
+	for (int v = 0; v <= RGB_COMPONENT_COLOR; v++) {
+		while (k < nr_levels && levels[k] < v) {
+			k++;
+		}
+		grid->first[v] = k;
+	}
+
+	return grid;
+}
+
+// Size a grid takes in an arena.
+size_t level_grid_arena_size(int rows, int cols) {
+	return arena_block_size(sizeof(level_grid_t)) + arena_block_size((size_t)rows * cols);
+}
+
+#ifdef SIMD_X86
+
+// Computes the luminance of 16 samples. The components are copied one by one, since the samples
+// are far apart, then (r + g + b) / 3 is computed as (r + g + b) * 0xAAAB >> 17, which is exact
+// for sums below 3 * 2^15.
+static inline __m128i luminance_sse(const ppm_pixel *first, int stride) {
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i third = _mm_set1_epi16((short)0xAAAB);
+	uint8_t red[16], green[16], blue[16];
+
+	for (int l = 0; l < 16; l++) {
+		const ppm_pixel *pixel = &first[l * stride];
+		red[l] = pixel->red;
+		green[l] = pixel->green;
+		blue[l] = pixel->blue;
+	}
+
+	__m128i r = _mm_loadu_si128((const __m128i *)red);
+	__m128i g = _mm_loadu_si128((const __m128i *)green);
+	__m128i b = _mm_loadu_si128((const __m128i *)blue);
+
+	__m128i sum_lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(r, zero),
+												 _mm_unpacklo_epi8(g, zero)),
+								   _mm_unpacklo_epi8(b, zero));
+	__m128i sum_hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(r, zero),
+												 _mm_unpackhi_epi8(g, zero)),
+								   _mm_unpackhi_epi8(b, zero));
+
+	return _mm_packus_epi16(_mm_srli_epi16(_mm_mulhi_epu16(sum_lo, third), 1),
+							_mm_srli_epi16(_mm_mulhi_epu16(sum_hi, third), 1));
+}
+
+// Mask of the points which are below `level`, whose 16 lanes all hold the level.
+static inline __m128i below_sse(__m128i lum, __m128i level) {
+	return _mm_cmpeq_epi8(_mm_min_epu8(lum, level), lum);
+}
+
+// Computes the configurations of the first squares of a row, 16 at a time, like
+// `level_grid_case`. Returns the number of squares computed.
+static int row_cases_sse(const level_grid_t *grid, const unsigned char *top,
+						 const unsigned char *bottom, int n, int level, unsigned char *cases) {
+	const __m128i lv = _mm_set1_epi8((char)level);
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i centre_limit = _mm_set1_epi16(4 * level + 2);
+	int j = 0;
+
+	for (; j + 16 <= n; j += 16) {
+		__m128i top_left = _mm_loadu_si128((const __m128i *)(top + j));
+		__m128i top_right = _mm_loadu_si128((const __m128i *)(top + j + 1));
+		__m128i bottom_left = _mm_loadu_si128((const __m128i *)(bottom + j));
+		__m128i bottom_right = _mm_loadu_si128((const __m128i *)(bottom + j + 1));
+
+		__m128i config = _mm_or_si128(
+			_mm_or_si128(_mm_and_si128(below_sse(top_left, lv), _mm_set1_epi8(8)),
+						 _mm_and_si128(below_sse(top_right, lv), _mm_set1_epi8(4))),
+			_mm_or_si128(_mm_and_si128(below_sse(bottom_right, lv), _mm_set1_epi8(2)),
+						 _mm_and_si128(below_sse(bottom_left, lv), _mm_set1_epi8(1))));
+
+		if (grid->saddle) {
+			__m128i sum_lo = _mm_add_epi16(_mm_add_epi16(_mm_unpacklo_epi8(top_left, zero),
+														 _mm_unpacklo_epi8(top_right, zero)),
+										   _mm_add_epi16(_mm_unpacklo_epi8(bottom_left, zero),
+														 _mm_unpacklo_epi8(bottom_right, zero)));
+			__m128i sum_hi = _mm_add_epi16(_mm_add_epi16(_mm_unpackhi_epi8(top_left, zero),
+														 _mm_unpackhi_epi8(top_right, zero)),
+										   _mm_add_epi16(_mm_unpackhi_epi8(bottom_left, zero),
+														 _mm_unpackhi_epi8(bottom_right, zero)));
+			__m128i joined = _mm_packs_epi16(_mm_cmplt_epi16(sum_lo, centre_limit),
+											 _mm_cmplt_epi16(sum_hi, centre_limit));
+
+			// 5 + 11 is ATLAS_JOINED_SADDLE_5 and 10 + 7 is ATLAS_JOINED_SADDLE_10
+			__m128i saddle_5 = _mm_and_si128(_mm_cmpeq_epi8(config, _mm_set1_epi8(5)), joined);
+			__m128i saddle_10 = _mm_and_si128(_mm_cmpeq_epi8(config, _mm_set1_epi8(10)), joined);
+			config = _mm_add_epi8(config, _mm_or_si128(
+				_mm_and_si128(saddle_5, _mm_set1_epi8(ATLAS_JOINED_SADDLE_5 - 5)),
+				_mm_and_si128(saddle_10, _mm_set1_epi8(ATLAS_JOINED_SADDLE_10 - 10))));
+		}
+
+		_mm_storeu_si128((__m128i *)(cases + j), config);
+	}
+
+	return j;
+}
+
+#endif  // SIMD_X86
+
+// Computes the luminance of `n` points found on row `i` of the grid, starting with column `col`.
+// Their samples are `stride` pixels apart, starting with `first`.
+void level_grid_sample(level_grid_t *grid, int i, int col, const ppm_pixel *first, int stride,
+					   int n) {
+	unsigned char *row = level_grid_row(grid, i) + col;
+	int j = 0;
+
+#ifdef SIMD_X86
+	if (grid->isa != SIMD_ISA_SCALAR) {
+		for (; j + 16 <= n; j += 16) {
+			_mm_storeu_si128((__m128i *)(row + j), luminance_sse(first + (size_t)j * stride,
+																 stride));
+		}
+	}
+#endif
+
+	for (; j < n; j++) {
+		ppm_pixel pixel = first[(size_t)j * stride];
+		row[j] = (pixel.red + pixel.green + pixel.blue) / 3;
+	}
+}
+
+// Computes the configurations of the squares formed by rows `i` and `i + 1` of the grid, for
+// level `k`, like `level_grid_case`.
+void level_grid_row_cases(const level_grid_t *grid, int i, int k, unsigned char *cases) {
+	const unsigned char *top = level_grid_row(grid, i);
+	const unsigned char *bottom = level_grid_row(grid, i + 1);
+	int level = grid->levels[k];
+	int n = grid->cols - 1;
+	int j = 0;
+
+#ifdef SIMD_X86
+	if (grid->isa != SIMD_ISA_SCALAR) {
+		j = row_cases_sse(grid, top, bottom, n, level, cases);
+	}
+#endif
+
+	for (; j < n; j++) {
+		cases[j] = level_grid_case(grid, top[j], top[j + 1], bottom[j + 1], bottom[j], level);
+	}
+}
+
+// Stamps the contours of every level on the squares formed by rows `i` and `i + 1` of the grid,
+// which start on line `x` of the image. The levels a square lies between are found from its
+// darkest and brightest corners, so the levels which do not cross it are never looked at.
+// `cases` must hold a configuration for every square.
+//
+// The result is the darkest of the contours of all the levels: a level is crossed by a square
+// when its darkest corner is at most the level and its brightest corner is above it. A level
+// above the whole square gives the grey contour 15 and one below it the white contour 0, which
+// never darkens the others. A square is first stamped with its darkest contour which covers it
+// whole (15 if a level is above it, otherwise the contour of the lowest level which crosses it),
+// as a run of the row, then the other levels which cross it are drawn over it.
+void level_grid_stamp_row(const level_grid_t *grid, int i, const contour_atlas_t *atlas,
+						  ppm_image *image, int x, int step, unsigned char *cases) {
+	const unsigned char *top = level_grid_row(grid, i);
+	const unsigned char *bottom = level_grid_row(grid, i + 1);
+	int n = grid->cols - 1;
+	int highest = grid->levels[grid->nr_levels - 1];
+
+	// a single level is the contour of its configurations
+	if (grid->nr_levels == 1) {
+		level_grid_row_cases(grid, i, 0, cases);
+		atlas_stamp_row(atlas, image, x, 0, cases, n, step);
+		return;
+	}
+
+	for (int j = 0; j < n; j++) {
+		int darkest = MIN(MIN(top[j], top[j + 1]), MIN(bottom[j], bottom[j + 1]));
+		int brightest = MAX(MAX(top[j], top[j + 1]), MAX(bottom[j], bottom[j + 1]));
+		int k = grid->first[darkest];
+
+		if (brightest <= highest) {
+			cases[j] = 15;
+		} else if (k < grid->nr_levels) {
+			cases[j] = level_grid_case(grid, top[j], top[j + 1], bottom[j + 1], bottom[j],
+									   grid->levels[k]);
+		} else {
+			cases[j] = 0;
+		}
+	}
+
+	atlas_stamp_row(atlas, image, x, 0, cases, n, step);
+
+	for (int j = 0; j < n; j++) {
+		int darkest = MIN(MIN(top[j], top[j + 1]), MIN(bottom[j], bottom[j + 1]));
+		int brightest = MAX(MAX(top[j], top[j + 1]), MAX(bottom[j], bottom[j + 1]));
+		int k = grid->first[darkest];
+
+		// the lowest level was already stamped
+		if (brightest > highest) {
+			k++;
+		}
+
+		for (; k < grid->nr_levels && grid->levels[k] < brightest; k++) {
+			int config = level_grid_case(grid, top[j], top[j + 1], bottom[j + 1], bottom[j],
+										 grid->levels[k]);
+			atlas_blend_tile(atlas, image, config, x, j * step);
+		}
+	}
+}
+
+// Returns the name of the file of the layer of `level`: `out_file` with the level added before
+// the extension.
+char *level_layer_path(const char *out_file, int level) {
+	size_t len = strlen(out_file);
+	const char *ext = strrchr(out_file, '.');
+	const char *slash = strrchr(out_file, '/');
+	if (!ext || (slash && ext < slash)) {
+		ext = out_file + len;
+	}
+
+	char *path = (char *)malloc(len + 5);
+	if (!path) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	sprintf(path, "%.*s_%03d%s", (int)(ext - out_file), out_file, level, ext);
+
+	return path;
+}
@@ -0,0 +1,84 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#ifndef LEVELS_H_
+#define LEVELS_H_
+
+#include "arena.h"
+#include "atlas.h"
+#include "helpers.h"
+#include "simd.h"
+
+// Luminance of the grid points, used to draw the isolines of several levels. A point is below
+// a level (value 1) when its luminance is at most the level. The levels are sorted and distinct,
+// in [0, RGB_COMPONENT_COLOR - 1], so that a point with the luminance RGB_COMPONENT_COLOR is
+// above all of them.
+typedef struct {
+	int rows, cols;
+	unsigned char *lum;
+
+	int nr_levels;
+	const unsigned char *levels;
+
+	// index of the first level which is at least `v`, for every luminance `v`
+	unsigned char first[RGB_COMPONENT_COLOR + 1];
+
+	// resolve the saddles from the average of their corners, see `level_grid_case`
+	int saddle;
+	simd_isa_t isa;
+} level_grid_t;
+
+// Carves a grid with all the points above every level out of `arena`. The kernels use the
+// instruction set `isa`.
+level_grid_t *level_grid_create(arena_t *arena, int rows, int cols, const unsigned char *levels,
+								int nr_levels, int saddle, simd_isa_t isa);
+
+// Size a grid takes in an arena.
+size_t level_grid_arena_size(int rows, int cols);
+
+static inline unsigned char *level_grid_row(const level_grid_t *grid, int i) {
+	return grid->lum + (size_t)i * grid->cols;
+}
+
+// Configuration of a square for `level`, from the luminance of its corners.
+static inline int level_case(int top_left, int top_right, int bottom_right, int bottom_left,
+							 int level) {
+	return 8 * (top_left <= level) + 4 * (top_right <= level) + 2 * (bottom_right <= level) +
+		   (bottom_left <= level);
+}
+
+// Configuration of a square for `level`. With `saddle`, the saddles (5 and 10) whose centre is
+// below the level, the centre being the average of the corners, are the joined saddles: the
+// isoline is at level + 0.5, so the centre is below it when the sum of the corners is at most
+// 4 * level + 1.
+static inline int level_grid_case(const level_grid_t *grid, int top_left, int top_right,
+								  int bottom_right, int bottom_left, int level) {
+	int config = level_case(top_left, top_right, bottom_right, bottom_left, level);
+
+	if (grid->saddle && (config == 5 || config == 10) &&
+		top_left + top_right + bottom_right + bottom_left <= 4 * level + 1) {
+		config = config == 5 ? ATLAS_JOINED_SADDLE_5 : ATLAS_JOINED_SADDLE_10;
+	}
+
+	return config;
+}
+
+// Computes the luminance of `n` points found on row `i` of the grid, starting with column `col`.
+// Their samples are `stride` pixels apart, starting with `first`.
+void level_grid_sample(level_grid_t *grid, int i, int col, const ppm_pixel *first, int stride,
+					   int n);
+
+// Computes the configurations of the squares formed by rows `i` and `i + 1` of the grid, for
+// level `k`, like `level_grid_case`.
+void level_grid_row_cases(const level_grid_t *grid, int i, int k, unsigned char *cases);
+
+// Stamps the contours of every level on the squares formed by rows `i` and `i + 1` of the grid,
+// which start on line `x` of the image. The levels a square lies between are found from its
+// darkest and brightest corners, so the levels which do not cross it are never looked at.
+// `cases` must hold a configuration for every square.
+void level_grid_stamp_row(const level_grid_t *grid, int i, const contour_atlas_t *atlas,
+						  ppm_image *image, int x, int step, unsigned char *cases);
+
+// Returns the name of the file of the layer of `level`: `out_file` with the level added before
+// the extension.
+char *level_layer_path(const char *out_file, int level);
+
+#endif  // LEVELS_H_
@@ -0,0 +1,353 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+// needed for sched_getaffinity and pthread_attr_setaffinity_np
+#define _GNU_SOURCE
+
+#include "numa.h"
+
+#include <dirent.h>
+#include <linux/mempolicy.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include "config.h"
+#include "helpers.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+
+// Directory of the NUMA nodes in sysfs, with a node<id>/cpulist file for every node.
+#define NUMA_SYSFS_NODES "/sys/devices/system/node"
+
+// Number of pages whose node is asked for at once.
+#define NUMA_QUERY_PAGES 1024
+
+// Bits of a mask of nodes held by a word.
+#define NUMA_WORD_BITS (8 * sizeof(unsigned long))
+
+static void set_node(unsigned long *mask, int node) {
+	mask[node / NUMA_WORD_BITS] |= 1UL << (node % NUMA_WORD_BITS);
+}
+
+static int has_node(const unsigned long *mask, int node) {
+	return (mask[node / NUMA_WORD_BITS] >> (node % NUMA_WORD_BITS)) & 1;
+}
+
+// Reads the list of CPUs of `node` (ranges such as 0-3,8-11) and records the node of each of
+// them in `cpu_nodes`.
+static void read_node_cpus(int node, int *cpu_nodes) {
+	char path[64];
+	snprintf(path, sizeof(path), NUMA_SYSFS_NODES "/node%d/cpulist", node);
+
+	FILE *file = fopen(path, "r");
+	if (!file) {
+		return;
+	}
+
+	char list[4096];
+	if (!fgets(list, sizeof(list), file)) {
+		fclose(file);
+		return;
+	}
+	fclose(file);
+
+	char *pos = list;
+	while (*pos >= '0' && *pos <= '9') {
+		long first = strtol(pos, &pos, 10);
+		long last = first;
+		if (*pos == '-') {
+			last = strtol(pos + 1, &pos, 10);
+		}
+
+		for (long cpu = first; cpu <= last && cpu < CPU_SETSIZE; cpu++) {
+			cpu_nodes[cpu] = node;
+		}
+
+		if (*pos == ',') {
+			pos++;
+		}
+	}
+}
+
+// Finds the node of every CPU, or -1 for the CPUs sysfs does not list.
+static void read_cpu_nodes(int *cpu_nodes) {
+	for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+		cpu_nodes[cpu] = -1;
+	}
+
+	DIR *dir = opendir(NUMA_SYSFS_NODES);
+	if (!dir) {
+		return;
+	}
+
+	struct dirent *entry;
+	while ((entry = readdir(dir))) {
+		int node;
+		char extra;
+		if (sscanf(entry->d_name, "node%d%c", &node, &extra) == 1 && node >= 0 &&
+			node < NUMA_MAX_NODES) {
+			read_node_cpus(node, cpu_nodes);
+		}
+	}
+
+	closedir(dir);
+}
+
+// Reads the nodes of the CPUs from sysfs and orders the CPUs for `mode`: the ones of a node
+// after the other for NUMA_COMPACT, or a CPU of every node in turn for NUMA_SCATTER.
+numa_topology_t *numa_topology_create(numa_mode_t mode) {
+	numa_topology_t *topology = (numa_topology_t *)calloc(1, sizeof(numa_topology_t));
+	int *cpu_nodes = (int *)malloc(CPU_SETSIZE * sizeof(int));
+	int *allowed = (int *)malloc(CPU_SETSIZE * sizeof(int));
+	if (!topology || !cpu_nodes || !allowed) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	read_cpu_nodes(cpu_nodes);
+
+	// the CPUs the process may run on, the ones missing from sysfs going to node 0
+	cpu_set_t set;
+	int nr_allowed = 0;
+	if (!sched_getaffinity(0, sizeof(set), &set)) {
+		for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+			if (CPU_ISSET(cpu, &set)) {
+				allowed[nr_allowed++] = cpu;
+			}
+		}
+	}
+	if (!nr_allowed) {
+		allowed[nr_allowed++] = 0;
+	}
+	for (int k = 0; k < nr_allowed; k++) {
+		if (cpu_nodes[allowed[k]] < 0) {
+			cpu_nodes[allowed[k]] = 0;
+		}
+		set_node(topology->mask, cpu_nodes[allowed[k]]);
+	}
+
+	// the nodes in increasing order, with the position of the next CPU of each of them
+	int nodes[NUMA_MAX_NODES];
+	int next[NUMA_MAX_NODES];
+	for (int node = 0; node < NUMA_MAX_NODES; node++) {
+		if (has_node(topology->mask, node)) {
+			next[topology->nr_nodes] = 0;
+			nodes[topology->nr_nodes++] = node;
+		}
+	}
+
+	topology->mode = mode;
+	topology->nr_cpus = nr_allowed;
+	topology->cpus = (int *)malloc(nr_allowed * sizeof(int));
+	topology->nodes = (int *)malloc(nr_allowed * sizeof(int));
+	if (!topology->cpus || !topology->nodes) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	// compact takes every CPU of a node before moving to the next one, scatter takes the next
+	// CPU of each node in turn
+	int count = 0;
+	for (int n = 0; count < nr_allowed; n = (n + 1) % topology->nr_nodes) {
+		int taken = 0;
+		while (next[n] < nr_allowed && (mode != NUMA_SCATTER || !taken)) {
+			int cpu = allowed[next[n]++];
+			if (cpu_nodes[cpu] == nodes[n]) {
+				topology->cpus[count] = cpu;
+				topology->nodes[count++] = nodes[n];
+				taken = 1;
+			}
+		}
+	}
+
+	free(allowed);
+	free(cpu_nodes);
+
+	return topology;
+}
+
+void numa_topology_destroy(numa_topology_t *topology) {
+	free(topology->cpus);
+	free(topology->nodes);
+	free(topology);
+}
+
+// Name of a NUMA mode, as printed by the statistics.
+const char *numa_mode_name(numa_mode_t mode) {
+	switch (mode) {
+	case NUMA_COMPACT:
+		return "compact";
+	case NUMA_SCATTER:
+		return "scatter";
+	default:
+		return "off";
+	}
+}
+
+// Node of the CPU thread `thread_id` is pinned to.
+int numa_thread_node(const numa_topology_t *topology, int thread_id) {
+	return topology->nodes[thread_id % topology->nr_cpus];
+}
+
+// Pins the thread `thread_id`, created with `attr`, to its CPU.
+void numa_pin_thread(const numa_topology_t *topology, int thread_id, pthread_attr_t *attr) {
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(topology->cpus[thread_id % topology->nr_cpus], &set);
+
+	pthread_attr_setaffinity_np(attr, sizeof(set), &set);
+}
+
+// Applies the memory policy `mode` over `mask` to the whole pages of [first, end), moving the
+// pages already touched. Errors are ignored, the placement being a hint.
+static void set_policy(uintptr_t first, uintptr_t end, int mode, const unsigned long *mask) {
+	if (first < end) {
+		syscall(SYS_mbind, (void *)first, end - first, mode, mask, NUMA_MAX_NODES + 1,
+				MPOL_MF_MOVE);
+	}
+}
+
+static uintptr_t page_down(const void *addr) {
+	return (uintptr_t)addr & ~((uintptr_t)sysconf(_SC_PAGESIZE) - 1);
+}
+
+static uintptr_t page_up(const void *addr) {
+	return page_down((const char *)addr + sysconf(_SC_PAGESIZE) - 1);
+}
+
+// Spreads the pages of [addr, addr + size) over the nodes, moving the ones already touched.
+// The placement is a hint: the pages stay where they are when the kernel refuses.
+void numa_interleave(const numa_topology_t *topology, const void *addr, size_t size) {
+	set_policy(page_down(addr), page_up((const char *)addr + size), MPOL_INTERLEAVE,
+			   topology->mask);
+}
+
+// Pages of the band of thread `t`. Every page goes to the band of its first byte, except the
+// first one, which goes to the first band.
+static void band_pages(const void *addr, size_t size, size_t row_size, int nr_rows, int step,
+					   int nr_threads, int t, uintptr_t *first, uintptr_t *end) {
+	const char *base = (const char *)addr;
+	int grid_x_points = nr_rows / step;
+
+	// the same split as the static bands of grid rows of the threads
+	int start = t * (double)grid_x_points / nr_threads;
+	int stop = MIN((t + 1) * (double)grid_x_points / nr_threads, grid_x_points);
+
+	*first = t ? page_up(base + (size_t)start * step * row_size) : page_down(base);
+	*end = t == nr_threads - 1 ? page_up(base + size)
+							   : page_up(base + (size_t)stop * step * row_size);
+}
+
+// Places the pages of the band of rows of each of the `nr_threads` threads on its node, the
+// `nr_rows` rows of `row_size` bytes starting at `addr` being split like the static bands of
+// the grid rows of the threads, `step` rows per grid row. The rows and the bytes of
+// [addr, addr + size) after the last grid row go with the last band. Like `numa_interleave`,
+// the placement is a hint.
+void numa_bind_bands(const numa_topology_t *topology, const void *addr, size_t size,
+					 size_t row_size, int nr_rows, int step, int nr_threads) {
+	for (int t = 0; t < nr_threads; t++) {
+		uintptr_t first, end;
+		band_pages(addr, size, row_size, nr_rows, step, nr_threads, t, &first, &end);
+
+		unsigned long mask[NUMA_MASK_WORDS] = {0};
+		set_node(mask, numa_thread_node(topology, t));
+
+		// preferred rather than bound, so that a full node does not fail the allocations
+		set_policy(first, end, MPOL_PREFERRED, mask);
+	}
+}
+
+// Calls `count` with the node of every page of [first, end), or with a negative error when
+// the page is not backed by memory.
+static void query_pages(uintptr_t first, uintptr_t end, void (*count)(void *, int), void *ctx) {
+	void *pages[NUMA_QUERY_PAGES];
+	int status[NUMA_QUERY_PAGES];
+	uintptr_t page_size = sysconf(_SC_PAGESIZE);
+
+	while (first < end) {
+		int nr_pages = 0;
+		for (; first < end && nr_pages < NUMA_QUERY_PAGES; first += page_size) {
+			pages[nr_pages++] = (void *)first;
+		}
+
+		// without a node for each page, move_pages only tells where they are
+		if (syscall(SYS_move_pages, 0, (unsigned long)nr_pages, pages, NULL, status, 0)) {
+			for (int k = 0; k < nr_pages; k++) {
+				status[k] = -1;
+			}
+		}
+
+		for (int k = 0; k < nr_pages; k++) {
+			count(ctx, status[k]);
+		}
+	}
+}
+
+// Pages of the bands, split by where they are compared with the node of their thread.
+typedef struct {
+	int node;
+	size_t local, remote, untouched;
+} band_count_t;
+
+static void count_band_page(void *ctx, int node) {
+	band_count_t *count = (band_count_t *)ctx;
+
+	if (node < 0) {
+		count->untouched++;
+	} else if (node == count->node) {
+		count->local++;
+	} else {
+		count->remote++;
+	}
+}
+
+// Prints how many pages of the bands of `numa_bind_bands` are on the node of their thread,
+// on other nodes, or not backed by memory yet.
+void numa_print_bands(const numa_topology_t *topology, const char *name, const void *addr,
+					  size_t size, size_t row_size, int nr_rows, int step, int nr_threads,
+					  FILE *file) {
+	band_count_t count = {0, 0, 0, 0};
+
+	for (int t = 0; t < nr_threads; t++) {
+		uintptr_t first, end;
+		band_pages(addr, size, row_size, nr_rows, step, nr_threads, t, &first, &end);
+
+		count.node = numa_thread_node(topology, t);
+		query_pages(first, end, count_band_page, &count);
+	}
+
+	fprintf(file, "numa: %s: %zu local, %zu remote, %zu untouched pages\n", name, count.local,
+			count.remote, count.untouched);
+}
+
+static void count_node_page(void *ctx, int node) {
+	size_t *pages = (size_t *)ctx;
+
+	pages[node >= 0 && node < NUMA_MAX_NODES ? node : NUMA_MAX_NODES]++;
+}
+
+// Prints how many pages of [addr, addr + size) are on each node.
+void numa_print_pages(const numa_topology_t *topology, const char *name, const void *addr,
+					  size_t size, FILE *file) {
+	size_t *pages = (size_t *)calloc(NUMA_MAX_NODES + 1, sizeof(size_t));
+	if (!pages) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	query_pages(page_down(addr), page_up((const char *)addr + size), count_node_page, pages);
+
+	fprintf(file, "numa: %s:", name);
+	for (int node = 0; node < NUMA_MAX_NODES; node++) {
+		if (has_node(topology->mask, node) || pages[node]) {
+			fprintf(file, " node %d %zu,", node, pages[node]);
+		}
+	}
+	fprintf(file, " untouched %zu pages\n", pages[NUMA_MAX_NODES]);
+
+	free(pages);
+}
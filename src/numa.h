@@ -0,0 +1,68 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#ifndef NUMA_H_
+#define NUMA_H_
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "config.h"
+
+// Upper bound for the ids of the NUMA nodes.
+#define NUMA_MAX_NODES 1024
+
+// Words of a mask of nodes.
+#define NUMA_MASK_WORDS (NUMA_MAX_NODES / (8 * sizeof(unsigned long)))
+
+// CPUs the threads are pinned to, in the order of their ids, and the nodes they belong to. Only
+// the CPUs the process is allowed to run on are used; without NUMA information they all belong
+// to node 0.
+typedef struct {
+	numa_mode_t mode;
+	int nr_cpus;
+	int *cpus;
+	int *nodes;
+
+	// the nodes which have such CPUs, over which the shared buffers are interleaved
+	int nr_nodes;
+	unsigned long mask[NUMA_MASK_WORDS];
+} numa_topology_t;
+
+// Reads the nodes of the CPUs from sysfs and orders the CPUs for `mode`: the ones of a node
+// after the other for NUMA_COMPACT, or a CPU of every node in turn for NUMA_SCATTER.
+numa_topology_t *numa_topology_create(numa_mode_t mode);
+
+void numa_topology_destroy(numa_topology_t *topology);
+
+// Name of a NUMA mode, as printed by the statistics.
+const char *numa_mode_name(numa_mode_t mode);
+
+// Node of the CPU thread `thread_id` is pinned to.
+int numa_thread_node(const numa_topology_t *topology, int thread_id);
+
+// Pins the thread `thread_id`, created with `attr`, to its CPU.
+void numa_pin_thread(const numa_topology_t *topology, int thread_id, pthread_attr_t *attr);
+
+// Spreads the pages of [addr, addr + size) over the nodes, moving the ones already touched.
+// The placement is a hint: the pages stay where they are when the kernel refuses.
+void numa_interleave(const numa_topology_t *topology, const void *addr, size_t size);
+
+// Places the pages of the band of rows of each of the `nr_threads` threads on its node, the
+// `nr_rows` rows of `row_size` bytes starting at `addr` being split like the static bands of
+// the grid rows of the threads, `step` rows per grid row. The rows and the bytes of
+// [addr, addr + size) after the last grid row go with the last band. Like `numa_interleave`,
+// the placement is a hint.
+void numa_bind_bands(const numa_topology_t *topology, const void *addr, size_t size,
+					 size_t row_size, int nr_rows, int step, int nr_threads);
+
+// Prints how many pages of the bands of `numa_bind_bands` are on the node of their thread,
+// on other nodes, or not backed by memory yet.
+void numa_print_bands(const numa_topology_t *topology, const char *name, const void *addr,
+					  size_t size, size_t row_size, int nr_rows, int step, int nr_threads,
+					  FILE *file);
+
+// Prints how many pages of [addr, addr + size) are on each node.
+void numa_print_pages(const numa_topology_t *topology, const char *name, const void *addr,
+					  size_t size, FILE *file);
+
+#endif  // NUMA_H_
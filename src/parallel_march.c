@@ -1,6 +1,7 @@
 // Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
 #include "parallel_march.h"
 
+#include <math.h>
 #include <pthread.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -8,142 +9,662 @@
 #include <unistd.h>
 
 #include "utils.h"
+#include "atlas.h"
+#include "grid.h"
 #include "helpers.h"
+#include "levels.h"
+#include "polyline.h"
+#include "resample.h"
+#include "sched.h"
+#include "trace.h"
 #include "types.h"
 
-#define STEP 8
-#define SIGMA 200
-
 #define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+
+// Costs of the cost model used by `auto_thread_count`, in ns: building the grid and stamping
+// the contours of a scaled pixel, the horizontal pass of a scaled row over a source line, the
+// vertical pass of a scaled pixel and the overhead of a thread.
+#define MARCH_COST_NS 0.5
+#define RESCALE_LINE_COST_NS 13.0
+#define RESCALE_PIXEL_COST_NS 2.0
+#define THREAD_COST_NS 30000.0
+
+// Side of the tiles used by the work-stealing scheduler, in squares. It matches the grid words,
+// so that no two tiles write the same word.
+#define TILE_CELLS GRID_WORD_BITS
+
+// Checks if only the pixels read by `bulid_grid_of_points` need to be interpolated. This is the
+// case when `march` overwrites the whole scaled image, so every other pixel is thrown away.
+static int rescale_lazily(const config_t *config, ppm_image *scaled_image) {
+	return !config->full_rescale && scaled_image->x % config->step == 0 &&
+		   scaled_image->y % config->step == 0 &&
+		   (config->row_major || scaled_image->x <= scaled_image->y);
+}
 
-// scale down the image using bicubic_interpolation 
-void bicubic_interpolation(thread_arg_t *arg) {
-	ppm_image *scaled_image = arg->scaled_image;
-	ppm_image *image = arg->image;
+// Index of the column of the scaled image sampled by the last column of the grid. The
+// reference orientation reads it at index `x - 1`, which is only the last column of square
+// images; the row-major one reads the actual last column.
+static int last_column(const config_t *config, ppm_image *scaled_image) {
+	return config->row_major ? scaled_image->y - 1 : scaled_image->x - 1;
+}
 
-	uint8_t sample[3];
+// Checks if a row of the scaled image needs to be interpolated. When rescaling lazily, only the
+// grid sample points and the last row are read afterwards.
+static int is_row_rescaled(const config_t *config, ppm_image *scaled_image, int index) {
+	return !rescale_lazily(config, scaled_image) || index % config->step == 0 ||
+		   index == scaled_image->x - 1;
+}
+
+// Same as `is_row_rescaled`, for a column of the scaled image.
+static int is_col_rescaled(const config_t *config, ppm_image *scaled_image, int index) {
+	return !rescale_lazily(config, scaled_image) || index % config->step == 0 ||
+		   index == last_column(config, scaled_image);
+}
+
+// Precomputes the bicubic filter used to scale the image. Returns NULL if no scaling is needed.
+resample_plan_t *create_rescale_plan(const config_t *config, ppm_image *image,
+									 ppm_image *scaled_image) {
+	if (image == scaled_image) {
+		return NULL;
+	}
+
+	int *cols = (int *)malloc(scaled_image->y * sizeof(int));
+	if (!cols) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	int nr_cols = 0;
+	for (int j = 0; j < scaled_image->y; j++) {
+		if (is_col_rescaled(config, scaled_image, j)) {
+			cols[nr_cols++] = j;
+		}
+	}
+
+	resample_plan_t *plan = resample_plan_create(image, scaled_image->x, scaled_image->y,
+												 cols, nr_cols, config->row_major,
+												 config->fixed_point, config->filter,
+												 config->isa);
+	free(cols);
+
+	return plan;
+}
+
+// Lists the rows of the scaled image which a thread interpolates, from its static slice, in
+// the slice of the shared `rows` buffer which starts at the first of them.
+static int *thread_rows(thread_arg_t *arg, int *nr_rows) {
+	ppm_image *scaled_image = arg->scaled_image;
 
 	// set the start and end index for each thread
 	int start = arg->thread_id * (double)scaled_image->x / arg->nr_threads;
 	int end = MIN((arg->thread_id + 1) * (double)scaled_image->x / arg->nr_threads,
 	 			  scaled_image->x);
 
-	// use bicubic interpolation for scaling
-	for (int i = start; i < end; i++) {
-		for (int j = 0; j < scaled_image->y; j++) {
-			float u = (float)i / (float)(scaled_image->x - 1);
-			float v = (float)j / (float)(scaled_image->y - 1);
-			sample_bicubic(image, u, v, sample);
+	int *rows = arg->rows + start;
 
-			scaled_image->data[i * scaled_image->y + j].red = sample[0];
-			scaled_image->data[i * scaled_image->y + j].green = sample[1];
-			scaled_image->data[i * scaled_image->y + j].blue = sample[2];
+	*nr_rows = 0;
+	for (int i = start; i < end; i++) {
+		if (is_row_rescaled(arg->config, scaled_image, i)) {
+			rows[(*nr_rows)++] = i;
 		}
 	}
+
+	return rows;
+}
+
+// scale down the image using bicubic_interpolation 
+void bicubic_interpolation(thread_arg_t *arg) {
+	trace_mark_t mark;
+	trace_begin(&mark);
+
+	int nr_rows;
+	int *rows = thread_rows(arg, &nr_rows);
+
+	// use bicubic interpolation for scaling
+	resample_rows(arg->plan, arg->image, arg->scaled_image, rows, nr_rows);
+
+	trace_end("rescale", TRACE_PHASE, &mark);
+}
+
+// Scales the planned columns [first_col, end_col) of the rows of a thread, reading the source
+// lines from `lines`, like `resample_lines`.
+void rescale_window(thread_arg_t *arg, const ppm_pixel *const *lines, int first_col,
+					int end_col) {
+	trace_mark_t mark;
+	trace_begin(&mark);
+
+	int nr_rows;
+	int *rows = thread_rows(arg, &nr_rows);
+
+	resample_lines(arg->plan, lines, arg->scaled_image, rows, nr_rows, first_col, end_col);
+
+	trace_end("rescale window", TRACE_PHASE, &mark);
+}
+
+// Computes the points of row `i` of the grid found on columns [start_y, end_y), including the
+// point on the last column if the range ends there. The start must be a multiple of
+// GRID_WORD_BITS.
+static void classify_grid_row(thread_arg_t *arg, int i, int start_y, int end_y) {
+	int step = arg->config->step;
+	ppm_image *image = arg->scaled_image;
+	int grid_y_points = image->y / step;
+
+	grid_classify(arg->grid, i, start_y, &image->data[i * step * image->y + start_y * step],
+				  step, end_y - start_y, arg->config->sigma, arg->config->isa);
+
+	// set the last column
+	if (end_y == grid_y_points) {
+		ppm_pixel curr_pixel =
+			image->data[i * step * image->y + last_column(arg->config, image)];
+		grid_set(arg->grid, i, grid_y_points, grid_threshold(curr_pixel, arg->config->sigma));
+	}
+}
+
+// Computes the points of the last row of the grid found on columns [start_y, end_y). The
+// start must be a multiple of GRID_WORD_BITS. The last point of the grid is left 0.
+static void classify_last_grid_row(thread_arg_t *arg, int start_y, int end_y) {
+	int step = arg->config->step;
+	ppm_image *image = arg->scaled_image;
+	int grid_x_points = image->x / step;
+
+	grid_classify(arg->grid, grid_x_points, start_y,
+				  &image->data[(image->x - 1) * image->y + start_y * step], step,
+				  end_y - start_y, arg->config->sigma, arg->config->isa);
+}
+
+// Stamps the contours of the squares found between rows `i` and `i + 1` of the grid, on
+// columns [start_y, end_y). The start must be a multiple of GRID_WORD_BITS.
+static void march_row(thread_arg_t *arg, int i, int start_y, int end_y, unsigned char *cases) {
+	int step = arg->config->step;
+	grid_row_cases(arg->grid, i, start_y, end_y - start_y, cases);
+	atlas_stamp_row(arg->atlas, arg->scaled_image, i * step, start_y * step, cases,
+					end_y - start_y, step);
 }
 
 // Builds a grid of points with values which can be either 0 or 1, depending on how the
 // pixel values compare to the `sigma` reference value.
 void bulid_grid_of_points(thread_arg_t *arg) {
-	int step_x, step_y;
-	step_x = step_y = STEP;
+	trace_mark_t mark;
+	trace_begin(&mark);
+
+	int step = arg->config->step;
 	ppm_image *image = arg->scaled_image;
-    unsigned char **grid = arg->grid;
 
 	// get number of points in the grid on x and y axis
-    int grid_x_points = image->x / step_x;
-    int grid_y_points = image->y / step_y;
+	int grid_x_points = image->x / step;
+	int grid_y_points = image->y / step;
 
-    
-    // set the start and end index for each thread
-    int start_x = arg->thread_id * (double)grid_x_points / arg->nr_threads;            
+	// set the start and end index for each thread
+	int start_x = arg->thread_id * (double)grid_x_points / arg->nr_threads;
 	int end_x = MIN((arg->thread_id + 1) * (double)grid_x_points / arg->nr_threads, grid_x_points);
 
-    int start_y = arg->thread_id * (double)grid_y_points / arg->nr_threads;            
-	int end_y = MIN((arg->thread_id + 1) * (double)grid_y_points / arg->nr_threads, grid_y_points);
+	// the last line is split in whole words, so that no word is written by two threads
+	int words = (grid_y_points + GRID_WORD_BITS - 1) / GRID_WORD_BITS;
+	int start_w = arg->thread_id * (double)words / arg->nr_threads;
+	int end_w = MIN((arg->thread_id + 1) * (double)words / arg->nr_threads, words);
 
-    // build a grid of points with values which can be either 0 or 1, depending on how the
-    // pixel values compare to the `sigma` reference value.
-    for (int i = start_x; i < end_x; i++) {
-        for (int j = 0; j < grid_y_points; j++) {
-            ppm_pixel curr_pixel = image->data[i * step_x * image->y + j * step_y];
+	for (int i = start_x; i < end_x; i++) {
+		classify_grid_row(arg, i, 0, grid_y_points);
+	}
 
-            unsigned char curr_color = (curr_pixel.red + curr_pixel.green + curr_pixel.blue) / 3;
+	if (start_w < end_w) {
+		classify_last_grid_row(arg, start_w * GRID_WORD_BITS,
+							   MIN(end_w * GRID_WORD_BITS, grid_y_points));
+	}
 
-            if (curr_color > SIGMA) {
-                grid[i][j] = 0;
-            } else {
-                grid[i][j] = 1;
-            }
-        }
-    }
-    grid[grid_x_points][grid_y_points] = 0;
+	trace_end("grid", TRACE_PHASE, &mark);
+}
 
-    // set the last column
-    for (int i = start_x; i < end_x; i++) {
-        ppm_pixel curr_pixel = image->data[i * step_x * image->y + image->x - 1];
+// Change the image, by swapping each section with its corresonding countour
+void march(thread_arg_t *arg) {
+	trace_mark_t mark;
+	trace_begin(&mark);
 
-        unsigned char curr_color = (curr_pixel.red + curr_pixel.green + curr_pixel.blue) / 3;
+	int step = arg->config->step;
+	// get number of points in the grid on x and y axis
+	int grid_x_points = arg->scaled_image->x / step;
+	int grid_y_points = arg->scaled_image->y / step;
 
-        if (curr_color > SIGMA) {
-            grid[i][grid_y_points] = 0;
-        } else {
-            grid[i][grid_y_points] = 1;
-        }
-    }
+	// set the start and end index for each thread
+	int start = arg->thread_id * (double)grid_x_points / arg->nr_threads;
+	int end = MIN((arg->thread_id + 1) * (double)grid_x_points / arg->nr_threads, grid_x_points);
 
-    // set the last line
-    for (int j = start_y; j < end_y; j++) {
-        ppm_pixel curr_pixel = image->data[(image->x - 1) * image->y + j * step_y];
+	unsigned char *cases = arg->cases;
 
-        unsigned char curr_color = (curr_pixel.red + curr_pixel.green + curr_pixel.blue) / 3;
+	for (int i = start; i < end; i++) {
+		march_row(arg, i, 0, grid_y_points, cases);
+	}
 
-        if (curr_color > SIGMA) {
-            grid[grid_x_points][j] = 0;
-        } else {
-            grid[grid_x_points][j] = 1;
-        }
-    }
+	trace_end("march", TRACE_PHASE, &mark);
 }
 
-// Change the image, by swapping each section with its corresonding countour
-void march(thread_arg_t *arg) {
-	int step_x, step_y;
-	step_x = step_y = STEP;
+// Computes the luminance of the points of the grid rows [start, end), from the same samples as
+// `classify_grid_row` and `classify_last_grid_row`.
+static void sample_levels(thread_arg_t *arg, int start, int end) {
+	int step = arg->config->step;
 	ppm_image *image = arg->scaled_image;
-    unsigned char **grid = arg->grid;
+	int grid_x_points = image->x / step;
+	int grid_y_points = image->y / step;
 
-	// get number of points in the grid on x and y axis
-    int grid_x_points = image->x / step_x;
-    int grid_y_points = image->y / step_y;
+	for (int i = start; i < end; i++) {
+		if (i == grid_x_points) {
+			level_grid_sample(arg->levels, i, 0, &image->data[(image->x - 1) * image->y], step,
+							  grid_y_points);
+			continue;
+		}
+
+		level_grid_sample(arg->levels, i, 0, &image->data[i * step * image->y], step,
+						  grid_y_points);
+		level_grid_sample(arg->levels, i, grid_y_points,
+						  &image->data[i * step * image->y + last_column(arg->config, image)], 1,
+						  1);
+	}
+}
+
+// Estimates the time (in ns) spent by a single thread on the three phases, then picks the
+// number of threads which minimizes work / P + P * THREAD_COST_NS, the second term being the
+// cost of creating, synchronizing and joining a thread. The constants were measured on one
+// core, with the default options.
+int auto_thread_count(const config_t *config, ppm_image *image, ppm_image *scaled_image,
+					  int max_threads) {
+	double work = (double)scaled_image->x * scaled_image->y * MARCH_COST_NS;
+
+	if (image != scaled_image) {
+		int *cols = (int *)malloc(scaled_image->y * sizeof(int));
+		if (!cols) {
+			fprintf(stderr, "Unable to allocate memory\n");
+			exit(1);
+		}
+
+		long rows = 0, nr_cols = 0;
+		for (int i = 0; i < scaled_image->x; i++) {
+			rows += is_row_rescaled(config, scaled_image, i);
+		}
+		for (int j = 0; j < scaled_image->y; j++) {
+			if (is_col_rescaled(config, scaled_image, j)) {
+				cols[nr_cols++] = j;
+			}
+		}
+
+		// the horizontal pass of each scaled row reads the source lines of the plan, which are
+		// all the lines unless the columns are planned lazily in the reference view
+		long lines = image->y;
+		if (rescale_lazily(config, scaled_image) && !config->row_major) {
+			lines = resample_count_lines(image->y, scaled_image->y, cols, nr_cols);
+		}
+		free(cols);
+
+		work += (double)rows * lines * RESCALE_LINE_COST_NS;
+		work += (double)rows * nr_cols * RESCALE_PIXEL_COST_NS;
+	}
+
+	int nr_threads = (int)sqrt(work / THREAD_COST_NS);
+
+	// more threads than grid rows would have nothing to do
+	nr_threads = MIN(nr_threads, scaled_image->x / config->step);
+	nr_threads = MIN(nr_threads, max_threads);
+
+	return MAX(nr_threads, 1);
+}
+
+// Allocates the flags used by the threads to publish the first row of their band.
+band_sync_t *band_sync_create(int grid_rows) {
+	band_sync_t *sync = (band_sync_t *)malloc(sizeof(band_sync_t));
+	if (!sync) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	sync->ready = (unsigned char *)calloc(grid_rows, sizeof(unsigned char));
+	if (!sync->ready) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
 
-    
-    // set the start and end index for each thread
-    int start = arg->thread_id * (double)grid_x_points / arg->nr_threads;            
+	pthread_mutex_init(&sync->lock, NULL);
+	pthread_cond_init(&sync->cond, NULL);
+
+	return sync;
+}
+
+void band_sync_destroy(band_sync_t *sync) {
+	pthread_mutex_destroy(&sync->lock);
+	pthread_cond_destroy(&sync->cond);
+	free(sync->ready);
+	free(sync);
+}
+
+static void publish_grid_row(band_sync_t *sync, int i) {
+	pthread_mutex_lock(&sync->lock);
+	sync->ready[i] = 1;
+	pthread_cond_broadcast(&sync->cond);
+	pthread_mutex_unlock(&sync->lock);
+}
+
+static void wait_grid_row(band_sync_t *sync, int i) {
+	pthread_mutex_lock(&sync->lock);
+	while (!sync->ready[i]) {
+		pthread_cond_wait(&sync->cond, &sync->lock);
+	}
+	pthread_mutex_unlock(&sync->lock);
+}
+
+// The fused mode needs every sample to be computed right before it is read, which is possible
+// when the image is not scaled, or when it is scaled lazily. The samples of the last grid
+// column must also be on the rows of their grid row, which the reference view only ensures
+// when the image is not wider than high, like in `rescale_lazily`.
+static int can_fuse(thread_arg_t *arg) {
+	ppm_image *scaled_image = arg->scaled_image;
+
+	return arg->config->fused &&
+		   (arg->config->row_major || scaled_image->x <= scaled_image->y) &&
+		   (arg->image == scaled_image || rescale_lazily(arg->config, scaled_image));
+}
+
+// Scales, samples and marches a band of grid rows in a single pass, a few rows at a time, so
+// that the scaled pixels are stamped while they are still in the cache. Stamping the squares
+// of row `i` needs the points of row `i + 1`, so the last row of the band waits for the next
+// thread to publish the first row of its band; this is the only synchronization.
+static void fused_band(thread_arg_t *arg) {
+	int step = arg->config->step;
+	ppm_image *scaled_image = arg->scaled_image;
+	int grid_x_points = scaled_image->x / step;
+	int grid_y_points = scaled_image->y / step;
+	int rescale = arg->image != scaled_image;
+
+	int start = arg->thread_id * (double)grid_x_points / arg->nr_threads;
 	int end = MIN((arg->thread_id + 1) * (double)grid_x_points / arg->nr_threads, grid_x_points);
 
-	for (int i = start; i < end; i++) {
-        for (int j = 0; j < grid_y_points; j++) {
-            unsigned char k = 8 * grid[i][j] + 4 * grid[i][j + 1] +
-                              2 * grid[i + 1][j + 1] + 1 * grid[i + 1][j];
+	if (start >= end) {
+		return;
+	}
 
-            update_image(image, arg->contour_map[k], i * step_x, j * step_y);
-        }
-    }
+	unsigned char *cases = arg->cases;
+	int rows[RESAMPLE_LANES + 1];
+	trace_mark_t mark;
+	trace_begin(&mark);
+
+	for (int chunk = start; chunk < end; chunk += RESAMPLE_LANES) {
+		int chunk_end = MIN(chunk + RESAMPLE_LANES, end);
+
+		// the band which ends with the last row of squares also computes the last grid row
+		int last_row = chunk_end == grid_x_points;
+
+		if (rescale) {
+			int nr_rows = 0;
+			for (int i = chunk; i < chunk_end; i++) {
+				rows[nr_rows++] = i * step;
+			}
+			if (last_row) {
+				rows[nr_rows++] = scaled_image->x - 1;
+			}
+
+			resample_rows(arg->plan, arg->image, scaled_image, rows, nr_rows);
+		}
+
+		for (int i = chunk; i < chunk_end; i++) {
+			classify_grid_row(arg, i, 0, grid_y_points);
+		}
+		if (last_row) {
+			classify_last_grid_row(arg, 0, grid_y_points);
+		}
+
+		if (chunk == start) {
+			publish_grid_row(arg->sync, start);
+		}
+
+		// every row of squares whose bottom grid row is known can be stamped
+		for (int i = MAX(start, chunk - 1); i < chunk_end - 1; i++) {
+			march_row(arg, i, 0, grid_y_points, cases);
+		}
+	}
+
+	trace_end("fused band", TRACE_PHASE, &mark);
+
+	if (end < grid_x_points) {
+		trace_begin(&mark);
+		wait_grid_row(arg->sync, end);
+		trace_end("wait next band", TRACE_WAIT, &mark);
+	}
+
+	trace_begin(&mark);
+	march_row(arg, end - 1, 0, grid_y_points, cases);
+	trace_end("march", TRACE_PHASE, &mark);
 }
 
-void *thread_function(void *arg) {
-	thread_arg_t *thread_arg = (thread_arg_t *)arg;
+// Number of tiles needed to cover `size` squares (or pixels, for tiles of `tile` pixels).
+static int tiles_count(int size, int tile) {
+	return (size + tile - 1) / tile;
+}
+
+// Scales the pixels of a tile of TILE_CELLS x TILE_CELLS squares.
+static void rescale_task(void *ctx, int task) {
+	thread_arg_t *arg = (thread_arg_t *)ctx;
+	int step = arg->config->step;
+	ppm_image *scaled_image = arg->scaled_image;
+	int tile = TILE_CELLS * step;
+	int tiles_y = tiles_count(scaled_image->y, tile);
+
+	int start_x = task / tiles_y * tile;
+	int end_x = MIN(start_x + tile, scaled_image->x);
+	int start_y = task % tiles_y * tile;
+	int end_y = MIN(start_y + tile, scaled_image->y);
+
+	int rows[TILE_CELLS * CONFIG_MAX_STEP];
+	int nr_rows = 0;
+	for (int i = start_x; i < end_x; i++) {
+		if (is_row_rescaled(arg->config, scaled_image, i)) {
+			rows[nr_rows++] = i;
+		}
+	}
+
+	int first_col, end_col;
+	resample_find_cols(arg->plan, start_y, end_y, &first_col, &end_col);
+	resample_block(arg->plan, arg->image, scaled_image, rows, nr_rows, first_col, end_col);
+}
+
+// Builds the points of a tile of TILE_CELLS x TILE_CELLS squares. The tiles on the last row
+// also build the last row of the grid.
+static void grid_task(void *ctx, int task) {
+	thread_arg_t *arg = (thread_arg_t *)ctx;
+	int step = arg->config->step;
+	int grid_x_points = arg->scaled_image->x / step;
+	int grid_y_points = arg->scaled_image->y / step;
+	int tiles_y = tiles_count(grid_y_points, TILE_CELLS);
+
+	int start_x = task / tiles_y * TILE_CELLS;
+	int end_x = MIN(start_x + TILE_CELLS, grid_x_points);
+	int start_y = task % tiles_y * TILE_CELLS;
+	int end_y = MIN(start_y + TILE_CELLS, grid_y_points);
+
+	for (int i = start_x; i < end_x; i++) {
+		classify_grid_row(arg, i, start_y, end_y);
+	}
 
+	if (end_x == grid_x_points) {
+		classify_last_grid_row(arg, start_y, end_y);
+	}
+}
+
+// Stamps the contours of a tile of TILE_CELLS x TILE_CELLS squares.
+static void march_task(void *ctx, int task) {
+	thread_arg_t *arg = (thread_arg_t *)ctx;
+	int step = arg->config->step;
+	int grid_x_points = arg->scaled_image->x / step;
+	int grid_y_points = arg->scaled_image->y / step;
+	int tiles_y = tiles_count(grid_y_points, TILE_CELLS);
+
+	int start_x = task / tiles_y * TILE_CELLS;
+	int end_x = MIN(start_x + TILE_CELLS, grid_x_points);
+	int start_y = task % tiles_y * TILE_CELLS;
+	int end_y = MIN(start_y + TILE_CELLS, grid_y_points);
+
+	unsigned char cases[TILE_CELLS];
+	for (int i = start_x; i < end_x; i++) {
+		march_row(arg, i, start_y, end_y, cases);
+	}
+}
+
+// Creates the work-stealing scheduler, for the largest phase (scaling the image).
+scheduler_t *create_scheduler(const config_t *config, int nr_threads, ppm_image *scaled_image,
+							  pthread_barrier_t *barrier) {
+	int tile = TILE_CELLS * config->step;
+	int max_tasks = tiles_count(scaled_image->x, tile) * tiles_count(scaled_image->y, tile);
+
+	return sched_create(nr_threads, max_tasks, barrier);
+}
+
+// Runs the three phases as tasks of the work-stealing scheduler.
+static void run_tiles(thread_arg_t *arg) {
+	int step = arg->config->step;
+	int grid_x_points = arg->scaled_image->x / step;
+	int grid_y_points = arg->scaled_image->y / step;
+	int grid_tiles = tiles_count(grid_x_points, TILE_CELLS) *
+					 tiles_count(grid_y_points, TILE_CELLS);
+
+	if (arg->image != arg->scaled_image) {
+		int tile = TILE_CELLS * step;
+		int tiles = tiles_count(arg->scaled_image->x, tile) *
+					tiles_count(arg->scaled_image->y, tile);
+
+		sched_run(arg->sched, arg->thread_id, tiles, rescale_task, arg, "rescale");
+		trace_barrier_wait(arg->barrier, "barrier rescale");
+	}
+
+	sched_run(arg->sched, arg->thread_id, grid_tiles, grid_task, arg, "grid");
+	trace_barrier_wait(arg->barrier, "barrier grid");
+
+	sched_run(arg->sched, arg->thread_id, grid_tiles, march_task, arg, "march");
+}
+
+// Runs the three phases on the static split of the rows, separated by barriers.
+static void run_phases(thread_arg_t *thread_arg) {
 	if (thread_arg->image != thread_arg->scaled_image) {
 		bicubic_interpolation(thread_arg);
-		pthread_barrier_wait(thread_arg->barrier);
+		trace_barrier_wait(thread_arg->barrier, "barrier rescale");
 	}
 
 	bulid_grid_of_points(thread_arg);
-	pthread_barrier_wait(thread_arg->barrier);
+	trace_barrier_wait(thread_arg->barrier, "barrier grid");
 
 	march(thread_arg);
+}
+
+// Writes the pixel rows of the band of grid rows assigned to a thread, once they have been
+// stamped, with `writer`. The last thread also writes the pixel rows after the last grid row.
+static void write_band(thread_arg_t *arg, ppm_writer_t *writer) {
+	int step = arg->config->step;
+	int grid_x_points = arg->scaled_image->x / step;
+
+	int start = arg->thread_id * (double)grid_x_points / arg->nr_threads;
+	int end = MIN((arg->thread_id + 1) * (double)grid_x_points / arg->nr_threads, grid_x_points);
+	int end_row = arg->thread_id == arg->nr_threads - 1 ? arg->scaled_image->x : end * step;
+
+	trace_mark_t mark;
+	trace_begin(&mark);
+	ppm_writer_write_rows(writer, arg->scaled_image, start * step, end_row);
+	trace_end("write", TRACE_PHASE, &mark);
+}
+
+// Scales the image, if needed, then samples the luminance of the grid points, on the static
+// split of the rows. The band of rows of squares of the thread is returned in [start, end).
+static void prepare_levels(thread_arg_t *arg, int *start, int *end) {
+	int grid_x_points = arg->scaled_image->x / arg->config->step;
+
+	*start = arg->thread_id * (double)grid_x_points / arg->nr_threads;
+	*end = MIN((arg->thread_id + 1) * (double)grid_x_points / arg->nr_threads, grid_x_points);
+
+	if (arg->image != arg->scaled_image) {
+		bicubic_interpolation(arg);
+		trace_barrier_wait(arg->barrier, "barrier rescale");
+	}
+
+	// the last thread also samples the last row of the grid
+	trace_mark_t mark;
+	trace_begin(&mark);
+	sample_levels(arg, *start,
+				  arg->thread_id == arg->nr_threads - 1 ? grid_x_points + 1 : *end);
+	trace_end("sample levels", TRACE_PHASE, &mark);
+	trace_barrier_wait(arg->barrier, "barrier levels");
+}
+
+// Draws the isolines of all the levels on the static split of the rows. The luminance of the
+// grid points is sampled once, then every square is compared with all the levels in the same
+// sweep. With layers, the levels are stamped one after the other instead, each thread writing
+// its band of a layer before stamping the next one over it.
+static void run_levels(thread_arg_t *arg) {
+	int step = arg->config->step;
+	int grid_y_points = arg->scaled_image->y / step;
+	int start, end;
+
+	prepare_levels(arg, &start, &end);
+
+	unsigned char *cases = arg->cases;
+	trace_mark_t mark;
+
+	if (!arg->layers) {
+		trace_begin(&mark);
+		for (int i = start; i < end; i++) {
+			level_grid_stamp_row(arg->levels, i, arg->atlas, arg->scaled_image, i * step, step,
+								 cases);
+		}
+		trace_end("stamp levels", TRACE_PHASE, &mark);
+	} else {
+		for (int k = 0; k < arg->levels->nr_levels; k++) {
+			trace_begin(&mark);
+			for (int i = start; i < end; i++) {
+				level_grid_row_cases(arg->levels, i, k, cases);
+				atlas_stamp_row(arg->atlas, arg->scaled_image, i * step, 0, cases, grid_y_points,
+								step);
+			}
+			trace_end("stamp layer", TRACE_PHASE, &mark);
+			write_band(arg, arg->layers[k]);
+		}
+	}
+}
+
+// Traces the isolines of all the levels through the band of the thread, into its polyline set.
+// Nothing is stamped on the image.
+static void run_vectors(thread_arg_t *arg) {
+	int start, end;
+
+	prepare_levels(arg, &start, &end);
+
+	trace_mark_t mark;
+	trace_begin(&mark);
+	polyline_trace_band(arg->levels, start, end, arg->config->step, arg->vectors);
+	trace_end("trace isolines", TRACE_PHASE, &mark);
+}
+
+// Processes the part of the image assigned to a thread. With a writer, the thread then writes
+// its band of the result.
+void process_image(thread_arg_t *thread_arg) {
+	if (thread_arg->vectors) {
+		run_vectors(thread_arg);
+	} else if (thread_arg->levels) {
+		run_levels(thread_arg);
+	} else if (can_fuse(thread_arg)) {
+		fused_band(thread_arg);
+	} else if (thread_arg->sched) {
+		run_tiles(thread_arg);
+
+		// the tiles of a band may have been stamped by any thread
+		if (thread_arg->writer) {
+			trace_barrier_wait(thread_arg->barrier, "barrier write");
+		}
+	} else {
+		run_phases(thread_arg);
+	}
+
+	if (thread_arg->writer) {
+		write_band(thread_arg, thread_arg->writer);
+	}
+}
+
+void *thread_function(void *arg) {
+	trace_set_thread("worker", ((thread_arg_t *)arg)->thread_id);
+	process_image((thread_arg_t *)arg);
 
 	pthread_exit(NULL);
-}
\ No newline at end of file
+}
@@ -2,7 +2,48 @@
 #ifndef PARALLEL_MARCH_H_
 #define PARALLEL_MARCH_H_
 
+#include "config.h"
 #include "helpers.h"
+#include "resample.h"
+#include "sched.h"
+#include "types.h"
+
+// Precomputes the bicubic filter used to scale the image. Returns NULL if no scaling is needed.
+resample_plan_t *create_rescale_plan(const config_t *config, ppm_image *image,
+									 ppm_image *scaled_image);
+
+// Picks a number of threads, at most `max_threads`, from the estimated cost of processing the
+// image, so that small images do not pay for threads they cannot use.
+int auto_thread_count(const config_t *config, ppm_image *image, ppm_image *scaled_image,
+					  int max_threads);
+
+// Allocates the flags used by the threads to publish the first row of their band, in the
+// fused mode.
+band_sync_t *band_sync_create(int grid_rows);
+
+void band_sync_destroy(band_sync_t *sync);
+
+// Creates the work-stealing scheduler, for the largest phase (scaling the image).
+scheduler_t *create_scheduler(const config_t *config, int nr_threads, ppm_image *scaled_image,
+							  pthread_barrier_t *barrier);
+
+// Scales the rows of the image assigned to a thread.
+void bicubic_interpolation(thread_arg_t *arg);
+
+// Scales the planned columns [first_col, end_col) of the rows of a thread, reading the source
+// lines from `lines`, like `resample_lines`.
+void rescale_window(thread_arg_t *arg, const ppm_pixel *const *lines, int first_col,
+					int end_col);
+
+// Builds the rows of the grid assigned to a thread, from the scaled image.
+void bulid_grid_of_points(thread_arg_t *arg);
+
+// Stamps the contours of the rows of squares assigned to a thread, once the whole grid is built.
+void march(thread_arg_t *arg);
+
+// Processes the part of the image assigned to a thread. With a writer, the thread then writes
+// its band of the result.
+void process_image(thread_arg_t *thread_arg);
 
 void *thread_function(void *arg);
 
@@ -0,0 +1,615 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#include "polyline.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "atlas.h"
+#include "config.h"
+#include "levels.h"
+
+// The edges of a square, as they are used by `segment_table`.
+enum { EDGE_TOP, EDGE_RIGHT, EDGE_BOTTOM, EDGE_LEFT };
+
+// The grid edges are numbered 2 * (i * cols + j) + direction, where the horizontal edge starts
+// in grid point (i, j) and goes right, and the vertical one goes down. The keys used to stitch
+// the segments also hold the level, as edge * nr_levels + level.
+#define EDGE_HORIZONTAL 0
+#define EDGE_VERTICAL 1
+
+// Segments of the contour of every configuration, as pairs of edges of the square, ended by -1.
+// The saddles (5 and 10) cut off their two corners which are below the level, the joined ones
+// the two corners which are above it.
+static const signed char segment_table[ATLAS_TILE_COUNT][5] = {
+	{-1},
+	{EDGE_LEFT, EDGE_BOTTOM, -1},
+	{EDGE_BOTTOM, EDGE_RIGHT, -1},
+	{EDGE_LEFT, EDGE_RIGHT, -1},
+	{EDGE_TOP, EDGE_RIGHT, -1},
+	{EDGE_TOP, EDGE_RIGHT, EDGE_LEFT, EDGE_BOTTOM, -1},
+	{EDGE_TOP, EDGE_BOTTOM, -1},
+	{EDGE_TOP, EDGE_LEFT, -1},
+	{EDGE_TOP, EDGE_LEFT, -1},
+	{EDGE_TOP, EDGE_BOTTOM, -1},
+	{EDGE_TOP, EDGE_LEFT, EDGE_BOTTOM, EDGE_RIGHT, -1},
+	{EDGE_TOP, EDGE_RIGHT, -1},
+	{EDGE_LEFT, EDGE_RIGHT, -1},
+	{EDGE_RIGHT, EDGE_BOTTOM, -1},
+	{EDGE_LEFT, EDGE_BOTTOM, -1},
+	{-1},
+	{EDGE_TOP, EDGE_LEFT, EDGE_BOTTOM, EDGE_RIGHT, -1},
+	{EDGE_TOP, EDGE_RIGHT, EDGE_LEFT, EDGE_BOTTOM, -1},
+};
+
+// Initializes an empty set.
+void polyline_set_init(polyline_set_t *set) {
+	memset(set, 0, sizeof(*set));
+}
+
+void polyline_set_free(polyline_set_t *set) {
+	free(set->points);
+	free(set->lines);
+}
+
+static void push_point(polyline_set_t *set, polyline_point_t point) {
+	if (set->nr_points == set->points_cap) {
+		set->points_cap = set->points_cap ? 2 * set->points_cap : 1024;
+		set->points = (polyline_point_t *)realloc(set->points,
+												  set->points_cap * sizeof(polyline_point_t));
+		if (!set->points) {
+			fprintf(stderr, "Unable to allocate memory\n");
+			exit(1);
+		}
+	}
+
+	set->points[set->nr_points++] = point;
+}
+
+// Starts an isoline, whose points are the ones pushed afterwards.
+static polyline_t *push_line(polyline_set_t *set, int level) {
+	if (set->nr_lines == set->lines_cap) {
+		set->lines_cap = set->lines_cap ? 2 * set->lines_cap : 64;
+		set->lines = (polyline_t *)realloc(set->lines, set->lines_cap * sizeof(polyline_t));
+		if (!set->lines) {
+			fprintf(stderr, "Unable to allocate memory\n");
+			exit(1);
+		}
+	}
+
+	polyline_t *line = &set->lines[set->nr_lines++];
+	memset(line, 0, sizeof(*line));
+	line->level = level;
+	line->first = set->nr_points;
+
+	return line;
+}
+
+// Hash of the ends of the pieces which are chained together. Every key is the end of at most
+// two pieces.
+typedef struct {
+	// key + 1, 0 for an empty slot
+	uint64_t key;
+	int piece[2];
+} end_slot_t;
+
+typedef struct {
+	end_slot_t *slots;
+	int shift;
+} end_table_t;
+
+static end_slot_t *end_find(const end_table_t *table, uint64_t key) {
+	size_t mask = ((size_t)1 << (64 - table->shift)) - 1;
+	size_t index = (size_t)((key * 0x9E3779B97F4A7C15ull) >> table->shift);
+
+	while (table->slots[index].key && table->slots[index].key != key + 1) {
+		index = (index + 1) & mask;
+	}
+
+	return &table->slots[index];
+}
+
+// Returns the piece which shares the end `key` with `piece`, or -1.
+static int end_other(const end_table_t *table, uint64_t key, int piece) {
+	const end_slot_t *slot = end_find(table, key);
+
+	return slot->piece[0] == piece ? slot->piece[1] : slot->piece[0];
+}
+
+// Called with every chain of pieces: piece `p` is stored as `p` if it is followed from its
+// first end to its second one, or as `~p` otherwise.
+typedef void (*chain_fn)(void *ctx, const int *chain, int length, int closed);
+
+// Chains `n` pieces, piece `p` having the ends `ends[2 * p]` and `ends[2 * p + 1]`, through
+// the ends they share. The open chains start from an end which is not shared, the pieces left
+// afterwards forming closed chains.
+static void chain_pieces(const uint64_t *ends, int n, chain_fn fn, void *ctx) {
+	if (!n) {
+		return;
+	}
+
+	// at most half of the slots are used
+	end_table_t table;
+	table.shift = 64;
+	while (((size_t)1 << (64 - table.shift)) < 4 * (size_t)n) {
+		table.shift--;
+	}
+
+	table.slots = (end_slot_t *)calloc((size_t)1 << (64 - table.shift), sizeof(end_slot_t));
+	int *chain = (int *)malloc(n * sizeof(int));
+	unsigned char *visited = (unsigned char *)calloc(n, sizeof(unsigned char));
+	if (!table.slots || !chain || !visited) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	for (int p = 0; p < 2 * n; p++) {
+		end_slot_t *slot = end_find(&table, ends[p]);
+		if (!slot->key) {
+			slot->key = ends[p] + 1;
+			slot->piece[0] = p / 2;
+			slot->piece[1] = -1;
+		} else {
+			slot->piece[1] = p / 2;
+		}
+	}
+
+	for (int closed = 0; closed <= 1; closed++) {
+		for (int p = 0; p < n; p++) {
+			if (visited[p]) {
+				continue;
+			}
+
+			// follow the piece from its first end, unless the second one is not shared
+			int reversed = 0;
+			if (!closed && end_other(&table, ends[2 * p], p) >= 0) {
+				if (end_other(&table, ends[2 * p + 1], p) >= 0) {
+					continue;
+				}
+				reversed = 1;
+			}
+
+			int length = 0;
+			for (int curr = p;;) {
+				visited[curr] = 1;
+				chain[length++] = reversed ? ~curr : curr;
+
+				uint64_t key = ends[2 * curr + !reversed];
+				int next = end_other(&table, key, curr);
+				if (next < 0 || visited[next]) {
+					break;
+				}
+
+				reversed = ends[2 * next] != key;
+				curr = next;
+			}
+
+			fn(ctx, chain, length, closed);
+		}
+	}
+
+	free(visited);
+	free(chain);
+	free(table.slots);
+}
+
+// The segments of a band, waiting to be stitched.
+typedef struct {
+	const level_grid_t *grid;
+	int step;
+	polyline_set_t *set;
+	uint64_t *ends;
+	int nr_segments, cap;
+} band_trace_t;
+
+// Point where the isoline crosses the edge of a key, interpolated between the luminance of the
+// two ends of the edge. A point is below the level when its luminance is at most the level, so
+// the isoline is at level + 0.5.
+static polyline_point_t edge_point(const level_grid_t *grid, uint64_t key, int step) {
+	int level = grid->levels[key % grid->nr_levels];
+	uint64_t edge = key / grid->nr_levels;
+	size_t index = edge / 2;
+	int i = index / grid->cols;
+	int j = index % grid->cols;
+
+	int first = level_grid_row(grid, i)[j];
+	int second = edge % 2 == EDGE_HORIZONTAL ? level_grid_row(grid, i)[j + 1]
+											 : level_grid_row(grid, i + 1)[j];
+	float t = (level + 0.5f - first) / (second - first);
+
+	polyline_point_t point;
+	point.x = (j + (edge % 2 == EDGE_HORIZONTAL ? t : 0)) * step;
+	point.y = (i + (edge % 2 == EDGE_VERTICAL ? t : 0)) * step;
+
+	return point;
+}
+
+// Key of an edge of square (i, j), for level `k`.
+static uint64_t edge_key(const level_grid_t *grid, int i, int j, int edge, int k) {
+	uint64_t index;
+
+	switch (edge) {
+	case EDGE_TOP:
+		index = 2 * ((uint64_t)i * grid->cols + j) + EDGE_HORIZONTAL;
+		break;
+	case EDGE_BOTTOM:
+		index = 2 * ((uint64_t)(i + 1) * grid->cols + j) + EDGE_HORIZONTAL;
+		break;
+	case EDGE_LEFT:
+		index = 2 * ((uint64_t)i * grid->cols + j) + EDGE_VERTICAL;
+		break;
+	default:
+		index = 2 * ((uint64_t)i * grid->cols + j + 1) + EDGE_VERTICAL;
+	}
+
+	return index * grid->nr_levels + k;
+}
+
+static void push_segment(band_trace_t *trace, uint64_t first, uint64_t second) {
+	if (trace->nr_segments == trace->cap) {
+		trace->cap = trace->cap ? 2 * trace->cap : 1024;
+		trace->ends = (uint64_t *)realloc(trace->ends, 2 * trace->cap * sizeof(uint64_t));
+		if (!trace->ends) {
+			fprintf(stderr, "Unable to allocate memory\n");
+			exit(1);
+		}
+	}
+
+	trace->ends[2 * trace->nr_segments] = first;
+	trace->ends[2 * trace->nr_segments + 1] = second;
+	trace->nr_segments++;
+}
+
+// Adds a chain of segments to the set: the points are the ends of the segments, in order.
+static void add_segment_chain(void *ctx, const int *chain, int length, int closed) {
+	band_trace_t *trace = (band_trace_t *)ctx;
+	const uint64_t *ends = trace->ends;
+
+	int first = chain[0] < 0 ? ~chain[0] : chain[0];
+	uint64_t first_edge = ends[2 * first + (chain[0] < 0)];
+
+	polyline_t *line = push_line(trace->set, trace->grid->levels[first_edge %
+																 trace->grid->nr_levels]);
+	line->closed = closed;
+	line->first_edge = first_edge;
+	push_point(trace->set, edge_point(trace->grid, first_edge, trace->step));
+
+	// the last end of a closed chain is its first one
+	for (int s = 0; s < length - closed; s++) {
+		int segment = chain[s] < 0 ? ~chain[s] : chain[s];
+		line->last_edge = ends[2 * segment + (chain[s] >= 0)];
+		push_point(trace->set, edge_point(trace->grid, line->last_edge, trace->step));
+	}
+
+	line->nr_points = trace->set->nr_points - line->first;
+}
+
+// Traces the isolines of every level of `grid` through the rows of squares [start, end). The
+// segment of a square cuts its edges where the luminance, interpolated linearly between the
+// two corners, crosses the level. The segments are stitched into polylines through a hash of
+// the edges they end on. The isolines which leave the band through its first or last grid row
+// stay open, to be merged with the ones of the neighbouring bands.
+void polyline_trace_band(const level_grid_t *grid, int start, int end, int step,
+						 polyline_set_t *set) {
+	band_trace_t trace = {grid, step, set, NULL, 0, 0};
+
+	for (int i = start; i < end; i++) {
+		const unsigned char *top = level_grid_row(grid, i);
+		const unsigned char *bottom = level_grid_row(grid, i + 1);
+
+		for (int j = 0; j < grid->cols - 1; j++) {
+			int darkest = top[j];
+			int brightest = top[j];
+			int corners[3] = {top[j + 1], bottom[j], bottom[j + 1]};
+			for (int c = 0; c < 3; c++) {
+				darkest = corners[c] < darkest ? corners[c] : darkest;
+				brightest = corners[c] > brightest ? corners[c] : brightest;
+			}
+
+			// only the levels between the darkest and the brightest corner cross the square
+			for (int k = grid->first[darkest]; k < grid->nr_levels && grid->levels[k] < brightest;
+				 k++) {
+				int config = level_grid_case(grid, top[j], top[j + 1], bottom[j + 1], bottom[j],
+											 grid->levels[k]);
+				const signed char *edges = segment_table[config];
+
+				for (int e = 0; edges[e] >= 0; e += 2) {
+					push_segment(&trace, edge_key(grid, i, j, edges[e], k),
+								 edge_key(grid, i, j, edges[e + 1], k));
+				}
+			}
+		}
+	}
+
+	chain_pieces(trace.ends, trace.nr_segments, add_segment_chain, &trace);
+	free(trace.ends);
+}
+
+// The open isolines of all the bands, waiting to be merged.
+typedef struct {
+	const polyline_set_t *bands;
+	const polyline_t **lines;
+	polyline_set_t *out;
+} band_merge_t;
+
+// Adds a chain of isolines to the set. Consecutive isolines share their end point, which is
+// added once.
+static void add_line_chain(void *ctx, const int *chain, int length, int closed) {
+	band_merge_t *merge = (band_merge_t *)ctx;
+	const polyline_set_t *set = merge->bands;
+
+	polyline_t *line = NULL;
+	for (int l = 0; l < length; l++) {
+		int reversed = chain[l] < 0;
+		const polyline_t *piece = merge->lines[reversed ? ~chain[l] : chain[l]];
+		const polyline_point_t *points = NULL;
+
+		// find the band of the isoline
+		for (set = merge->bands; !(piece >= set->lines && piece < set->lines + set->nr_lines);
+			 set++) {
+		}
+		points = set->points + piece->first;
+
+		if (!line) {
+			line = push_line(merge->out, piece->level);
+			line->closed = closed;
+			line->first_edge = reversed ? piece->last_edge : piece->first_edge;
+			push_point(merge->out, points[reversed ? piece->nr_points - 1 : 0]);
+		}
+		line->last_edge = reversed ? piece->first_edge : piece->last_edge;
+
+		// the first point was added by the previous isoline, the last one of a closed chain is
+		// its first point
+		size_t count = piece->nr_points - 1 - (closed && l == length - 1);
+		for (size_t p = 1; p <= count; p++) {
+			push_point(merge->out, points[reversed ? piece->nr_points - 1 - p : p]);
+		}
+	}
+
+	line->nr_points = merge->out->nr_points - line->first;
+}
+
+// Orders the points by line, then by column.
+static int point_compare(const polyline_point_t *a, const polyline_point_t *b) {
+	if (a->y != b->y) {
+		return a->y < b->y ? -1 : 1;
+	}
+	if (a->x != b->x) {
+		return a->x < b->x ? -1 : 1;
+	}
+
+	return 0;
+}
+
+// Starts an isoline from its smallest point: a closed isoline is rotated to it, and then goes
+// towards the smaller of its two neighbours, while an open one starts with the smaller of its
+// ends. `scratch` must hold the points of the isoline.
+static void canonicalize_line(polyline_set_t *set, polyline_t *line, polyline_point_t *scratch) {
+	polyline_point_t *points = set->points + line->first;
+	size_t n = line->nr_points;
+
+	if (!line->closed) {
+		if (n > 1 && point_compare(&points[n - 1], &points[0]) < 0) {
+			for (size_t p = 0; p < n / 2; p++) {
+				polyline_point_t point = points[p];
+				points[p] = points[n - 1 - p];
+				points[n - 1 - p] = point;
+			}
+
+			uint64_t edge = line->first_edge;
+			line->first_edge = line->last_edge;
+			line->last_edge = edge;
+		}
+		return;
+	}
+
+	size_t first = 0;
+	for (size_t p = 1; p < n; p++) {
+		if (point_compare(&points[p], &points[first]) < 0) {
+			first = p;
+		}
+	}
+
+	int forward = point_compare(&points[(first + 1) % n], &points[(first + n - 1) % n]) <= 0;
+	for (size_t p = 0; p < n; p++) {
+		scratch[p] = points[forward ? (first + p) % n : (first + n - p) % n];
+	}
+	memcpy(points, scratch, n * sizeof(polyline_point_t));
+}
+
+// An isoline with its first point, the key by which the isolines are sorted.
+typedef struct {
+	polyline_point_t start;
+	polyline_t line;
+} sorted_line_t;
+
+static int sorted_line_compare(const void *a, const void *b) {
+	const sorted_line_t *first = (const sorted_line_t *)a;
+	const sorted_line_t *second = (const sorted_line_t *)b;
+
+	if (first->line.level != second->line.level) {
+		return first->line.level < second->line.level ? -1 : 1;
+	}
+
+	return point_compare(&first->start, &second->start);
+}
+
+// Puts the isolines in a form which does not depend on how the image was split in bands: every
+// isoline starts from its smallest point, and the isolines are sorted by level, then by their
+// first point. The points are unique, since every edge is crossed once by the isoline of a
+// level, at a place which depends on the level.
+static void canonicalize(polyline_set_t *set) {
+	size_t longest = 0;
+	for (size_t l = 0; l < set->nr_lines; l++) {
+		longest = set->lines[l].nr_points > longest ? set->lines[l].nr_points : longest;
+	}
+
+	polyline_point_t *scratch = (polyline_point_t *)malloc((longest + 1) *
+														   sizeof(polyline_point_t));
+	sorted_line_t *sorted = (sorted_line_t *)malloc((set->nr_lines + 1) * sizeof(sorted_line_t));
+	if (!scratch || !sorted) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	for (size_t l = 0; l < set->nr_lines; l++) {
+		canonicalize_line(set, &set->lines[l], scratch);
+		sorted[l].line = set->lines[l];
+		sorted[l].start = set->points[set->lines[l].first];
+	}
+
+	qsort(sorted, set->nr_lines, sizeof(sorted_line_t), sorted_line_compare);
+	for (size_t l = 0; l < set->nr_lines; l++) {
+		set->lines[l] = sorted[l].line;
+	}
+
+	free(sorted);
+	free(scratch);
+}
+
+// Merges the isolines of `nr_bands` bands traced by `polyline_trace_band`, joining the ones
+// which meet on the seams between the bands, into `out`. The result does not depend on the
+// number of bands: every isoline starts from its smallest point (by line, then by column), and
+// the isolines are sorted by level, then by their first point.
+void polyline_merge(const polyline_set_t *bands, int nr_bands, polyline_set_t *out) {
+	int nr_open = 0;
+	for (int b = 0; b < nr_bands; b++) {
+		for (size_t l = 0; l < bands[b].nr_lines; l++) {
+			nr_open += !bands[b].lines[l].closed;
+		}
+	}
+
+	const polyline_t **lines = (const polyline_t **)malloc((nr_open + 1) * sizeof(*lines));
+	uint64_t *ends = (uint64_t *)malloc((2 * nr_open + 1) * sizeof(uint64_t));
+	if (!lines || !ends) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	// the closed isolines are copied, the open ones are chained through their end edges
+	nr_open = 0;
+	for (int b = 0; b < nr_bands; b++) {
+		for (size_t l = 0; l < bands[b].nr_lines; l++) {
+			const polyline_t *line = &bands[b].lines[l];
+
+			if (line->closed) {
+				polyline_t *copy = push_line(out, line->level);
+				copy->closed = 1;
+				for (size_t p = 0; p < line->nr_points; p++) {
+					push_point(out, bands[b].points[line->first + p]);
+				}
+				copy->nr_points = line->nr_points;
+				continue;
+			}
+
+			lines[nr_open] = line;
+			ends[2 * nr_open] = line->first_edge;
+			ends[2 * nr_open + 1] = line->last_edge;
+			nr_open++;
+		}
+	}
+
+	band_merge_t merge = {bands, lines, out};
+	chain_pieces(ends, nr_open, add_line_chain, &merge);
+
+	free(ends);
+	free(lines);
+
+	canonicalize(out);
+}
+
+static void put_u32(FILE *file, uint32_t value) {
+	unsigned char bytes[4] = {value, value >> 8, value >> 16, value >> 24};
+	fwrite(bytes, 1, sizeof(bytes), file);
+}
+
+static void put_f32(FILE *file, float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+	put_u32(file, bits);
+}
+
+static void write_svg(FILE *file, const polyline_set_t *set, int width, int height) {
+	fprintf(file, "<svg xmlns=\"http://www.w3.org/2000/svg\" width=\"%d\" height=\"%d\" "
+			"viewBox=\"0 0 %d %d\">\n", width, height, width, height);
+
+	for (size_t l = 0; l < set->nr_lines; l++) {
+		const polyline_t *line = &set->lines[l];
+
+		fprintf(file, "<%s class=\"level-%d\" fill=\"none\" stroke=\"black\" points=\"",
+				line->closed ? "polygon" : "polyline", line->level);
+		for (size_t p = 0; p < line->nr_points; p++) {
+			const polyline_point_t *point = &set->points[line->first + p];
+			fprintf(file, p ? " %.2f,%.2f" : "%.2f,%.2f", point->x, point->y);
+		}
+		fprintf(file, "\"/>\n");
+	}
+
+	fprintf(file, "</svg>\n");
+}
+
+static void write_geojson(FILE *file, const polyline_set_t *set) {
+	fprintf(file, "{\"type\":\"FeatureCollection\",\"features\":[");
+
+	for (size_t l = 0; l < set->nr_lines; l++) {
+		const polyline_t *line = &set->lines[l];
+
+		fprintf(file, "%s\n{\"type\":\"Feature\",\"properties\":{\"level\":%d,\"closed\":%s},"
+				"\"geometry\":{\"type\":\"LineString\",\"coordinates\":[", l ? "," : "",
+				line->level, line->closed ? "true" : "false");
+
+		// the first point of a closed isoline is repeated at its end
+		for (size_t p = 0; p < line->nr_points + line->closed; p++) {
+			const polyline_point_t *point = &set->points[line->first + p % line->nr_points];
+			fprintf(file, "%s[%.2f,%.2f]", p ? "," : "", point->x, point->y);
+		}
+		fprintf(file, "]}}");
+	}
+
+	fprintf(file, "\n]}\n");
+}
+
+static void write_binary(FILE *file, const polyline_set_t *set, int width, int height) {
+	fwrite("MSQV", 1, 4, file);
+	put_u32(file, width);
+	put_u32(file, height);
+	put_u32(file, set->nr_lines);
+
+	for (size_t l = 0; l < set->nr_lines; l++) {
+		const polyline_t *line = &set->lines[l];
+
+		fputc(line->level, file);
+		fputc(line->closed, file);
+		put_u32(file, line->nr_points);
+		for (size_t p = 0; p < line->nr_points; p++) {
+			put_f32(file, set->points[line->first + p].x);
+			put_f32(file, set->points[line->first + p].y);
+		}
+	}
+}
+
+// Writes the isolines of an image of `width` x `height` pixels in `format`.
+void polyline_write(const polyline_set_t *set, const char *filename, vector_format_t format,
+					int width, int height) {
+	FILE *file = fopen(filename, "wb");
+	if (!file) {
+		fprintf(stderr, "Unable to open file '%s'\n", filename);
+		exit(1);
+	}
+
+	switch (format) {
+	case VECTOR_SVG:
+		write_svg(file, set, width, height);
+		break;
+	case VECTOR_GEOJSON:
+		write_geojson(file, set);
+		break;
+	default:
+		write_binary(file, set, width, height);
+	}
+
+	if (fclose(file)) {
+		fprintf(stderr, "Unable to write file '%s'\n", filename);
+		exit(1);
+	}
+}
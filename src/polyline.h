@@ -0,0 +1,61 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#ifndef POLYLINE_H_
+#define POLYLINE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "config.h"
+#include "levels.h"
+
+// A point of an isoline, in pixels of the scaled image: `x` is the column and `y` the line.
+typedef struct {
+	float x, y;
+} polyline_point_t;
+
+// An isoline of `level`, made of `nr_points` consecutive points of a polyline set, starting
+// with `first`. The first point of a closed isoline is not repeated at its end. The ends of an
+// open isoline lie on the grid edges `first_edge` and `last_edge`, as they are numbered by
+// `polyline_trace_band`.
+typedef struct {
+	int level;
+	int closed;
+	size_t first, nr_points;
+	uint64_t first_edge, last_edge;
+} polyline_t;
+
+// Isolines, with their points stored one after the other.
+typedef struct {
+	polyline_point_t *points;
+	size_t nr_points, points_cap;
+	polyline_t *lines;
+	size_t nr_lines, lines_cap;
+} polyline_set_t;
+
+// Initializes an empty set.
+void polyline_set_init(polyline_set_t *set);
+
+void polyline_set_free(polyline_set_t *set);
+
+// Traces the isolines of every level of `grid` through the rows of squares [start, end). The
+// segment of a square cuts its edges where the luminance, interpolated linearly between the
+// two corners, crosses the level. The segments are stitched into polylines through a hash of
+// the edges they end on. The isolines which leave the band through
+// its first or last grid row stay open, to be merged with the ones of the neighbouring bands.
+void polyline_trace_band(const level_grid_t *grid, int start, int end, int step,
+						 polyline_set_t *set);
+
+// Merges the isolines of `nr_bands` bands traced by `polyline_trace_band`, joining the ones
+// which meet on the seams between the bands, into `out`. The result does not depend on the
+// number of bands: every isoline starts from its smallest point (by line, then by column), and
+// the isolines are sorted by level, then by their first point.
+void polyline_merge(const polyline_set_t *bands, int nr_bands, polyline_set_t *out);
+
+// Writes the isolines of an image of `width` x `height` pixels in `format`. The binary format
+// is made of the magic "MSQV", then the width, the height and the number of isolines, as 32 bit
+// integers, then for every isoline its level and whether it is closed (a byte each), its number
+// of points (32 bit) and its points, as pairs of 32 bit floats. All the values are little endian.
+void polyline_write(const polyline_set_t *set, const char *filename, vector_format_t format,
+					int width, int height);
+
+#endif  // POLYLINE_H_
@@ -0,0 +1,114 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#include "pool.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "trace.h"
+
+typedef struct {
+	worker_pool_t *pool;
+	int id;
+} worker_t;
+
+static void *worker_loop(void *arg) {
+	worker_t *worker = (worker_t *)arg;
+	worker_pool_t *pool = worker->pool;
+	int id = worker->id;
+
+	free(worker);
+	trace_set_thread(pool->name, id);
+
+	while (1) {
+		pthread_barrier_wait(&pool->start);
+		if (pool->stop) {
+			break;
+		}
+
+		if (id < pool->nr_active) {
+			pool->fn(pool->args + id * pool->arg_size);
+		}
+
+		pthread_barrier_wait(&pool->done);
+	}
+
+	return NULL;
+}
+
+// Creates a pool of `nr_workers` threads, named `name` in the trace.
+worker_pool_t *pool_create(const char *name, int nr_workers) {
+	worker_pool_t *pool = (worker_pool_t *)calloc(1, sizeof(worker_pool_t));
+	if (!pool) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	pool->name = name;
+	pool->nr_workers = nr_workers;
+	pool->tid = (pthread_t *)malloc(nr_workers * sizeof(pthread_t));
+	if (!pool->tid) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	// the submitting thread takes part in both barriers
+	pthread_barrier_init(&pool->start, NULL, nr_workers + 1);
+	pthread_barrier_init(&pool->done, NULL, nr_workers + 1);
+
+	for (int i = 0; i < nr_workers; i++) {
+		worker_t *worker = (worker_t *)malloc(sizeof(worker_t));
+		if (!worker) {
+			fprintf(stderr, "Unable to allocate memory\n");
+			exit(1);
+		}
+		worker->pool = pool;
+		worker->id = i;
+
+		if (pthread_create(&pool->tid[i], NULL, worker_loop, worker)) {
+			printf("ERROR: failed to create thread number %d\n", i);
+			exit(1);
+		}
+	}
+
+	return pool;
+}
+
+// Stops the workers and frees the pool. There must be no job in progress.
+void pool_destroy(worker_pool_t *pool) {
+	pool->stop = 1;
+	pthread_barrier_wait(&pool->start);
+
+	for (int i = 0; i < pool->nr_workers; i++) {
+		if (pthread_join(pool->tid[i], NULL)) {
+			printf("ERROR: failed to join thread number %d\n", i);
+			exit(1);
+		}
+	}
+
+	pthread_barrier_destroy(&pool->start);
+	pthread_barrier_destroy(&pool->done);
+	free(pool->tid);
+	free(pool);
+}
+
+// Starts a job in which worker `i` < `nr_active` calls `fn(args + i * arg_size)`.
+void pool_start(worker_pool_t *pool, int nr_active, pool_fn fn, void *args, size_t arg_size) {
+	pool->fn = fn;
+	pool->args = (char *)args;
+	pool->arg_size = arg_size;
+	pool->nr_active = nr_active;
+
+	pthread_barrier_wait(&pool->start);
+}
+
+// Waits for the job started by `pool_start` to finish.
+void pool_wait(worker_pool_t *pool) {
+	pthread_barrier_wait(&pool->done);
+}
+
+// Runs a job and waits for it to finish.
+void pool_run(worker_pool_t *pool, int nr_active, pool_fn fn, void *args, size_t arg_size) {
+	pool_start(pool, nr_active, fn, args, arg_size);
+	pool_wait(pool);
+}
@@ -0,0 +1,47 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#ifndef POOL_H_
+#define POOL_H_
+
+#include <pthread.h>
+#include <stddef.h>
+
+// Function executed by a worker of the pool, with its own argument.
+typedef void (*pool_fn)(void *arg);
+
+// Threads which are created once and then execute one job after another. A job runs the same
+// function on the first `nr_active` workers, each with its own argument, while the other
+// workers stay idle.
+typedef struct {
+	// name of the workers in the trace, where worker `i` is shown as `name` `i`
+	const char *name;
+	int nr_workers;
+	pthread_t *tid;
+
+	// the workers and the thread which submits the jobs meet at `start` before a job and at
+	// `done` after it
+	pthread_barrier_t start, done;
+
+	// the current job, written only while the workers wait at `start`
+	pool_fn fn;
+	char *args;
+	size_t arg_size;
+	int nr_active;
+	int stop;
+} worker_pool_t;
+
+// Creates a pool of `nr_workers` threads, named `name` in the trace.
+worker_pool_t *pool_create(const char *name, int nr_workers);
+
+// Stops the workers and frees the pool. There must be no job in progress.
+void pool_destroy(worker_pool_t *pool);
+
+// Starts a job in which worker `i` < `nr_active` calls `fn(args + i * arg_size)`.
+void pool_start(worker_pool_t *pool, int nr_active, pool_fn fn, void *args, size_t arg_size);
+
+// Waits for the job started by `pool_start` to finish.
+void pool_wait(worker_pool_t *pool);
+
+// Runs a job and waits for it to finish.
+void pool_run(worker_pool_t *pool, int nr_active, pool_fn fn, void *args, size_t arg_size);
+
+#endif  // POOL_H_
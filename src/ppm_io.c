@@ -0,0 +1,488 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+// needed for fallocate
+#define _GNU_SOURCE
+
+#include "ppm_io.h"
+
+#include <ctype.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "helpers.h"
+
+// Image returned by `ppm_map`, together with the memory which holds the whole file (only the
+// pixels, for `ppm_alloc`).
+typedef struct {
+	ppm_image image;
+	unsigned char *file;
+	size_t size;
+	int mapped;
+} mapped_ppm_t;
+
+// Skips the whitespace and the comments found before a token of the header.
+static size_t skip_space(const unsigned char *file, size_t size, size_t pos) {
+	while (pos < size) {
+		if (file[pos] == '#') {
+			while (pos < size && file[pos] != '\n') {
+				pos++;
+			}
+		} else if (isspace(file[pos])) {
+			pos++;
+		} else {
+			break;
+		}
+	}
+
+	return pos;
+}
+
+// Parses a decimal number of the header. Returns -1 if there is none.
+static long parse_number(const unsigned char *file, size_t size, size_t *pos) {
+	size_t p = skip_space(file, size, *pos);
+	long value = 0;
+
+	if (p == size || !isdigit(file[p])) {
+		return -1;
+	}
+
+	while (p < size && isdigit(file[p]) && value <= 1L << 32) {
+		value = value * 10 + (file[p++] - '0');
+	}
+
+	*pos = p;
+	return value;
+}
+
+// Parses the header of a P6 image found at the start of `file`, setting the size of `image`.
+// Returns the offset of the pixels. Exits on errors.
+static size_t parse_header(const unsigned char *file, size_t size, const char *filename,
+						   ppm_image *image) {
+	// check the image format
+	if (size < 2 || file[0] != 'P' || file[1] != '6') {
+		fprintf(stderr, "Invalid image format (must be 'P6')\n");
+		exit(1);
+	}
+
+	// read image size information and RGB component
+	size_t pos = 2;
+	long x = parse_number(file, size, &pos);
+	long y = parse_number(file, size, &pos);
+	if (x <= 0 || y <= 0 || x > 1L << 30 || y > 1L << 30) {
+		fprintf(stderr, "Invalid image size (error loading '%s')\n", filename);
+		exit(1);
+	}
+
+	long rgb_comp_color = parse_number(file, size, &pos);
+	if (rgb_comp_color < 0) {
+		fprintf(stderr, "Invalid rgb component (error loading '%s')\n", filename);
+		exit(1);
+	}
+	if (rgb_comp_color != RGB_COMPONENT_COLOR) {
+		fprintf(stderr, "'%s' does not have 8-bits components\n", filename);
+		exit(1);
+	}
+
+	// a single whitespace character separates the header from the pixels
+	if (pos >= size) {
+		fprintf(stderr, "Error loading image '%s'\n", filename);
+		exit(1);
+	}
+
+	image->x = x;
+	image->y = y;
+
+	return pos + 1;
+}
+
+// Reads a file which cannot be mapped.
+static unsigned char *read_file(int fd, const char *filename, size_t *size) {
+	size_t capacity = 1 << 20;
+	unsigned char *file = (unsigned char *)malloc(capacity);
+	if (!file) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	*size = 0;
+	ssize_t count;
+	while ((count = read(fd, file + *size, capacity - *size)) > 0) {
+		*size += count;
+		if (*size == capacity) {
+			capacity *= 2;
+			file = (unsigned char *)realloc(file, capacity);
+			if (!file) {
+				fprintf(stderr, "Unable to allocate memory\n");
+				exit(1);
+			}
+		}
+	}
+
+	if (count < 0) {
+		perror(filename);
+		exit(1);
+	}
+
+	return file;
+}
+
+// Maps a P6 image in memory. Only the header is parsed, `data` points to the pixels in the
+// mapping, which is private: the pixels can be written without changing the file. Files which
+// cannot be mapped (pipes, for example) are read in a buffer instead. Exits on errors.
+ppm_image *ppm_map(const char *filename) {
+	mapped_ppm_t *ppm = (mapped_ppm_t *)malloc(sizeof(mapped_ppm_t));
+	if (!ppm) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	int fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "Unable to open file '%s'\n", filename);
+		exit(1);
+	}
+
+	struct stat st;
+	if (fstat(fd, &st)) {
+		perror(filename);
+		exit(1);
+	}
+
+	ppm->mapped = 0;
+	if (S_ISREG(st.st_mode) && st.st_size > 0) {
+		ppm->size = st.st_size;
+		ppm->file = mmap(NULL, ppm->size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+		ppm->mapped = ppm->file != MAP_FAILED;
+	}
+
+	if (ppm->mapped) {
+		// start reading the file ahead. The lazy resampler reads only the planned lines, and
+		// reads them again for every group of rows, so the pages must not be dropped behind the
+		// reads as MADV_SEQUENTIAL would allow
+		madvise(ppm->file, ppm->size, MADV_WILLNEED);
+	} else {
+		ppm->file = read_file(fd, filename, &ppm->size);
+	}
+
+	close(fd);
+
+	size_t pos = parse_header(ppm->file, ppm->size, filename, &ppm->image);
+	if ((ppm->size - pos) / 3 / ppm->image.x < (size_t)ppm->image.y) {
+		fprintf(stderr, "Error loading image '%s'\n", filename);
+		exit(1);
+	}
+
+	ppm->image.data = (ppm_pixel *)(ppm->file + pos);
+
+	return &ppm->image;
+}
+
+// Maps an existing P6 image for updating it in place: the mapping is shared, so the pixels which
+// are written end up in the file. Returns NULL if the file cannot be opened or mapped, or is not
+// a P6 image.
+ppm_image *ppm_map_update(const char *filename) {
+	int fd = open(filename, O_RDWR);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || st.st_size < 2) {
+		close(fd);
+		return NULL;
+	}
+
+	unsigned char *file = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (file == MAP_FAILED) {
+		return NULL;
+	}
+
+	mapped_ppm_t *ppm = (mapped_ppm_t *)malloc(sizeof(mapped_ppm_t));
+	if (!ppm) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	ppm->file = file;
+	ppm->size = st.st_size;
+	ppm->mapped = 1;
+
+	// the file may have been written by another program
+	if (file[0] != 'P' || file[1] != '6') {
+		ppm_unmap(&ppm->image);
+		return NULL;
+	}
+
+	size_t pos = parse_header(ppm->file, ppm->size, filename, &ppm->image);
+	if ((ppm->size - pos) / 3 / ppm->image.x < (size_t)ppm->image.y) {
+		ppm_unmap(&ppm->image);
+		return NULL;
+	}
+
+	ppm->image.data = (ppm_pixel *)(ppm->file + pos);
+
+	return &ppm->image;
+}
+
+// Allocates an image which is released with `ppm_unmap`, like the mapped ones.
+ppm_image *ppm_alloc(int x, int y) {
+	mapped_ppm_t *ppm = (mapped_ppm_t *)malloc(sizeof(mapped_ppm_t));
+	if (!ppm) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	ppm->mapped = 0;
+	ppm->size = (size_t)x * y * sizeof(ppm_pixel);
+	ppm->file = (unsigned char *)malloc(ppm->size);
+	if (!ppm->file) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	ppm->image.x = x;
+	ppm->image.y = y;
+	ppm->image.data = (ppm_pixel *)ppm->file;
+
+	return &ppm->image;
+}
+
+// Unmaps an image returned by `ppm_map`, `ppm_map_update` or `ppm_alloc`.
+void ppm_unmap(ppm_image *image) {
+	mapped_ppm_t *ppm = (mapped_ppm_t *)((char *)image - offsetof(mapped_ppm_t, image));
+
+	if (ppm->mapped) {
+		munmap(ppm->file, ppm->size);
+	} else {
+		free(ppm->file);
+	}
+
+	free(ppm);
+}
+
+// Writes `size` bytes at `offset`, retrying after partial writes.
+static void write_at(ppm_writer_t *writer, const void *buf, size_t size, off_t offset) {
+	const char *bytes = (const char *)buf;
+
+	while (size > 0) {
+		ssize_t count = pwrite(writer->fd, bytes, size, offset);
+		if (count < 0) {
+			perror(writer->filename);
+			exit(1);
+		}
+
+		bytes += count;
+		size -= count;
+		offset += count;
+	}
+}
+
+// Creates the output file for `image`: writes the header and allocates the space of the
+// pixels, so that the rows can then be written in any order. Exits on errors.
+ppm_writer_t *ppm_writer_open(const char *filename, const ppm_image *image) {
+	ppm_writer_t *writer = (ppm_writer_t *)malloc(sizeof(ppm_writer_t));
+	if (!writer) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	writer->filename = filename;
+	writer->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (writer->fd < 0) {
+		fprintf(stderr, "Unable to open file '%s'\n", filename);
+		exit(1);
+	}
+
+	// the same header as `write_ppm`
+	char header[64];
+	writer->header_size = snprintf(header, sizeof(header), "P6\n%d %d\n%d\n", image->x,
+								   image->y, RGB_COMPONENT_COLOR);
+
+	// reserve the blocks of the file, or at least set its size if the file system cannot
+	off_t size = writer->header_size + (off_t)image->x * image->y * sizeof(ppm_pixel);
+	if (fallocate(writer->fd, 0, 0, size) && ftruncate(writer->fd, size)) {
+		perror(filename);
+		exit(1);
+	}
+
+	write_at(writer, header, writer->header_size, 0);
+
+	return writer;
+}
+
+// Writes the pixels of the rows [first_row, end_row) at their place in the file.
+void ppm_writer_write_rows(ppm_writer_t *writer, const ppm_image *image, int first_row,
+						   int end_row) {
+	if (first_row >= end_row) {
+		return;
+	}
+
+	size_t row_size = (size_t)image->y * sizeof(ppm_pixel);
+
+	write_at(writer, &image->data[(size_t)first_row * image->y], (end_row - first_row) * row_size,
+			 writer->header_size + first_row * row_size);
+}
+
+void ppm_writer_close(ppm_writer_t *writer) {
+	if (close(writer->fd)) {
+		perror(writer->filename);
+		exit(1);
+	}
+
+	free(writer);
+}
+
+// Opens a P6 image whose pixels are read on demand, a few lines at a time. Sets the size of
+// `header`, but not its pixels. Exits on errors.
+ppm_stream_t *ppm_stream_open(const char *filename, ppm_image *header) {
+	ppm_stream_t *stream = (ppm_stream_t *)malloc(sizeof(ppm_stream_t));
+	if (!stream) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	stream->filename = filename;
+	stream->fd = open(filename, O_RDONLY);
+	if (stream->fd < 0) {
+		fprintf(stderr, "Unable to open file '%s'\n", filename);
+		exit(1);
+	}
+
+	// the header, including the comments, must fit in the first block read
+	unsigned char block[PPM_HEADER_MAX];
+	ssize_t size = pread(stream->fd, block, sizeof(block), 0);
+	if (size < 0) {
+		perror(filename);
+		exit(1);
+	}
+
+	stream->data_offset = parse_header(block, size, filename, header);
+	stream->line_size = (size_t)header->x * sizeof(ppm_pixel);
+	header->data = NULL;
+
+	// the lines are read in increasing order
+	posix_fadvise(stream->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+	return stream;
+}
+
+// Reads `nr_lines` consecutive lines, starting with `first_line`, in `buf`.
+void ppm_stream_read_lines(ppm_stream_t *stream, int first_line, int nr_lines, ppm_pixel *buf) {
+	char *bytes = (char *)buf;
+	size_t size = nr_lines * stream->line_size;
+	off_t offset = stream->data_offset + (off_t)first_line * stream->line_size;
+
+	while (size > 0) {
+		ssize_t count = pread(stream->fd, bytes, size, offset);
+		if (count <= 0) {
+			fprintf(stderr, "Error loading image '%s'\n", stream->filename);
+			exit(1);
+		}
+
+		bytes += count;
+		size -= count;
+		offset += count;
+	}
+}
+
+void ppm_stream_close(ppm_stream_t *stream) {
+	close(stream->fd);
+	free(stream);
+}
+
+// Reads the next character of a header which is not whitespace or part of a comment.
+static int skip_frame_space(FILE *fp) {
+	int c = getc(fp);
+
+	while (c == '#' || isspace(c)) {
+		if (c == '#') {
+			while (c != '\n' && c != EOF) {
+				c = getc(fp);
+			}
+		} else {
+			c = getc(fp);
+		}
+	}
+
+	return c;
+}
+
+// Reads a decimal number of a frame header, together with the whitespace character which ends
+// it. Returns -1 if there is none.
+static long read_frame_number(FILE *fp) {
+	int c = skip_frame_space(fp);
+	long value = 0;
+
+	if (!isdigit(c)) {
+		return -1;
+	}
+
+	while (isdigit(c) && value <= 1L << 32) {
+		value = value * 10 + (c - '0');
+		c = getc(fp);
+	}
+
+	if (c != EOF && !isspace(c)) {
+		ungetc(c, fp);
+	}
+
+	return value;
+}
+
+// Reads the header of the next frame of a stream of concatenated P6 images, setting the size
+// of `header`, but not its pixels. Returns 0 at the end of the stream. Exits on errors.
+int ppm_frame_read_header(FILE *fp, const char *filename, ppm_image *header) {
+	int c = skip_frame_space(fp);
+	if (c == EOF) {
+		return 0;
+	}
+
+	if (c != 'P' || getc(fp) != '6') {
+		fprintf(stderr, "Invalid image format (must be 'P6')\n");
+		exit(1);
+	}
+
+	long x = read_frame_number(fp);
+	long y = read_frame_number(fp);
+	if (x <= 0 || y <= 0 || x > 1L << 30 || y > 1L << 30) {
+		fprintf(stderr, "Invalid image size (error loading '%s')\n", filename);
+		exit(1);
+	}
+
+	long rgb_comp_color = read_frame_number(fp);
+	if (rgb_comp_color < 0) {
+		fprintf(stderr, "Invalid rgb component (error loading '%s')\n", filename);
+		exit(1);
+	}
+	if (rgb_comp_color != RGB_COMPONENT_COLOR) {
+		fprintf(stderr, "'%s' does not have 8-bits components\n", filename);
+		exit(1);
+	}
+
+	header->x = x;
+	header->y = y;
+
+	return 1;
+}
+
+// Reads the pixels of the frame whose header was just read in `image`. Exits on errors.
+void ppm_frame_read_pixels(FILE *fp, const char *filename, ppm_image *image) {
+	if (fread(image->data, 3 * (size_t)image->y, image->x, fp) != (size_t)image->x) {
+		fprintf(stderr, "Error loading image '%s'\n", filename);
+		exit(1);
+	}
+}
+
+// Appends `image` to a stream of concatenated P6 images. Exits on errors.
+void ppm_frame_write(FILE *fp, const char *filename, const ppm_image *image) {
+	fprintf(fp, "P6\n%d %d\n%d\n", image->x, image->y, RGB_COMPONENT_COLOR);
+	if (fwrite(image->data, 3 * (size_t)image->y, image->x, fp) != (size_t)image->x) {
+		fprintf(stderr, "Unable to write file '%s'\n", filename);
+		exit(1);
+	}
+}
@@ -0,0 +1,73 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#ifndef PPM_IO_H_
+#define PPM_IO_H_
+
+#include <stdio.h>
+
+#include "helpers.h"
+
+// Maps a P6 image in memory. Only the header is parsed, `data` points to the pixels in the
+// mapping, which is private: the pixels can be written without changing the file. Files which
+// cannot be mapped (pipes, for example) are read in a buffer instead. Exits on errors.
+ppm_image *ppm_map(const char *filename);
+
+// Maps an existing P6 image for updating it in place: the mapping is shared, so the pixels which
+// are written end up in the file. Returns NULL if the file cannot be opened or mapped, or is not
+// a P6 image.
+ppm_image *ppm_map_update(const char *filename);
+
+// Allocates an image which is released with `ppm_unmap`, like the mapped ones.
+ppm_image *ppm_alloc(int x, int y);
+
+// Unmaps an image returned by `ppm_map`, `ppm_map_update` or `ppm_alloc`.
+void ppm_unmap(ppm_image *image);
+
+// Maximum size of the header of an image read by `ppm_stream_open`.
+#define PPM_HEADER_MAX 4096
+
+// Image whose pixels are read from the file on demand.
+typedef struct {
+	int fd;
+	size_t data_offset;
+	size_t line_size;
+	const char *filename;
+} ppm_stream_t;
+
+// Opens a P6 image whose pixels are read on demand, a few lines at a time. Sets the size of
+// `header`, but not its pixels. Exits on errors.
+ppm_stream_t *ppm_stream_open(const char *filename, ppm_image *header);
+
+// Reads `nr_lines` consecutive lines, starting with `first_line`, in `buf`.
+void ppm_stream_read_lines(ppm_stream_t *stream, int first_line, int nr_lines, ppm_pixel *buf);
+
+void ppm_stream_close(ppm_stream_t *stream);
+
+// Reads the header of the next frame of a stream of concatenated P6 images, setting the size
+// of `header`, but not its pixels. Returns 0 at the end of the stream. Exits on errors.
+int ppm_frame_read_header(FILE *fp, const char *filename, ppm_image *header);
+
+// Reads the pixels of the frame whose header was just read in `image`. Exits on errors.
+void ppm_frame_read_pixels(FILE *fp, const char *filename, ppm_image *image);
+
+// Appends `image` to a stream of concatenated P6 images. Exits on errors.
+void ppm_frame_write(FILE *fp, const char *filename, const ppm_image *image);
+
+// Output file in which the rows of an image are written independently, possibly by several
+// threads at the same time.
+typedef struct {
+	int fd;
+	size_t header_size;
+	const char *filename;
+} ppm_writer_t;
+
+// Creates the output file for `image`: writes the header and allocates the space of the
+// pixels, so that the rows can then be written in any order. Exits on errors.
+ppm_writer_t *ppm_writer_open(const char *filename, const ppm_image *image);
+
+// Writes the pixels of the rows [first_row, end_row) at their place in the file.
+void ppm_writer_write_rows(ppm_writer_t *writer, const ppm_image *image, int first_row,
+						   int end_row);
+
+void ppm_writer_close(ppm_writer_t *writer);
+
+#endif  // PPM_IO_H_
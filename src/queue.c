@@ -0,0 +1,62 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#include "queue.h"
+
+#include <errno.h>
+#include <semaphore.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// Waits for a semaphore, also across the signals received meanwhile.
+static void wait_semaphore(sem_t *sem) {
+	while (sem_wait(sem)) {
+		if (errno != EINTR) {
+			perror("sem_wait");
+			exit(1);
+		}
+	}
+}
+
+// Initializes an empty queue which holds at most `capacity` items.
+void spsc_queue_init(spsc_queue_t *queue, size_t capacity) {
+	queue->items = (void **)malloc(capacity * sizeof(void *));
+	if (!queue->items) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	queue->capacity = capacity;
+	queue->head = 0;
+	queue->tail = 0;
+	sem_init(&queue->filled, 0, 0);
+	sem_init(&queue->empty, 0, capacity);
+}
+
+void spsc_queue_destroy(spsc_queue_t *queue) {
+	sem_destroy(&queue->filled);
+	sem_destroy(&queue->empty);
+	free(queue->items);
+}
+
+// Adds `item` at the end of the queue, waiting for a free place if it is full.
+void spsc_queue_push(spsc_queue_t *queue, void *item) {
+	wait_semaphore(&queue->empty);
+
+	// only the producer moves the tail, posting `filled` publishes the item
+	queue->items[queue->tail % queue->capacity] = item;
+	queue->tail++;
+
+	sem_post(&queue->filled);
+}
+
+// Removes the first item of the queue, waiting for one if it is empty.
+void *spsc_queue_pop(spsc_queue_t *queue) {
+	wait_semaphore(&queue->filled);
+
+	// only the consumer moves the head, posting `empty` gives the place back to the producer
+	void *item = queue->items[queue->head % queue->capacity];
+	queue->head++;
+
+	sem_post(&queue->empty);
+
+	return item;
+}
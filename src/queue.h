@@ -0,0 +1,32 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#ifndef QUEUE_H_
+#define QUEUE_H_
+
+#include <semaphore.h>
+#include <stddef.h>
+
+// Bounded queue between a single producer and a single consumer. The items are passed through
+// a ring whose head is only moved by the consumer and whose tail only by the producer, so no
+// lock is taken. The semaphores count the items and the free places, and also order the
+// accesses to the ring: posting one publishes the place written or freed before it to the
+// thread which waits for it. A thread only sleeps on them when the queue is empty or full,
+// instead of spinning, which matters when the stages outnumber the CPUs.
+typedef struct {
+	void **items;
+	size_t capacity;
+	size_t head, tail;
+	sem_t filled, empty;
+} spsc_queue_t;
+
+// Initializes an empty queue which holds at most `capacity` items.
+void spsc_queue_init(spsc_queue_t *queue, size_t capacity);
+
+void spsc_queue_destroy(spsc_queue_t *queue);
+
+// Adds `item` at the end of the queue, waiting for a free place if it is full.
+void spsc_queue_push(spsc_queue_t *queue, void *item);
+
+// Removes the first item of the queue, waiting for one if it is empty.
+void *spsc_queue_pop(spsc_queue_t *queue);
+
+#endif  // QUEUE_H_
@@ -0,0 +1,1303 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#include "resample.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "helpers.h"
+#include "simd.h"
+
+#ifdef SIMD_X86
+#include <immintrin.h>
+#endif
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+
+// Size of the L2 cache when the system does not report it, and of its lines.
+#define RESAMPLE_DEFAULT_L2 (256 * 1024)
+#define RESAMPLE_CACHE_LINE 64
+
+// The scaled rows interpolated together, one per lane of the kernels. Unused lanes repeat the
+// last row, so that the kernels never have to deal with partial groups. Only the planned
+// columns [first_col, end_col) are computed, which read the source lines [first_line, end_line).
+// Along the horizontal pass, the pixels [prefetch_first, prefetch_last] of the lines
+// [prefetch_line, prefetch_end_line), which the next group reads, are prefetched.
+typedef struct {
+	int first_col, end_col;
+	int first_line, end_line;
+	int prefetch_line, prefetch_end_line;
+	int prefetch_first, prefetch_last;
+
+	int n;
+	int rows[RESAMPLE_LANES];
+	int taps[4][RESAMPLE_LANES];
+	float fract[RESAMPLE_LANES] __attribute__((aligned(32)));
+
+	// for the fixed-point kernels, the taps of the lanes as [lane][tap] and their weights as
+	// [lane][channel][pair of taps]
+	int lane_taps[4 * RESAMPLE_LANES];
+	int16_t w01[3 * 2 * RESAMPLE_LANES], w23[3 * 2 * RESAMPLE_LANES];
+} lane_group_t;
+
+// Interpolates the group along the x axis of the source, for every source line in the plan.
+// Line `k` of the plan is found at `lines[k]`. The result is stored in `h` as
+// [line][channel][lane].
+typedef void (*horizontal_fn)(const ppm_pixel *const *lines, const lane_group_t *group,
+							  float *h);
+
+// Interpolates the result of the horizontal pass along the y axis and stores the pixels.
+typedef void (*vertical_fn)(const resample_plan_t *plan, const lane_group_t *group,
+							const float *h, ppm_image *dst);
+
+// Same computation as in `sample_bicubic`, including the double precision subtraction.
+static void compute_taps(float coord, int size, int taps[4], float *fract) {
+	float x = (coord * size) - 0.5;
+	int xint = (int)x;
+	*fract = x - floor(x);
+
+	for (int k = 0; k < 4; k++) {
+		int tap = xint - 1 + k;
+		if (tap < 0) {
+			tap = 0;
+		} else if (tap > size - 1) {
+			tap = size - 1;
+		}
+		taps[k] = tap;
+	}
+}
+
+// Weights of the 4 taps of `cubic_hermite` at the fractional offset `t`, rounded to
+// RESAMPLE_WEIGHT_BITS bits. The rounding error of the sum goes to the largest weight, so that
+// they add up to exactly 1 and flat areas keep their value.
+static void compute_weights(float t, int16_t weights[4]) {
+	const double one = 1 << RESAMPLE_WEIGHT_BITS;
+	double w[4] = {
+		((-0.5 * t + 1.0) * t - 0.5) * t,
+		(1.5 * t - 2.5) * t * t + 1.0,
+		((-1.5 * t + 2.0) * t + 0.5) * t,
+		(0.5 * t - 0.5) * t * t,
+	};
+	int sum = 0;
+
+	for (int k = 0; k < 4; k++) {
+		weights[k] = (int16_t)lrint(w[k] * one);
+		sum += weights[k];
+	}
+	weights[t < 0.5f ? 1 : 2] += (1 << RESAMPLE_WEIGHT_BITS) - sum;
+}
+
+// Precomputes the row-major filter: the taps of the scaled rows are source rows, the taps of
+// the planned columns are source columns.
+static void plan_row_major(resample_plan_t *plan, const ppm_image *source, const int *cols,
+						   int nr_cols) {
+	for (int i = 0; i < plan->dst_x; i++) {
+		float v = (float)i / (float)(plan->dst_x - 1);
+		compute_taps(v, source->x, plan->x_taps + 4 * i, plan->x_fract + i);
+	}
+
+	for (int k = 0; k < nr_cols; k++) {
+		float u = (float)cols[k] / (float)(plan->dst_y - 1);
+		compute_taps(u, source->y, plan->y_taps + 4 * k, plan->y_fract + k);
+	}
+
+	plan->nr_src_rows = 0;
+	plan->src_rows = NULL;
+}
+
+// Finds the most source lines a tile of the reference view may read. For every line, a group
+// keeps its horizontal pass and the cache lines of the pixels it reads, and prefetches the ones
+// of the next group, which must all stay in half of the L2 cache, the other half being left to
+// the scaled rows and to the other data of the thread.
+static int plan_tile_lines(const resample_plan_t *plan) {
+	long l2 = sysconf(_SC_LEVEL2_CACHE_SIZE);
+	if (l2 <= 0) {
+		l2 = RESAMPLE_DEFAULT_L2;
+	}
+
+	size_t pass = 3 * RESAMPLE_LANES * (plan->fixed_point ? sizeof(int16_t) : sizeof(float));
+	return MAX(4, (int)(l2 / 2 / (pass + 3 * RESAMPLE_CACHE_LINE)));
+}
+
+// Precomputes the weights of the fixed-point kernels from the fractional offsets of the taps.
+static void plan_weights(resample_plan_t *plan) {
+	if (!plan->fixed_point) {
+		return;
+	}
+
+	plan->x_weights = (int16_t *)malloc(4 * plan->dst_x * sizeof(int16_t));
+	if (!plan->x_weights) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	for (int i = 0; i < plan->dst_x; i++) {
+		compute_weights(plan->x_fract[i], plan->x_weights + 4 * i);
+	}
+
+	plan->y_weights = (int16_t *)malloc(4 * plan->nr_cols * sizeof(int16_t));
+	if (!plan->y_weights) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	for (int k = 0; k < plan->nr_cols; k++) {
+		compute_weights(plan->y_fract[k], plan->y_weights + 4 * k);
+	}
+}
+
+// Precomputes the filter taps for scaling `source` to dst_x x dst_y pixels. Only the columns
+// of the scaled image listed in `cols` will be computed by `resample_rows`. With `row_major`,
+// the images are scaled row by row, with `fixed_point`, by the fixed-point kernels, and with
+// a `filter` other than bicubic, by this filter, see `resample_plan_t`.
+resample_plan_t *resample_plan_create(const ppm_image *source, int dst_x, int dst_y,
+									  const int *cols, int nr_cols, int row_major,
+									  int fixed_point, filter_t filter, simd_isa_t isa) {
+	resample_plan_t *plan = (resample_plan_t *)malloc(sizeof(resample_plan_t));
+	if (!plan) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	plan->src_x = source->x;
+	plan->src_y = source->y;
+	plan->dst_x = dst_x;
+	plan->dst_y = dst_y;
+	plan->row_major = row_major;
+	plan->fixed_point = fixed_point;
+	plan->filter = filter;
+	plan->isa = simd_resolve_isa(isa);
+	plan->x_weights = NULL;
+	plan->y_weights = NULL;
+	plan->filter_plan = NULL;
+	plan->tile_lines = plan_tile_lines(plan);
+
+	// the reference filter reads the source lines along x, the row-major one along y
+	if (filter != FILTER_BICUBIC && row_major) {
+		plan->filter_plan = filter_plan_create(filter, source->y, source->x, dst_y, dst_x,
+											   plan->isa);
+	} else if (filter != FILTER_BICUBIC) {
+		plan->filter_plan = filter_plan_create(filter, source->x, source->y, dst_x, dst_y,
+											   plan->isa);
+	}
+
+	plan->x_taps = (int *)malloc(4 * dst_x * sizeof(int));
+	plan->x_fract = (float *)malloc(dst_x * sizeof(float));
+
+	plan->nr_cols = nr_cols;
+	plan->cols = (int *)malloc(nr_cols * sizeof(int));
+	plan->y_taps = (int *)malloc(4 * nr_cols * sizeof(int));
+	plan->y_fract = (float *)malloc(nr_cols * sizeof(float));
+	if (!plan->x_taps || !plan->x_fract || !plan->cols || !plan->y_taps || !plan->y_fract) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	memcpy(plan->cols, cols, nr_cols * sizeof(int));
+
+	if (row_major) {
+		plan_row_major(plan, source, cols, nr_cols);
+		plan_weights(plan);
+		return plan;
+	}
+
+	for (int i = 0; i < dst_x; i++) {
+		float u = (float)i / (float)(dst_x - 1);
+		compute_taps(u, source->x, plan->x_taps + 4 * i, plan->x_fract + i);
+	}
+
+	// mark the source lines which are read, then give them consecutive indices
+	int *line_index = (int *)malloc(source->y * sizeof(int));
+	if (!line_index) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	for (int r = 0; r < source->y; r++) {
+		line_index[r] = -1;
+	}
+
+	for (int k = 0; k < nr_cols; k++) {
+		float v = (float)cols[k] / (float)(dst_y - 1);
+		compute_taps(v, source->y, plan->y_taps + 4 * k, plan->y_fract + k);
+
+		for (int t = 0; t < 4; t++) {
+			line_index[plan->y_taps[4 * k + t]] = 0;
+		}
+	}
+
+	plan->nr_src_rows = 0;
+	for (int r = 0; r < source->y; r++) {
+		if (line_index[r] == 0) {
+			line_index[r] = plan->nr_src_rows++;
+		}
+	}
+
+	plan->src_rows = (int *)malloc(plan->nr_src_rows * sizeof(int));
+	if (!plan->src_rows) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	for (int r = 0; r < source->y; r++) {
+		if (line_index[r] >= 0) {
+			plan->src_rows[line_index[r]] = r;
+		}
+	}
+
+	for (int k = 0; k < 4 * nr_cols; k++) {
+		plan->y_taps[k] = line_index[plan->y_taps[k]];
+	}
+
+	free(line_index);
+	plan_weights(plan);
+
+	return plan;
+}
+
+// Counts the distinct source lines read by the columns `cols` of a scaled image with `dst_y`
+// columns, out of the `src_y` lines of the source, in the reference view. This is the
+// `nr_src_rows` of their plan, without building it.
+int resample_count_lines(int src_y, int dst_y, const int *cols, int nr_cols) {
+	unsigned char *read = (unsigned char *)calloc(src_y, 1);
+	if (!read) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	int nr_lines = 0;
+	for (int k = 0; k < nr_cols; k++) {
+		int taps[4];
+		float fract;
+		compute_taps((float)cols[k] / (float)(dst_y - 1), src_y, taps, &fract);
+
+		for (int t = 0; t < 4; t++) {
+			nr_lines += !read[taps[t]];
+			read[taps[t]] = 1;
+		}
+	}
+
+	free(read);
+
+	return nr_lines;
+}
+
+void resample_plan_destroy(resample_plan_t *plan) {
+	free(plan->x_taps);
+	free(plan->x_fract);
+	free(plan->x_weights);
+	free(plan->src_rows);
+	free(plan->cols);
+	free(plan->y_taps);
+	free(plan->y_fract);
+	free(plan->y_weights);
+	if (plan->filter_plan) {
+		filter_plan_destroy(plan->filter_plan);
+	}
+	free(plan);
+}
+
+// Sets the planned columns of a group to the tile which starts with column `first_col`: the
+// tile takes the next columns, up to `end_col`, as long as they read at most `tile_lines` source
+// lines. The taps are increasing, so the columns read a contiguous range of source lines.
+static void init_tile(const resample_plan_t *plan, int first_col, int end_col,
+					  lane_group_t *group) {
+	int first_line = plan->y_taps[4 * first_col];
+	int k = first_col + 1;
+
+	while (k < end_col && plan->y_taps[4 * k + 3] - first_line < plan->tile_lines) {
+		k++;
+	}
+
+	group->first_col = first_col;
+	group->end_col = k;
+	group->first_line = first_line;
+	group->end_line = plan->y_taps[4 * (k - 1) + 3] + 1;
+}
+
+// Sets the pixels prefetched by the group which starts with rows[i], in a tile which ends with
+// column `end_col`: the ones of the next group of the tile, or of the first group of the next
+// tile, if there is one.
+static void init_prefetch(const resample_plan_t *plan, const int *rows, int nr_rows, int i,
+						  int end_col, lane_group_t *group) {
+	int next = i + RESAMPLE_LANES;
+
+	if (next < nr_rows) {
+		group->prefetch_line = group->first_line;
+		group->prefetch_end_line = group->end_line;
+	} else if (group->end_col < end_col) {
+		lane_group_t tile;
+		init_tile(plan, group->end_col, end_col, &tile);
+		group->prefetch_line = tile.first_line;
+		group->prefetch_end_line = tile.end_line;
+		next = 0;
+	} else {
+		group->prefetch_line = group->prefetch_end_line = group->first_line;
+		return;
+	}
+
+	group->prefetch_first = plan->x_taps[4 * rows[next]];
+	group->prefetch_last = plan->x_taps[4 * rows[MIN(next + RESAMPLE_LANES, nr_rows) - 1] + 3];
+}
+
+// Prefetches the pixels which the next group reads on its line of the same rank as the line
+// `k` of the group, a cache line at a time.
+static inline __attribute__((always_inline))
+void prefetch_next(const ppm_pixel *const *lines, const lane_group_t *group, int k) {
+	int line = group->prefetch_line + k - group->first_line;
+	if (line >= group->prefetch_end_line) {
+		return;
+	}
+
+	uintptr_t first = (uintptr_t)(lines[line] + group->prefetch_first);
+	uintptr_t end = (uintptr_t)(lines[line] + group->prefetch_last + 1);
+	for (uintptr_t p = first & ~(uintptr_t)(RESAMPLE_CACHE_LINE - 1); p < end;
+		 p += RESAMPLE_CACHE_LINE) {
+		__builtin_prefetch((const void *)p);
+	}
+}
+
+// Fills the lanes of a group with the given scaled rows.
+static void init_group(const resample_plan_t *plan, const int *rows, int n, lane_group_t *group) {
+	group->n = n;
+
+	for (int l = 0; l < RESAMPLE_LANES; l++) {
+		int row = rows[MIN(l, n - 1)];
+
+		group->rows[l] = row;
+		group->fract[l] = plan->x_fract[row];
+		for (int t = 0; t < 4; t++) {
+			group->taps[t][l] = plan->x_taps[4 * row + t];
+		}
+
+		if (plan->fixed_point) {
+			const int16_t *w = plan->x_weights + 4 * row;
+
+			memcpy(group->lane_taps + 4 * l, plan->x_taps + 4 * row, 4 * sizeof(int));
+			for (int c = 0; c < 3; c++) {
+				int pair = 2 * (3 * l + c);
+				group->w01[pair] = w[0];
+				group->w01[pair + 1] = w[1];
+				group->w23[pair] = w[2];
+				group->w23[pair + 1] = w[3];
+			}
+		}
+	}
+}
+
+static void horizontal_scalar(const ppm_pixel *const *lines, const lane_group_t *group,
+							  float *h) {
+	for (int k = group->first_line; k < group->end_line; k++) {
+		const ppm_pixel *line = lines[k];
+		float *out = h + 3 * RESAMPLE_LANES * k;
+
+		prefetch_next(lines, group, k);
+
+		for (int l = 0; l < RESAMPLE_LANES; l++) {
+			const ppm_pixel *p0 = &line[group->taps[0][l]];
+			const ppm_pixel *p1 = &line[group->taps[1][l]];
+			const ppm_pixel *p2 = &line[group->taps[2][l]];
+			const ppm_pixel *p3 = &line[group->taps[3][l]];
+			float t = group->fract[l];
+
+			out[l] = cubic_hermite(p0->red, p1->red, p2->red, p3->red, t);
+			out[RESAMPLE_LANES + l] = cubic_hermite(p0->green, p1->green, p2->green,
+													p3->green, t);
+			out[2 * RESAMPLE_LANES + l] = cubic_hermite(p0->blue, p1->blue, p2->blue,
+														p3->blue, t);
+		}
+	}
+}
+
+// Clamps the interpolated values and stores them on the rows of the group. It is always inlined,
+// so that the vector kernels do not pay for switching between SSE and AVX code.
+static inline __attribute__((always_inline))
+void store_pixels(const lane_group_t *group, ppm_image *dst, int col, const float *value) {
+	for (int l = 0; l < group->n; l++) {
+		ppm_pixel *pixel = &dst->data[(size_t)group->rows[l] * dst->y + col];
+		uint8_t channel[3];
+
+		for (int c = 0; c < 3; c++) {
+			float v = value[c * RESAMPLE_LANES + l];
+			if (v < 0.0f) {
+				v = 0.0f;
+			} else if (v > 255.0f) {
+				v = 255.0f;
+			}
+			channel[c] = (uint8_t)v;
+		}
+
+		pixel->red = channel[0];
+		pixel->green = channel[1];
+		pixel->blue = channel[2];
+	}
+}
+
+static void vertical_scalar(const resample_plan_t *plan, const lane_group_t *group,
+							const float *h, ppm_image *dst) {
+	float value[3 * RESAMPLE_LANES];
+
+	for (int k = group->first_col; k < group->end_col; k++) {
+		const int *taps = plan->y_taps + 4 * k;
+		float t = plan->y_fract[k];
+
+		for (int c = 0; c < 3; c++) {
+			for (int l = 0; l < RESAMPLE_LANES; l++) {
+				int offset = c * RESAMPLE_LANES + l;
+				value[offset] = cubic_hermite(h[3 * RESAMPLE_LANES * taps[0] + offset],
+											  h[3 * RESAMPLE_LANES * taps[1] + offset],
+											  h[3 * RESAMPLE_LANES * taps[2] + offset],
+											  h[3 * RESAMPLE_LANES * taps[3] + offset], t);
+			}
+		}
+
+		store_pixels(group, dst, plan->cols[k], value);
+	}
+}
+
+#ifdef SIMD_X86
+
+// `cubic_hermite` on 4 lanes. The operations are done in the same order as in the scalar
+// version and halving is exact, so the results are bit-exact.
+static inline __m128 cubic_hermite_sse(__m128 A, __m128 B, __m128 C, __m128 D, __m128 t) {
+	const __m128 half = _mm_set1_ps(0.5f);
+	const __m128 two = _mm_set1_ps(2.0f);
+	const __m128 three = _mm_set1_ps(3.0f);
+	const __m128 five = _mm_set1_ps(5.0f);
+
+	__m128 half_A = _mm_mul_ps(A, half);
+	__m128 half_C = _mm_mul_ps(C, half);
+	__m128 half_D = _mm_mul_ps(D, half);
+
+	__m128 a = _mm_sub_ps(_mm_mul_ps(_mm_mul_ps(three, B), half), half_A);
+	a = _mm_sub_ps(a, _mm_mul_ps(_mm_mul_ps(three, C), half));
+	a = _mm_add_ps(a, half_D);
+
+	__m128 b = _mm_sub_ps(A, _mm_mul_ps(_mm_mul_ps(five, B), half));
+	b = _mm_add_ps(b, _mm_mul_ps(two, C));
+	b = _mm_sub_ps(b, half_D);
+
+	__m128 c = _mm_sub_ps(half_C, half_A);
+
+	__m128 r = _mm_mul_ps(_mm_mul_ps(_mm_mul_ps(a, t), t), t);
+	r = _mm_add_ps(r, _mm_mul_ps(_mm_mul_ps(b, t), t));
+	r = _mm_add_ps(r, _mm_mul_ps(c, t));
+	return _mm_add_ps(r, B);
+}
+
+// The vector kernels load the bytes one by one, only the arithmetic is vectorized: the taps of
+// neighbouring rows are too far apart in the source for wide loads, and gathers are slower.
+static void horizontal_sse(const ppm_pixel *const *lines, const lane_group_t *group,
+						   float *h) {
+	float p[4][3][RESAMPLE_LANES] __attribute__((aligned(16)));
+	__m128 t_lo = _mm_load_ps(group->fract);
+	__m128 t_hi = _mm_load_ps(group->fract + 4);
+
+	for (int k = group->first_line; k < group->end_line; k++) {
+		const ppm_pixel *line = lines[k];
+		float *out = h + 3 * RESAMPLE_LANES * k;
+
+		prefetch_next(lines, group, k);
+
+		for (int t = 0; t < 4; t++) {
+			for (int l = 0; l < RESAMPLE_LANES; l++) {
+				const ppm_pixel *pixel = &line[group->taps[t][l]];
+				p[t][0][l] = pixel->red;
+				p[t][1][l] = pixel->green;
+				p[t][2][l] = pixel->blue;
+			}
+		}
+
+		for (int c = 0; c < 3; c++) {
+			_mm_store_ps(out + c * RESAMPLE_LANES,
+						 cubic_hermite_sse(_mm_load_ps(p[0][c]), _mm_load_ps(p[1][c]),
+										   _mm_load_ps(p[2][c]), _mm_load_ps(p[3][c]), t_lo));
+			_mm_store_ps(out + c * RESAMPLE_LANES + 4,
+						 cubic_hermite_sse(_mm_load_ps(p[0][c] + 4), _mm_load_ps(p[1][c] + 4),
+										   _mm_load_ps(p[2][c] + 4), _mm_load_ps(p[3][c] + 4),
+										   t_hi));
+		}
+	}
+}
+
+static void vertical_sse(const resample_plan_t *plan, const lane_group_t *group,
+						 const float *h, ppm_image *dst) {
+	float value[3 * RESAMPLE_LANES] __attribute__((aligned(16)));
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 max = _mm_set1_ps(255.0f);
+
+	for (int k = group->first_col; k < group->end_col; k++) {
+		const float *h0 = h + 3 * RESAMPLE_LANES * plan->y_taps[4 * k];
+		const float *h1 = h + 3 * RESAMPLE_LANES * plan->y_taps[4 * k + 1];
+		const float *h2 = h + 3 * RESAMPLE_LANES * plan->y_taps[4 * k + 2];
+		const float *h3 = h + 3 * RESAMPLE_LANES * plan->y_taps[4 * k + 3];
+		__m128 t = _mm_set1_ps(plan->y_fract[k]);
+
+		for (int offset = 0; offset < 3 * RESAMPLE_LANES; offset += 4) {
+			__m128 v = cubic_hermite_sse(_mm_load_ps(h0 + offset), _mm_load_ps(h1 + offset),
+										 _mm_load_ps(h2 + offset), _mm_load_ps(h3 + offset), t);
+			_mm_store_ps(value + offset, _mm_min_ps(_mm_max_ps(v, zero), max));
+		}
+
+		store_pixels(group, dst, plan->cols[k], value);
+	}
+}
+
+__attribute__((target("avx2")))
+static inline __m256 cubic_hermite_avx2(__m256 A, __m256 B, __m256 C, __m256 D, __m256 t) {
+	const __m256 half = _mm256_set1_ps(0.5f);
+	const __m256 two = _mm256_set1_ps(2.0f);
+	const __m256 three = _mm256_set1_ps(3.0f);
+	const __m256 five = _mm256_set1_ps(5.0f);
+
+	__m256 half_A = _mm256_mul_ps(A, half);
+	__m256 half_C = _mm256_mul_ps(C, half);
+	__m256 half_D = _mm256_mul_ps(D, half);
+
+	__m256 a = _mm256_sub_ps(_mm256_mul_ps(_mm256_mul_ps(three, B), half), half_A);
+	a = _mm256_sub_ps(a, _mm256_mul_ps(_mm256_mul_ps(three, C), half));
+	a = _mm256_add_ps(a, half_D);
+
+	__m256 b = _mm256_sub_ps(A, _mm256_mul_ps(_mm256_mul_ps(five, B), half));
+	b = _mm256_add_ps(b, _mm256_mul_ps(two, C));
+	b = _mm256_sub_ps(b, half_D);
+
+	__m256 c = _mm256_sub_ps(half_C, half_A);
+
+	__m256 r = _mm256_mul_ps(_mm256_mul_ps(_mm256_mul_ps(a, t), t), t);
+	r = _mm256_add_ps(r, _mm256_mul_ps(_mm256_mul_ps(b, t), t));
+	r = _mm256_add_ps(r, _mm256_mul_ps(c, t));
+	return _mm256_add_ps(r, B);
+}
+
+__attribute__((target("avx2")))
+static void horizontal_avx2(const ppm_pixel *const *lines, const lane_group_t *group,
+							float *h) {
+	float p[4][3][RESAMPLE_LANES] __attribute__((aligned(32)));
+	__m256 fract = _mm256_load_ps(group->fract);
+
+	for (int k = group->first_line; k < group->end_line; k++) {
+		const ppm_pixel *line = lines[k];
+		float *out = h + 3 * RESAMPLE_LANES * k;
+
+		prefetch_next(lines, group, k);
+
+		for (int t = 0; t < 4; t++) {
+			for (int l = 0; l < RESAMPLE_LANES; l++) {
+				const ppm_pixel *pixel = &line[group->taps[t][l]];
+				p[t][0][l] = pixel->red;
+				p[t][1][l] = pixel->green;
+				p[t][2][l] = pixel->blue;
+			}
+		}
+
+		for (int c = 0; c < 3; c++) {
+			_mm256_store_ps(out + c * RESAMPLE_LANES,
+							cubic_hermite_avx2(_mm256_load_ps(p[0][c]), _mm256_load_ps(p[1][c]),
+											   _mm256_load_ps(p[2][c]), _mm256_load_ps(p[3][c]),
+											   fract));
+		}
+	}
+}
+
+__attribute__((target("avx2")))
+static void vertical_avx2(const resample_plan_t *plan, const lane_group_t *group,
+						  const float *h, ppm_image *dst) {
+	float value[3 * RESAMPLE_LANES] __attribute__((aligned(32)));
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 max = _mm256_set1_ps(255.0f);
+
+	for (int k = group->first_col; k < group->end_col; k++) {
+		const float *h0 = h + 3 * RESAMPLE_LANES * plan->y_taps[4 * k];
+		const float *h1 = h + 3 * RESAMPLE_LANES * plan->y_taps[4 * k + 1];
+		const float *h2 = h + 3 * RESAMPLE_LANES * plan->y_taps[4 * k + 2];
+		const float *h3 = h + 3 * RESAMPLE_LANES * plan->y_taps[4 * k + 3];
+		__m256 t = _mm256_set1_ps(plan->y_fract[k]);
+
+		for (int c = 0; c < 3; c++) {
+			int offset = c * RESAMPLE_LANES;
+			__m256 v = cubic_hermite_avx2(_mm256_load_ps(h0 + offset),
+										  _mm256_load_ps(h1 + offset),
+										  _mm256_load_ps(h2 + offset),
+										  _mm256_load_ps(h3 + offset), t);
+			_mm256_store_ps(value + offset, _mm256_min_ps(_mm256_max_ps(v, zero), max));
+		}
+
+		store_pixels(group, dst, plan->cols[k], value);
+	}
+}
+
+#endif  // SIMD_X86
+
+// Interpolates source row `line` along its length, at the `n` planned columns starting with
+// `first_col`, for the row-major filter. The result is stored in `h` as [channel][column], with
+// `stride` columns per channel; the vector kernels fill the columns past `n` with the last one.
+typedef void (*row_horizontal_fn)(const resample_plan_t *plan, const ppm_pixel *line,
+								  int first_col, int n, int stride, float *h);
+
+// Interpolates the 4 source rows `h` of a scaled row along the columns of the source, into
+// `value`, stored like the rows.
+typedef void (*row_vertical_fn)(const float *const *h, float t, int n, int stride, float *value);
+
+static void row_horizontal_scalar(const resample_plan_t *plan, const ppm_pixel *line,
+								  int first_col, int n, int stride, float *h) {
+	for (int k = 0; k < n; k++) {
+		const int *taps = plan->y_taps + 4 * (first_col + k);
+		const ppm_pixel *p0 = &line[taps[0]];
+		const ppm_pixel *p1 = &line[taps[1]];
+		const ppm_pixel *p2 = &line[taps[2]];
+		const ppm_pixel *p3 = &line[taps[3]];
+		float t = plan->y_fract[first_col + k];
+
+		h[k] = cubic_hermite(p0->red, p1->red, p2->red, p3->red, t);
+		h[stride + k] = cubic_hermite(p0->green, p1->green, p2->green, p3->green, t);
+		h[2 * stride + k] = cubic_hermite(p0->blue, p1->blue, p2->blue, p3->blue, t);
+	}
+}
+
+static void row_vertical_scalar(const float *const *h, float t, int n, int stride,
+								float *value) {
+	for (int c = 0; c < 3; c++) {
+		for (int k = c * stride; k < c * stride + n; k++) {
+			value[k] = cubic_hermite(h[0][k], h[1][k], h[2][k], h[3][k], t);
+		}
+	}
+}
+
+#ifdef SIMD_X86
+
+// Loads the taps of the columns [k, k + lanes) of a row in `p`, as [tap][channel][lane], and
+// their fractional offsets in `fract`. The columns past `n` repeat the last one.
+static inline __attribute__((always_inline))
+void load_row_taps(const resample_plan_t *plan, const ppm_pixel *line, int first_col, int n,
+				   int k, int lanes, float *p, float *fract) {
+	for (int l = 0; l < lanes; l++) {
+		int col = first_col + MIN(k + l, n - 1);
+		const int *taps = plan->y_taps + 4 * col;
+
+		for (int t = 0; t < 4; t++) {
+			const ppm_pixel *pixel = &line[taps[t]];
+			p[(3 * t + 0) * lanes + l] = pixel->red;
+			p[(3 * t + 1) * lanes + l] = pixel->green;
+			p[(3 * t + 2) * lanes + l] = pixel->blue;
+		}
+		fract[l] = plan->y_fract[col];
+	}
+}
+
+static void row_horizontal_sse(const resample_plan_t *plan, const ppm_pixel *line,
+							   int first_col, int n, int stride, float *h) {
+	float p[4 * 3 * 4] __attribute__((aligned(16)));
+	float fract[4] __attribute__((aligned(16)));
+
+	for (int k = 0; k < stride; k += 4) {
+		load_row_taps(plan, line, first_col, n, k, 4, p, fract);
+		__m128 t = _mm_load_ps(fract);
+
+		for (int c = 0; c < 3; c++) {
+			_mm_store_ps(h + c * stride + k,
+						 cubic_hermite_sse(_mm_load_ps(p + c * 4), _mm_load_ps(p + (3 + c) * 4),
+										   _mm_load_ps(p + (6 + c) * 4),
+										   _mm_load_ps(p + (9 + c) * 4), t));
+		}
+	}
+}
+
+static void row_vertical_sse(const float *const *h, float t, int n, int stride, float *value) {
+	__m128 tv = _mm_set1_ps(t);
+	(void)n;
+
+	for (int k = 0; k < 3 * stride; k += 4) {
+		_mm_store_ps(value + k, cubic_hermite_sse(_mm_load_ps(h[0] + k), _mm_load_ps(h[1] + k),
+												  _mm_load_ps(h[2] + k), _mm_load_ps(h[3] + k),
+												  tv));
+	}
+}
+
+__attribute__((target("avx2")))
+static void row_horizontal_avx2(const resample_plan_t *plan, const ppm_pixel *line,
+								int first_col, int n, int stride, float *h) {
+	float p[4 * 3 * 8] __attribute__((aligned(32)));
+	float fract[8] __attribute__((aligned(32)));
+
+	for (int k = 0; k < stride; k += 8) {
+		load_row_taps(plan, line, first_col, n, k, 8, p, fract);
+		__m256 t = _mm256_load_ps(fract);
+
+		for (int c = 0; c < 3; c++) {
+			_mm256_store_ps(h + c * stride + k,
+							cubic_hermite_avx2(_mm256_load_ps(p + c * 8),
+											   _mm256_load_ps(p + (3 + c) * 8),
+											   _mm256_load_ps(p + (6 + c) * 8),
+											   _mm256_load_ps(p + (9 + c) * 8), t));
+		}
+	}
+}
+
+__attribute__((target("avx2")))
+static void row_vertical_avx2(const float *const *h, float t, int n, int stride, float *value) {
+	__m256 tv = _mm256_set1_ps(t);
+	(void)n;
+
+	for (int k = 0; k < 3 * stride; k += 8) {
+		_mm256_store_ps(value + k,
+						cubic_hermite_avx2(_mm256_load_ps(h[0] + k), _mm256_load_ps(h[1] + k),
+										   _mm256_load_ps(h[2] + k), _mm256_load_ps(h[3] + k),
+										   tv));
+	}
+}
+
+#endif  // SIMD_X86
+
+// Clamps the interpolated values of scaled row `row` and stores them on its planned columns
+// [first_col, first_col + n).
+static void store_row(const resample_plan_t *plan, ppm_image *dst, int row, int first_col,
+					  int n, int stride, const float *value) {
+	ppm_pixel *out = dst->data + (size_t)row * dst->y;
+
+	for (int k = 0; k < n; k++) {
+		ppm_pixel *pixel = &out[plan->cols[first_col + k]];
+		uint8_t channel[3];
+
+		for (int c = 0; c < 3; c++) {
+			float v = value[c * stride + k];
+			if (v < 0.0f) {
+				v = 0.0f;
+			} else if (v > 255.0f) {
+				v = 255.0f;
+			}
+			channel[c] = (uint8_t)v;
+		}
+
+		pixel->red = channel[0];
+		pixel->green = channel[1];
+		pixel->blue = channel[2];
+	}
+}
+
+// The fixed-point kernels. The first pass multiplies the pixels with weights of
+// RESAMPLE_WEIGHT_BITS bits and rounds the sums to FIXED_PASS_BITS fractional bits, which
+// keeps them in 16 bits with the overshoot of the filter (-0.125 to 1.125 times 255). The
+// second pass multiplies them with the weights again and drops the fractional bits, truncating
+// like the float kernels. Both passes add pairs of 16-bit products in 32 bits, which is what
+// pmaddwd computes on 8 lanes with SSE and 16 with AVX2.
+#define FIXED_PASS_BITS 6
+#define FIXED_PASS_SHIFT (RESAMPLE_WEIGHT_BITS - FIXED_PASS_BITS)
+#define FIXED_SHIFT (RESAMPLE_WEIGHT_BITS + FIXED_PASS_BITS)
+
+// Computes `n` values of the first pass, `n` being a multiple of 8: value `i` adds the products
+// of the taps p01[2 * i], p01[2 * i + 1], p23[2 * i] and p23[2 * i + 1] with the same elements
+// of `w01` and `w23`.
+typedef void (*fixed_taps_fn)(const int16_t *p01, const int16_t *p23, const int16_t *w01,
+							  const int16_t *w23, int n, int16_t *out);
+
+// Computes `n` values of the second pass, `n` being a multiple of 8, from the values
+// h[0][i] .. h[3][i] of the first pass and the 4 weights `w`, clamped to [0, 255].
+typedef void (*fixed_lines_fn)(const int16_t *const *h, const int16_t *w, int n, uint8_t *out);
+
+// Gathers the pixels of the taps taps[4 * i .. 4 * i + 3] of `n` outputs from `line`, as
+// pairs of taps for the first pass, [output][channel][pair]: the first two taps go in `p01`,
+// the last two in `p23`. Both must have room for 2 values past the 6 * n gathered ones.
+typedef void (*fixed_gather_fn)(const ppm_pixel *line, const int *taps, int n, int16_t *p01,
+								int16_t *p23);
+
+static void fixed_taps_scalar(const int16_t *p01, const int16_t *p23, const int16_t *w01,
+							  const int16_t *w23, int n, int16_t *out) {
+	for (int i = 0; i < n; i++) {
+		int32_t sum = p01[2 * i] * w01[2 * i] + p01[2 * i + 1] * w01[2 * i + 1] +
+					  p23[2 * i] * w23[2 * i] + p23[2 * i + 1] * w23[2 * i + 1];
+		out[i] = (int16_t)((sum + (1 << (FIXED_PASS_SHIFT - 1))) >> FIXED_PASS_SHIFT);
+	}
+}
+
+static void fixed_gather_scalar(const ppm_pixel *line, const int *taps, int n, int16_t *p01,
+								int16_t *p23) {
+	for (int i = 0; i < n; i++) {
+		for (int t = 0; t < 4; t++) {
+			const ppm_pixel *pixel = &line[taps[4 * i + t]];
+			int16_t *p = (t < 2 ? p01 : p23) + 6 * i + (t & 1);
+
+			p[0] = pixel->red;
+			p[2] = pixel->green;
+			p[4] = pixel->blue;
+		}
+	}
+}
+
+static void fixed_lines_scalar(const int16_t *const *h, const int16_t *w, int n, uint8_t *out) {
+	for (int i = 0; i < n; i++) {
+		int32_t v = (h[0][i] * w[0] + h[1][i] * w[1] + h[2][i] * w[2] + h[3][i] * w[3]) >>
+					FIXED_SHIFT;
+		if (v < 0) {
+			v = 0;
+		} else if (v > 255) {
+			v = 255;
+		}
+		out[i] = (uint8_t)v;
+	}
+}
+
+#ifdef SIMD_X86
+
+// Packs two weights in the 32 bits which pmaddwd multiplies with a pair of taps.
+static inline int pair_weights(int16_t first, int16_t second) {
+	return (int)((uint32_t)(uint16_t)first | (uint32_t)(uint16_t)second << 16);
+}
+
+static void fixed_taps_sse(const int16_t *p01, const int16_t *p23, const int16_t *w01,
+						   const int16_t *w23, int n, int16_t *out) {
+	const __m128i round = _mm_set1_epi32(1 << (FIXED_PASS_SHIFT - 1));
+
+	for (int i = 0; i < n; i += 8) {
+		__m128i sum[2];
+
+		for (int half = 0; half < 2; half++) {
+			int k = 2 * i + 8 * half;
+			__m128i s01 = _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(p01 + k)),
+										 _mm_loadu_si128((const __m128i *)(w01 + k)));
+			__m128i s23 = _mm_madd_epi16(_mm_loadu_si128((const __m128i *)(p23 + k)),
+										 _mm_loadu_si128((const __m128i *)(w23 + k)));
+			sum[half] = _mm_srai_epi32(_mm_add_epi32(_mm_add_epi32(s01, s23), round),
+									   FIXED_PASS_SHIFT);
+		}
+
+		_mm_storeu_si128((__m128i *)(out + i), _mm_packs_epi32(sum[0], sum[1]));
+	}
+}
+
+// Computes the values [i, i + 8) of the second pass, in the low 8 bytes of the result. The
+// lines are interleaved into pairs, whose products are added by pmaddwd, and the packs clamp
+// the values to [0, 255].
+static inline __attribute__((always_inline))
+__m128i fixed_lines_8(const int16_t *const *h, __m128i w01, __m128i w23, int i) {
+	__m128i h0 = _mm_loadu_si128((const __m128i *)(h[0] + i));
+	__m128i h1 = _mm_loadu_si128((const __m128i *)(h[1] + i));
+	__m128i h2 = _mm_loadu_si128((const __m128i *)(h[2] + i));
+	__m128i h3 = _mm_loadu_si128((const __m128i *)(h[3] + i));
+
+	__m128i lo = _mm_add_epi32(_mm_madd_epi16(_mm_unpacklo_epi16(h0, h1), w01),
+							   _mm_madd_epi16(_mm_unpacklo_epi16(h2, h3), w23));
+	__m128i hi = _mm_add_epi32(_mm_madd_epi16(_mm_unpackhi_epi16(h0, h1), w01),
+							   _mm_madd_epi16(_mm_unpackhi_epi16(h2, h3), w23));
+	__m128i v = _mm_packs_epi32(_mm_srai_epi32(lo, FIXED_SHIFT), _mm_srai_epi32(hi, FIXED_SHIFT));
+	return _mm_packus_epi16(v, v);
+}
+
+static void fixed_lines_sse(const int16_t *const *h, const int16_t *w, int n, uint8_t *out) {
+	__m128i w01 = _mm_set1_epi32(pair_weights(w[0], w[1]));
+	__m128i w23 = _mm_set1_epi32(pair_weights(w[2], w[3]));
+
+	for (int i = 0; i < n; i += 8) {
+		_mm_storel_epi64((__m128i *)(out + i), fixed_lines_8(h, w01, w23, i));
+	}
+}
+
+// The taps of an output are consecutive pixels, except near the edges where they are clamped,
+// so their 12 bytes are loaded at once and spread into pairs by two shuffles. The stores of an
+// output spill 2 values over the next one, which are overwritten when it is gathered.
+__attribute__((target("avx2")))
+static void fixed_gather_avx2(const ppm_pixel *line, const int *taps, int n, int16_t *p01,
+							  int16_t *p23) {
+	const __m128i first_pair = _mm_setr_epi8(0, -1, 3, -1, 1, -1, 4, -1, 2, -1, 5, -1,
+											 -1, -1, -1, -1);
+	const __m128i last_pair = _mm_setr_epi8(6, -1, 9, -1, 7, -1, 10, -1, 8, -1, 11, -1,
+											-1, -1, -1, -1);
+
+	for (int i = 0; i < n; i++) {
+		const int *t = taps + 4 * i;
+
+		if (t[3] - t[0] != 3) {
+			fixed_gather_scalar(line, t, 1, p01 + 6 * i, p23 + 6 * i);
+			continue;
+		}
+
+		// the last 4 bytes are loaded on their own, so that nothing is read past the pixels
+		const unsigned char *bytes = (const unsigned char *)&line[t[0]];
+		int32_t last;
+		memcpy(&last, bytes + 8, sizeof(last));
+		__m128i v = _mm_insert_epi32(_mm_loadl_epi64((const __m128i *)bytes), last, 2);
+
+		_mm_storeu_si128((__m128i *)(p01 + 6 * i), _mm_shuffle_epi8(v, first_pair));
+		_mm_storeu_si128((__m128i *)(p23 + 6 * i), _mm_shuffle_epi8(v, last_pair));
+	}
+}
+
+__attribute__((target("avx2")))
+static void fixed_taps_avx2(const int16_t *p01, const int16_t *p23, const int16_t *w01,
+							const int16_t *w23, int n, int16_t *out) {
+	const __m256i round = _mm256_set1_epi32(1 << (FIXED_PASS_SHIFT - 1));
+
+	for (int i = 0; i < n; i += 8) {
+		__m256i s01 = _mm256_madd_epi16(_mm256_loadu_si256((const __m256i *)(p01 + 2 * i)),
+										_mm256_loadu_si256((const __m256i *)(w01 + 2 * i)));
+		__m256i s23 = _mm256_madd_epi16(_mm256_loadu_si256((const __m256i *)(p23 + 2 * i)),
+										_mm256_loadu_si256((const __m256i *)(w23 + 2 * i)));
+		__m256i sum = _mm256_srai_epi32(_mm256_add_epi32(_mm256_add_epi32(s01, s23), round),
+										FIXED_PASS_SHIFT);
+
+		_mm_storeu_si128((__m128i *)(out + i),
+						 _mm_packs_epi32(_mm256_castsi256_si128(sum),
+										 _mm256_extracti128_si256(sum, 1)));
+	}
+}
+
+// The unpacks and the packs work on the halves of the registers, so the values stay in order
+// until the last pack, which leaves the bytes of each half in its low 8 bytes.
+__attribute__((target("avx2")))
+static void fixed_lines_avx2(const int16_t *const *h, const int16_t *w, int n, uint8_t *out) {
+	__m256i w01 = _mm256_set1_epi32(pair_weights(w[0], w[1]));
+	__m256i w23 = _mm256_set1_epi32(pair_weights(w[2], w[3]));
+	int i = 0;
+
+	for (; i + 16 <= n; i += 16) {
+		__m256i h0 = _mm256_loadu_si256((const __m256i *)(h[0] + i));
+		__m256i h1 = _mm256_loadu_si256((const __m256i *)(h[1] + i));
+		__m256i h2 = _mm256_loadu_si256((const __m256i *)(h[2] + i));
+		__m256i h3 = _mm256_loadu_si256((const __m256i *)(h[3] + i));
+
+		__m256i lo = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpacklo_epi16(h0, h1), w01),
+									  _mm256_madd_epi16(_mm256_unpacklo_epi16(h2, h3), w23));
+		__m256i hi = _mm256_add_epi32(_mm256_madd_epi16(_mm256_unpackhi_epi16(h0, h1), w01),
+									  _mm256_madd_epi16(_mm256_unpackhi_epi16(h2, h3), w23));
+		__m256i v = _mm256_packs_epi32(_mm256_srai_epi32(lo, FIXED_SHIFT),
+									   _mm256_srai_epi32(hi, FIXED_SHIFT));
+		v = _mm256_permute4x64_epi64(_mm256_packus_epi16(v, v), 0x08);
+		_mm_storeu_si128((__m128i *)(out + i), _mm256_castsi256_si128(v));
+	}
+
+	for (; i < n; i += 8) {
+		_mm_storel_epi64((__m128i *)(out + i),
+						 fixed_lines_8(h, _mm256_castsi256_si128(w01),
+									   _mm256_castsi256_si128(w23), i));
+	}
+}
+
+#endif  // SIMD_X86
+
+// The fixed-point kernels of the instruction set of the plan.
+typedef struct {
+	fixed_gather_fn gather;
+	fixed_taps_fn taps;
+	fixed_lines_fn lines;
+} fixed_kernels_t;
+
+static fixed_kernels_t fixed_kernels(const resample_plan_t *plan) {
+	fixed_kernels_t kernels = {fixed_gather_scalar, fixed_taps_scalar, fixed_lines_scalar};
+
+#ifdef SIMD_X86
+	if (plan->isa == SIMD_ISA_SSE) {
+		kernels.taps = fixed_taps_sse;
+		kernels.lines = fixed_lines_sse;
+	} else if (plan->isa == SIMD_ISA_AVX2) {
+		kernels.gather = fixed_gather_avx2;
+		kernels.taps = fixed_taps_avx2;
+		kernels.lines = fixed_lines_avx2;
+	}
+#endif
+
+	return kernels;
+}
+
+// Interpolates the group along the x axis of the source like a `horizontal_fn`, with the
+// fixed-point kernels. The result is stored in `h` as [line][lane][channel].
+static void horizontal_fixed(const fixed_kernels_t *kernels, const ppm_pixel *const *lines,
+							 const lane_group_t *group, int16_t *h) {
+	int16_t p01[3 * 2 * RESAMPLE_LANES + 2], p23[3 * 2 * RESAMPLE_LANES + 2];
+
+	for (int k = group->first_line; k < group->end_line; k++) {
+		prefetch_next(lines, group, k);
+		kernels->gather(lines[k], group->lane_taps, RESAMPLE_LANES, p01, p23);
+		kernels->taps(p01, p23, group->w01, group->w23, 3 * RESAMPLE_LANES,
+					  h + 3 * RESAMPLE_LANES * k);
+	}
+}
+
+// Interpolates the result of `horizontal_fixed` along the y axis and stores the pixels.
+static void vertical_fixed(const fixed_kernels_t *kernels, const resample_plan_t *plan,
+						   const lane_group_t *group, const int16_t *h, ppm_image *dst) {
+	uint8_t value[3 * RESAMPLE_LANES];
+
+	for (int k = group->first_col; k < group->end_col; k++) {
+		const int16_t *rows[4];
+		for (int t = 0; t < 4; t++) {
+			rows[t] = h + 3 * RESAMPLE_LANES * plan->y_taps[4 * k + t];
+		}
+
+		kernels->lines(rows, plan->y_weights + 4 * k, 3 * RESAMPLE_LANES, value);
+
+		for (int l = 0; l < group->n; l++) {
+			memcpy(&dst->data[(size_t)group->rows[l] * dst->y + plan->cols[k]], value + 3 * l,
+				   sizeof(ppm_pixel));
+		}
+	}
+}
+
+// Same as `resample_row_major`, with the fixed-point kernels.
+static void resample_row_major_fixed(const resample_plan_t *plan, const ppm_image *source,
+									 ppm_image *dst, const int *rows, int nr_rows,
+									 int first_col, int end_col) {
+	fixed_kernels_t kernels = fixed_kernels(plan);
+
+	int n = end_col - first_col;
+	int stride = (n + RESAMPLE_LANES - 1) / RESAMPLE_LANES * RESAMPLE_LANES;
+	size_t size = (size_t)3 * stride;
+
+	// the 4 rows of the ring, stored as [column][channel], then the taps of a source row and
+	// their weights, for which the columns past `n` are 0
+	int16_t *ring = (int16_t *)malloc((12 * size + 4) * sizeof(int16_t));
+	uint8_t *value = (uint8_t *)malloc(size);
+	if (!ring || !value) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	int16_t *w01 = ring + 4 * size;
+	int16_t *w23 = w01 + 2 * size;
+	int16_t *p01 = w23 + 2 * size;
+	int16_t *p23 = p01 + 2 * size + 2;
+	int held[4] = {-1, -1, -1, -1};
+	memset(w01, 0, (8 * size + 4) * sizeof(int16_t));
+
+	// the weights of the columns are the same for every source row
+	for (int k = 0; k < n; k++) {
+		const int16_t *w = plan->y_weights + 4 * (first_col + k);
+
+		for (int c = 0; c < 3; c++) {
+			int16_t *pair = w01 + 2 * (3 * k + c);
+			pair[0] = w[0];
+			pair[1] = w[1];
+			pair = w23 + 2 * (3 * k + c);
+			pair[0] = w[2];
+			pair[1] = w[3];
+		}
+	}
+
+	for (int i = 0; i < nr_rows; i++) {
+		const int *row_taps = plan->x_taps + 4 * rows[i];
+		const int16_t *h[4];
+
+		for (int t = 0; t < 4; t++) {
+			int line = row_taps[t];
+			int16_t *slot = ring + (line & 3) * size;
+
+			if (held[line & 3] != line) {
+				kernels.gather(source->data + (size_t)line * source->y,
+							   plan->y_taps + 4 * first_col, n, p01, p23);
+				kernels.taps(p01, p23, w01, w23, (int)size, slot);
+				held[line & 3] = line;
+			}
+			h[t] = slot;
+		}
+
+		kernels.lines(h, plan->x_weights + 4 * rows[i], (int)size, value);
+
+		ppm_pixel *out = dst->data + (size_t)rows[i] * dst->y;
+		for (int k = 0; k < n; k++) {
+			memcpy(&out[plan->cols[first_col + k]], value + 3 * k, sizeof(ppm_pixel));
+		}
+	}
+
+	free(value);
+	free(ring);
+}
+
+// Same as `resample_lines`, with the fixed-point kernels.
+static void resample_lines_fixed(const resample_plan_t *plan, const ppm_pixel *const *lines,
+								 ppm_image *dst, const int *rows, int nr_rows, int first_col,
+								 int end_col) {
+	fixed_kernels_t kernels = fixed_kernels(plan);
+	int16_t *h = (int16_t *)malloc((size_t)plan->nr_src_rows * 3 * RESAMPLE_LANES *
+								   sizeof(int16_t));
+	if (!h) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	lane_group_t group;
+
+	for (int tile = first_col; tile < end_col; tile = group.end_col) {
+		init_tile(plan, tile, end_col, &group);
+
+		for (int i = 0; i < nr_rows; i += RESAMPLE_LANES) {
+			init_group(plan, rows + i, MIN(RESAMPLE_LANES, nr_rows - i), &group);
+			init_prefetch(plan, rows, nr_rows, i, end_col, &group);
+			horizontal_fixed(&kernels, lines, &group, h);
+			vertical_fixed(&kernels, plan, &group, h, dst);
+		}
+	}
+
+	free(h);
+}
+
+// Interpolates the given scaled rows, which must be sorted, on the planned columns
+// [first_col, end_col), with the row-major filter. Every source row read by the scaled rows is
+// interpolated along its length once, into a ring which holds the last 4 of them: the taps of a
+// scaled row are consecutive source rows, so they never fall on the same place of the ring.
+static void resample_row_major(const resample_plan_t *plan, const ppm_image *source,
+							   ppm_image *dst, const int *rows, int nr_rows, int first_col,
+							   int end_col) {
+	if (plan->fixed_point) {
+		resample_row_major_fixed(plan, source, dst, rows, nr_rows, first_col, end_col);
+		return;
+	}
+
+	row_horizontal_fn horizontal = row_horizontal_scalar;
+	row_vertical_fn vertical = row_vertical_scalar;
+
+#ifdef SIMD_X86
+	if (plan->isa == SIMD_ISA_SSE) {
+		horizontal = row_horizontal_sse;
+		vertical = row_vertical_sse;
+	} else if (plan->isa == SIMD_ISA_AVX2) {
+		horizontal = row_horizontal_avx2;
+		vertical = row_vertical_avx2;
+	}
+#endif
+
+	int n = end_col - first_col;
+	int stride = (n + RESAMPLE_LANES - 1) / RESAMPLE_LANES * RESAMPLE_LANES;
+
+	// the 4 rows of the ring, then the values of a scaled row
+	float *ring = aligned_alloc(32, (size_t)5 * 3 * stride * sizeof(float));
+	if (!ring) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	float *value = ring + 4 * 3 * stride;
+	int held[4] = {-1, -1, -1, -1};
+
+	for (int i = 0; i < nr_rows; i++) {
+		const int *taps = plan->x_taps + 4 * rows[i];
+		const float *h[4];
+
+		for (int t = 0; t < 4; t++) {
+			int line = taps[t];
+			float *slot = ring + (line & 3) * 3 * stride;
+
+			if (held[line & 3] != line) {
+				horizontal(plan, source->data + (size_t)line * source->y, first_col, n, stride,
+						   slot);
+				held[line & 3] = line;
+			}
+			h[t] = slot;
+		}
+
+		vertical(h, plan->x_fract[rows[i]], n, stride, value);
+		store_row(plan, dst, rows[i], first_col, n, stride, value);
+	}
+
+	free(ring);
+}
+
+// Interpolates the pixels found on the given rows and on the planned columns of `dst` whose
+// indices in the plan are in [first_col, end_col). Line `k` of the plan is read from
+// `lines[k]`, only the lines read by these columns must be set.
+void resample_lines(const resample_plan_t *plan, const ppm_pixel *const *lines, ppm_image *dst,
+					const int *rows, int nr_rows, int first_col, int end_col) {
+	horizontal_fn horizontal = horizontal_scalar;
+	vertical_fn vertical = vertical_scalar;
+
+#ifdef SIMD_X86
+	if (plan->isa == SIMD_ISA_SSE) {
+		horizontal = horizontal_sse;
+		vertical = vertical_sse;
+	} else if (plan->isa == SIMD_ISA_AVX2) {
+		horizontal = horizontal_avx2;
+		vertical = vertical_avx2;
+	}
+#endif
+
+	if (nr_rows == 0 || first_col >= end_col) {
+		return;
+	}
+
+	if (plan->fixed_point) {
+		resample_lines_fixed(plan, lines, dst, rows, nr_rows, first_col, end_col);
+		return;
+	}
+
+	float *h = aligned_alloc(32, (size_t)plan->nr_src_rows * 3 * RESAMPLE_LANES * sizeof(float));
+	if (!h) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	// every group of rows goes over a tile of columns before the next tile, so that each source
+	// pixel is brought in the cache once
+	lane_group_t group;
+
+	for (int tile = first_col; tile < end_col; tile = group.end_col) {
+		init_tile(plan, tile, end_col, &group);
+
+		for (int i = 0; i < nr_rows; i += RESAMPLE_LANES) {
+			init_group(plan, rows + i, MIN(RESAMPLE_LANES, nr_rows - i), &group);
+			init_prefetch(plan, rows, nr_rows, i, end_col, &group);
+			horizontal(lines, &group, h);
+			vertical(plan, &group, h, dst);
+		}
+	}
+
+	free(h);
+}
+
+// Interpolates the pixels found on the given rows and on the planned columns of `dst` whose
+// indices in the plan are in [first_col, end_col).
+void resample_block(const resample_plan_t *plan, const ppm_image *source, ppm_image *dst,
+					const int *rows, int nr_rows, int first_col, int end_col) {
+	if (nr_rows == 0 || first_col >= end_col) {
+		return;
+	}
+
+	// the scaled rows are the inner coordinates of the reference filter, the outer ones of the
+	// row-major filter
+	if (plan->filter_plan && plan->row_major) {
+		filter_resample(plan->filter_plan, source->data, plan->cols + first_col,
+						end_col - first_col, rows, nr_rows, dst, 1);
+		return;
+	}
+	if (plan->filter_plan) {
+		filter_resample(plan->filter_plan, source->data, rows, nr_rows, plan->cols + first_col,
+						end_col - first_col, dst, 0);
+		return;
+	}
+
+	if (plan->row_major) {
+		resample_row_major(plan, source, dst, rows, nr_rows, first_col, end_col);
+		return;
+	}
+
+	const ppm_pixel **lines = (const ppm_pixel **)malloc(plan->nr_src_rows *
+														 sizeof(ppm_pixel *));
+	if (!lines) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	int first_line = plan->y_taps[4 * first_col];
+	int end_line = plan->y_taps[4 * (end_col - 1) + 3] + 1;
+
+	for (int k = first_line; k < end_line; k++) {
+		lines[k] = source->data + (size_t)plan->src_rows[k] * source->x;
+	}
+
+	resample_lines(plan, lines, dst, rows, nr_rows, first_col, end_col);
+
+	free(lines);
+}
+
+// Interpolates the pixels found on the given rows and on the planned columns of `dst`.
+// The result is bit-exact with calling `sample_bicubic` for each pixel.
+void resample_rows(const resample_plan_t *plan, const ppm_image *source, ppm_image *dst,
+				   const int *rows, int nr_rows) {
+	resample_block(plan, source, dst, rows, nr_rows, 0, plan->nr_cols);
+}
+
+// Finds the planned columns of the scaled image found in [start, end), as indices in the plan.
+void resample_find_cols(const resample_plan_t *plan, int start, int end, int *first_col,
+						int *end_col) {
+	int k = 0;
+	while (k < plan->nr_cols && plan->cols[k] < start) {
+		k++;
+	}
+	*first_col = k;
+
+	while (k < plan->nr_cols && plan->cols[k] < end) {
+		k++;
+	}
+	*end_col = k;
+}
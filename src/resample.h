@@ -0,0 +1,117 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#ifndef RESAMPLE_H_
+#define RESAMPLE_H_
+
+#include <stdint.h>
+
+#include "filter.h"
+#include "helpers.h"
+#include "simd.h"
+
+// Number of scaled rows which are interpolated together by the resampling kernels.
+#define RESAMPLE_LANES 8
+
+// Fractional bits of the weights of the fixed-point kernels, which add up to 1 << 14.
+#define RESAMPLE_WEIGHT_BITS 14
+
+// Tap indices and fractional offsets of the bicubic filter, precomputed once for a pair of
+// source and scaled image sizes. Just like in `sample_bicubic`, row `i` of the scaled image
+// is sampled at u = i / (x - 1) along the x axis of the source, and column `j` at
+// v = j / (y - 1) along its y axis.
+//
+// The row-major filter samples the images as `x` rows of `y` pixels instead: row `i` of the
+// scaled image reads the source rows x_taps[4 * i .. 4 * i + 3] and column cols[k] reads the
+// source columns y_taps[4 * k .. 4 * k + 3] of these rows, so every source row is read along
+// its length. The scaled image is then the transpose of the one of the default filter.
+//
+// The fixed-point kernels interpolate with the same polynomial, but from 16-bit weights and
+// with integer multiply-adds, and the pixels may be off by one from `sample_bicubic`.
+//
+// With a filter other than bicubic, the pixels are interpolated by `filter_resample` instead,
+// sampled at the same places. The taps above are still computed, for the footprints.
+typedef struct {
+	int src_x, src_y;
+	int dst_x, dst_y;
+	int row_major;
+	int fixed_point;
+	filter_t filter;
+
+	// row i of the scaled image reads the source columns x_taps[4 * i .. 4 * i + 3]
+	int *x_taps;
+	float *x_fract;
+	// the weights of these taps, for the fixed-point kernels
+	int16_t *x_weights;
+
+	// the distinct source lines read by the scaled columns in `cols`, in increasing order (none
+	// for the row-major filter)
+	int nr_src_rows;
+	int *src_rows;
+
+	// column cols[k] of the scaled image reads the source lines
+	// src_rows[y_taps[4 * k]] .. src_rows[y_taps[4 * k + 3]]
+	int nr_cols;
+	int *cols;
+	int *y_taps;
+	float *y_fract;
+	int16_t *y_weights;
+
+	// the taps of the other filters, or NULL for bicubic
+	filter_plan_t *filter_plan;
+
+	// the most source lines read by a tile of planned columns in the reference view, so that
+	// the lines and their horizontal pass stay in the L2 cache from a group of rows to the next
+	int tile_lines;
+
+	simd_isa_t isa;
+} resample_plan_t;
+
+// Precomputes the filter taps for scaling `source` to dst_x x dst_y pixels. Only the columns
+// of the scaled image listed in `cols` will be computed by `resample_rows`. With `row_major`,
+// the images are scaled row by row, with `fixed_point`, by the fixed-point kernels, and with
+// a `filter` other than bicubic, by this filter, see `resample_plan_t`.
+resample_plan_t *resample_plan_create(const ppm_image *source, int dst_x, int dst_y,
+									  const int *cols, int nr_cols, int row_major,
+									  int fixed_point, filter_t filter, simd_isa_t isa);
+
+void resample_plan_destroy(resample_plan_t *plan);
+
+// Counts the distinct source lines read by the columns `cols` of a scaled image with `dst_y`
+// columns, out of the `src_y` lines of the source, in the reference view. This is the
+// `nr_src_rows` of their plan, without building it.
+int resample_count_lines(int src_y, int dst_y, const int *cols, int nr_cols);
+
+// Interpolates the pixels found on the given rows and on the planned columns of `dst`.
+// The result is bit-exact with calling `sample_bicubic` for each pixel, or at most one off
+// with the fixed-point kernels, when the filter is bicubic.
+void resample_rows(const resample_plan_t *plan, const ppm_image *source, ppm_image *dst,
+				   const int *rows, int nr_rows);
+
+// Interpolates the pixels found on the given rows and on the planned columns of `dst` whose
+// indices in the plan are in [first_col, end_col).
+void resample_block(const resample_plan_t *plan, const ppm_image *source, ppm_image *dst,
+					const int *rows, int nr_rows, int first_col, int end_col);
+
+// Same as `resample_block`, but line `k` of the plan is read from `lines[k]` instead of the
+// source image. Only the lines read by the given columns must be set.
+void resample_lines(const resample_plan_t *plan, const ppm_pixel *const *lines, ppm_image *dst,
+					const int *rows, int nr_rows, int first_col, int end_col);
+
+// Finds the planned columns of the scaled image found in [start, end), as indices in the plan.
+void resample_find_cols(const resample_plan_t *plan, int start, int end, int *first_col,
+						int *end_col);
+
+// Finds the source columns [*first, *end) read by row `row` of the scaled image.
+static inline void resample_row_footprint(const resample_plan_t *plan, int row, int *first,
+										  int *end) {
+	*first = plan->x_taps[4 * row];
+	*end = plan->x_taps[4 * row + 3] + 1;
+}
+
+// Finds the source lines [*first, *end) read by the planned column `k` (an index in the plan).
+static inline void resample_col_footprint(const resample_plan_t *plan, int k, int *first,
+										  int *end) {
+	*first = plan->src_rows[plan->y_taps[4 * k]];
+	*end = plan->src_rows[plan->y_taps[4 * k + 3]] + 1;
+}
+
+#endif  // RESAMPLE_H_
@@ -0,0 +1,164 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#include "sched.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "trace.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+// Creates a scheduler for `nr_workers` threads, for phases of at most `max_tasks` tasks. The
+// barrier must be shared by all the workers.
+scheduler_t *sched_create(int nr_workers, int max_tasks, pthread_barrier_t *barrier) {
+	scheduler_t *sched = (scheduler_t *)malloc(sizeof(scheduler_t));
+	if (!sched) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	sched->nr_workers = nr_workers;
+	sched->max_tasks = max_tasks;
+	sched->barrier = barrier;
+	sched->deques = (task_deque_t *)malloc(nr_workers * sizeof(task_deque_t));
+	sched->stats = (worker_stats_t *)calloc(nr_workers, sizeof(worker_stats_t));
+	if (!sched->deques || !sched->stats) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	for (int w = 0; w < nr_workers; w++) {
+		task_deque_t *deque = &sched->deques[w];
+
+		pthread_mutex_init(&deque->lock, NULL);
+		deque->top = deque->bottom = 0;
+
+		// a worker gets at most its block of tasks
+		deque->tasks = (int *)malloc((max_tasks / nr_workers + 1) * sizeof(int));
+		if (!deque->tasks) {
+			fprintf(stderr, "Unable to allocate memory\n");
+			exit(1);
+		}
+	}
+
+	return sched;
+}
+
+void sched_destroy(scheduler_t *sched) {
+	for (int w = 0; w < sched->nr_workers; w++) {
+		pthread_mutex_destroy(&sched->deques[w].lock);
+		free(sched->deques[w].tasks);
+	}
+	free(sched->deques);
+	free(sched->stats);
+	free(sched);
+}
+
+// Takes the last task of the worker's own deque. Returns -1 if it is empty.
+static int pop_task(task_deque_t *deque) {
+	int task = -1;
+
+	pthread_mutex_lock(&deque->lock);
+	if (deque->top < deque->bottom) {
+		task = deque->tasks[--deque->bottom];
+	}
+	pthread_mutex_unlock(&deque->lock);
+
+	return task;
+}
+
+// Takes the first task of another worker's deque, the one furthest from what its owner is
+// working on. Returns -1 if it is empty.
+static int steal_task(task_deque_t *deque) {
+	int task = -1;
+
+	pthread_mutex_lock(&deque->lock);
+	if (deque->top < deque->bottom) {
+		task = deque->tasks[deque->top++];
+	}
+	pthread_mutex_unlock(&deque->lock);
+
+	return task;
+}
+
+// Runs a phase of `nr_tasks` tasks. Must be called by all the workers. A worker returns when
+// there are no more tasks to take, but other workers may still be executing theirs. The phase
+// is traced as `name`.
+void sched_run(scheduler_t *sched, int worker, int nr_tasks, task_fn fn, void *ctx,
+			   const char *name) {
+	task_deque_t *own = &sched->deques[worker];
+	worker_stats_t *stats = &sched->stats[worker];
+
+	// the same contiguous block as the static split, pushed in reverse so that the owner
+	// executes it in order and the thieves take the end of the block
+	int start = worker * (double)nr_tasks / sched->nr_workers;
+	int end = MIN((worker + 1) * (double)nr_tasks / sched->nr_workers, nr_tasks);
+
+	pthread_mutex_lock(&own->lock);
+	own->top = own->bottom = 0;
+	for (int task = end - 1; task >= start; task--) {
+		own->tasks[own->bottom++] = task;
+	}
+	pthread_mutex_unlock(&own->lock);
+
+	// all the deques must be filled before anyone starts stealing
+	trace_barrier_wait(sched->barrier, "barrier deques");
+
+	trace_mark_t mark;
+	trace_begin(&mark);
+
+	for (;;) {
+		int task = pop_task(own);
+
+		// look for work at the other workers, starting with the next one
+		for (int w = 1; task < 0 && w < sched->nr_workers; w++) {
+			task = steal_task(&sched->deques[(worker + w) % sched->nr_workers]);
+			if (task >= 0) {
+				stats->stolen++;
+			}
+		}
+
+		// no tasks are created during a phase, so empty deques mean that the phase is done
+		if (task < 0) {
+			break;
+		}
+
+		double begin = now();
+		fn(ctx, task);
+		stats->busy += now() - begin;
+		stats->executed++;
+	}
+
+	trace_end(name, TRACE_PHASE, &mark);
+}
+
+// Prints the number of tasks executed and stolen and the busy time of every worker.
+void sched_print_stats(const scheduler_t *sched, FILE *file) {
+	double total = 0, max = 0;
+
+	fprintf(file, "worker  tasks  stolen  busy (ms)\n");
+	for (int w = 0; w < sched->nr_workers; w++) {
+		const worker_stats_t *stats = &sched->stats[w];
+
+		fprintf(file, "%6d %6ld %7ld %10.2f\n", w, stats->executed, stats->stolen,
+				stats->busy * 1000);
+		total += stats->busy;
+		if (stats->busy > max) {
+			max = stats->busy;
+		}
+	}
+
+	// 1.00 means that all the workers were busy for the same time
+	if (total > 0) {
+		fprintf(file, "imbalance (max / mean busy time): %.2f\n",
+				max * sched->nr_workers / total);
+	}
+}
@@ -0,0 +1,50 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#ifndef SCHED_H_
+#define SCHED_H_
+
+#include <pthread.h>
+#include <stdio.h>
+
+// Tasks of a worker. The owner takes tasks from the bottom, idle workers steal from the top.
+typedef struct {
+	pthread_mutex_t lock;
+	int *tasks;
+	int top, bottom;
+} task_deque_t;
+
+// Statistics of a worker, accumulated over all the phases.
+typedef struct {
+	long executed;
+	long stolen;
+	double busy;
+} worker_stats_t;
+
+// Work-stealing scheduler. Each phase is split in numbered tasks, which are first given to the
+// workers in contiguous blocks, like the static split.
+typedef struct {
+	int nr_workers;
+	int max_tasks;
+	task_deque_t *deques;
+	worker_stats_t *stats;
+	pthread_barrier_t *barrier;
+} scheduler_t;
+
+// Function which executes task `task` of a phase.
+typedef void (*task_fn)(void *ctx, int task);
+
+// Creates a scheduler for `nr_workers` threads, for phases of at most `max_tasks` tasks. The
+// barrier must be shared by all the workers.
+scheduler_t *sched_create(int nr_workers, int max_tasks, pthread_barrier_t *barrier);
+
+void sched_destroy(scheduler_t *sched);
+
+// Runs a phase of `nr_tasks` tasks. Must be called by all the workers. A worker returns when
+// there are no more tasks to take, but other workers may still be executing theirs. The phase
+// is traced as `name`.
+void sched_run(scheduler_t *sched, int worker, int nr_tasks, task_fn fn, void *ctx,
+			   const char *name);
+
+// Prints the number of tasks executed and stolen and the busy time of every worker.
+void sched_print_stats(const scheduler_t *sched, FILE *file);
+
+#endif  // SCHED_H_
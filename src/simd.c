@@ -0,0 +1,41 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#include "simd.h"
+
+#include <string.h>
+
+// Returns the best instruction set supported by the CPU.
+simd_isa_t simd_best_isa(void) {
+#ifdef SIMD_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2")) {
+		return SIMD_ISA_AVX2;
+	}
+	return SIMD_ISA_SSE;
+#else
+	return SIMD_ISA_SCALAR;
+#endif
+}
+
+// Returns `isa`, or the best supported instruction set if `isa` is `auto` or not supported.
+simd_isa_t simd_resolve_isa(simd_isa_t isa) {
+	simd_isa_t best = simd_best_isa();
+
+	if (isa == SIMD_ISA_AUTO || isa > best) {
+		return best;
+	}
+	return isa;
+}
+
+// Converts an instruction set name (auto, scalar, sse, avx2). Returns 0 on success.
+int simd_isa_from_name(const char *name, simd_isa_t *isa) {
+	static const char *names[] = {"auto", "scalar", "sse", "avx2"};
+
+	for (int i = 0; i < (int)(sizeof(names) / sizeof(names[0])); i++) {
+		if (!strcmp(name, names[i])) {
+			*isa = (simd_isa_t)i;
+			return 0;
+		}
+	}
+
+	return -1;
+}
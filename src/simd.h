@@ -0,0 +1,26 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#ifndef SIMD_H_
+#define SIMD_H_
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86
+#endif
+
+// Instruction sets for which the vector kernels are implemented, from the least capable one.
+typedef enum {
+	SIMD_ISA_AUTO,
+	SIMD_ISA_SCALAR,
+	SIMD_ISA_SSE,
+	SIMD_ISA_AVX2,
+} simd_isa_t;
+
+// Returns the best instruction set supported by the CPU.
+simd_isa_t simd_best_isa(void);
+
+// Returns `isa`, or the best supported instruction set if `isa` is `auto` or not supported.
+simd_isa_t simd_resolve_isa(simd_isa_t isa);
+
+// Converts an instruction set name (auto, scalar, sse, avx2). Returns 0 on success.
+int simd_isa_from_name(const char *name, simd_isa_t *isa);
+
+#endif  // SIMD_H_
@@ -0,0 +1,201 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#include "stream.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "atlas.h"
+#include "config.h"
+#include "helpers.h"
+#include "parallel_march.h"
+#include "pool.h"
+#include "ppm_io.h"
+#include "resample.h"
+#include "types.h"
+#include "utils.h"
+
+#define MIN(X, Y) (((X) < (Y)) ? (X) : (Y))
+#define MAX(X, Y) (((X) > (Y)) ? (X) : (Y))
+
+// Arguments of a thread which scales a window.
+typedef struct {
+	thread_arg_t arg;
+	const ppm_pixel *const *lines;
+	int first_col, end_col;
+} window_arg_t;
+
+static void scale_window(void *arg) {
+	window_arg_t *window = (window_arg_t *)arg;
+
+	rescale_window(&window->arg, window->lines, window->first_col, window->end_col);
+}
+
+static void process_slot(void *arg) {
+	process_image((thread_arg_t *)arg);
+}
+
+// Scales the image read from `stream` into `scaled_image`. The source lines of the plan are
+// read in windows of `window_lines` lines; each window scales every column whose taps it
+// holds, then the next window starts with the first line of the next column.
+static void scale_stream(const config_t *config, ppm_stream_t *stream, ppm_image *header,
+						 ppm_image *scaled_image, worker_pool_t *pool, int nr_threads,
+						 int window_lines) {
+	resample_plan_t *plan = create_rescale_plan(config, header, scaled_image);
+
+	ppm_pixel *window = (ppm_pixel *)malloc((size_t)window_lines * header->x * sizeof(ppm_pixel));
+	const ppm_pixel **lines = (const ppm_pixel **)calloc(plan->nr_src_rows, sizeof(ppm_pixel *));
+	window_arg_t *args = (window_arg_t *)malloc(nr_threads * sizeof(window_arg_t));
+	int *rows = (int *)malloc(scaled_image->x * sizeof(int));
+	if (!window || !lines || !args || !rows) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	for (int i = 0; i < nr_threads; i++) {
+		memset(&args[i].arg, 0, sizeof(thread_arg_t));
+		args[i].arg.thread_id = i;
+		args[i].arg.nr_threads = nr_threads;
+		args[i].arg.config = config;
+		args[i].arg.image = header;
+		args[i].arg.scaled_image = scaled_image;
+		args[i].arg.plan = plan;
+		args[i].arg.rows = rows;
+		args[i].lines = lines;
+	}
+
+	// the lines of the plan held by the window are [first_line, end_line)
+	int first_line = 0, end_line = 0;
+
+	for (int first_col = 0; first_col < plan->nr_cols;) {
+		int start = plan->y_taps[4 * first_col];
+		int end = MIN(start + window_lines, plan->nr_src_rows);
+
+		// keep the lines which are still needed, then read the others
+		int kept = MAX(0, end_line - start);
+		memmove(window, lines[start] ? lines[start] : window,
+				(size_t)kept * header->x * sizeof(ppm_pixel));
+		for (int k = first_line; k < end_line; k++) {
+			lines[k] = NULL;
+		}
+
+		for (int k = start; k < end; k++) {
+			lines[k] = window + (size_t)(k - start) * header->x;
+		}
+
+		for (int k = start + kept; k < end;) {
+			// read the consecutive source lines together
+			int run = 1;
+			while (k + run < end && plan->src_rows[k + run] == plan->src_rows[k] + run) {
+				run++;
+			}
+
+			ppm_stream_read_lines(stream, plan->src_rows[k], run, (ppm_pixel *)lines[k]);
+			k += run;
+		}
+
+		first_line = start;
+		end_line = end;
+
+		// the columns whose last tap is in the window
+		int end_col = first_col;
+		while (end_col < plan->nr_cols && plan->y_taps[4 * end_col + 3] < end) {
+			end_col++;
+		}
+
+		for (int i = 0; i < nr_threads; i++) {
+			args[i].first_col = first_col;
+			args[i].end_col = end_col;
+		}
+		pool_run(pool, nr_threads, scale_window, args, sizeof(window_arg_t));
+
+		first_col = end_col;
+	}
+
+	free(rows);
+	free(args);
+	free(lines);
+	free(window);
+	resample_plan_destroy(plan);
+}
+
+// Processes `config->in_file` without loading it: when the image is scaled, the source lines
+// are read in windows of at most `config->stream_budget` bytes, each window being scaled
+// before the next one is read. The scaled image is kept whole, outside of the budget. Returns
+// the exit status of the program.
+int stream_run(const config_t *config) {
+	ppm_image header;
+	ppm_stream_t *stream = ppm_stream_open(config->in_file, &header);
+	int rescale = header.x > config->rescale_x || header.y > config->rescale_y;
+	ppm_image *image;
+
+	// the threads are counted for the whole image, including the scaling
+	config_t image_config = *config;
+	if (config->nr_threads == CONFIG_AUTO_THREADS) {
+		ppm_image scaled = {config->rescale_x, config->rescale_y, NULL};
+		image_config.nr_threads = auto_thread_count(config, &header, rescale ? &scaled : &header,
+													available_cpus());
+	}
+
+	int nr_threads = image_config.nr_threads;
+	worker_pool_t *pool = pool_create("worker", nr_threads);
+
+	if (!rescale) {
+		// the image is not scaled and it is not larger than the result
+		image = ppm_map(config->in_file);
+	} else {
+		size_t line_size = (size_t)header.x * sizeof(ppm_pixel);
+		int window_lines = MIN(config->stream_budget / line_size, (size_t)header.y);
+
+		// a scaled pixel reads 4 consecutive source lines
+		if (window_lines < 4) {
+			fprintf(stderr, "The stream budget must be at least %zu bytes\n", 4 * line_size);
+			exit(1);
+		}
+
+		image = ppm_alloc(config->rescale_x, config->rescale_y);
+		scale_stream(config, stream, &header, image, pool, nr_threads, window_lines);
+	}
+
+	ppm_stream_close(stream);
+
+	// the rest of the work only needs the scaled image
+	contour_atlas_t *atlas = atlas_load("./contours", config->step);
+	pthread_barrier_t barrier;
+	image_job_t job;
+
+	job_init(&job, &image_config, image, nr_threads, &barrier, NULL);
+	pthread_barrier_init(&barrier, NULL, job.nr_threads);
+
+	thread_arg_t *thread_args = (thread_arg_t *)malloc(job.nr_threads * sizeof(thread_arg_t));
+	if (!thread_args) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	job_set_args(&job, &image_config, atlas, &barrier, thread_args);
+
+	ppm_writer_t *writer = NULL;
+	if (!config->serial_write) {
+		writer = ppm_writer_open(config->out_file, job.scaled_image);
+		for (int i = 0; i < job.nr_threads; i++) {
+			thread_args[i].writer = writer;
+		}
+	}
+
+	pool_run(pool, job.nr_threads, process_slot, thread_args, sizeof(thread_arg_t));
+
+	if (writer) {
+		ppm_writer_close(writer);
+	} else {
+		write_ppm(job.scaled_image, config->out_file);
+	}
+
+	job_destroy(&job);
+	atlas_destroy(atlas);
+	pool_destroy(pool);
+	pthread_barrier_destroy(&barrier);
+	free(thread_args);
+
+	return 0;
+}
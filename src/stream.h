@@ -0,0 +1,13 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#ifndef STREAM_H_
+#define STREAM_H_
+
+#include "config.h"
+
+// Processes `config->in_file` without loading it: when the image is scaled, the source lines
+// are read in windows of at most `config->stream_budget` bytes, each window being scaled
+// before the next one is read. The scaled image is kept whole, outside of the budget. Returns
+// the exit status of the program.
+int stream_run(const config_t *config);
+
+#endif  // STREAM_H_
@@ -5,54 +5,135 @@
 #include <string.h>
 #include <unistd.h>
 
+#include "arena.h"
+#include "atlas.h"
+#include "batch.h"
+#include "config.h"
+#include "frames.h"
+#include "grid.h"
 #include "helpers.h"
+#include "incremental.h"
+#include "levels.h"
+#include "numa.h"
 #include "parallel_march.h"
+#include "polyline.h"
+#include "ppm_io.h"
+#include "stream.h"
+#include "trace.h"
 #include "types.h"
 #include "utils.h"
 
-#define MAX_THREADS_NR 12
+// Places the buffers of `job` for the threads pinned with `topology`: the bands of the scaled
+// image and of the grid of each thread go on its node, while the input, which is read by all
+// the threads, is interleaved over the nodes. Without scaling the threads stamp the input, so
+// it is split in bands instead.
+static void place_job(const config_t *config, const numa_topology_t *topology, image_job_t *job) {
+	ppm_image *scaled = job->scaled_image;
+	size_t row_size = (size_t)scaled->y * sizeof(ppm_pixel);
+	grid_t *grid = job->grid;
+	size_t grid_row_size = (size_t)grid->words_per_row * sizeof(uint64_t);
 
-int main(int argc, char *argv[]) {
-	if (argc < 4) {
-		fprintf(stderr, "Usage: ./tema1 <in_file> <out_file> <P>\n");
-		return 1;
+	if (scaled != job->image) {
+		numa_interleave(topology, job->image->data,
+						(size_t)job->image->x * job->image->y * sizeof(ppm_pixel));
 	}
+	// the threads stamp and write `step` pixel rows per row of their band of the grid
+	numa_bind_bands(topology, scaled->data, scaled->x * row_size, row_size, scaled->x,
+					config->step, job->nr_threads);
+	numa_bind_bands(topology, grid->bits, grid->rows * grid_row_size, grid_row_size,
+					scaled->x / config->step, 1, job->nr_threads);
+}
+
+// Prints where the pages of the buffers placed by `place_job` ended up.
+static void print_placement(const config_t *config, const numa_topology_t *topology,
+							image_job_t *job) {
+	ppm_image *scaled = job->scaled_image;
+	size_t row_size = (size_t)scaled->y * sizeof(ppm_pixel);
+	grid_t *grid = job->grid;
+	size_t grid_row_size = (size_t)grid->words_per_row * sizeof(uint64_t);
 
-	// set the number of threads used
-	int nr_threads = atoi(argv[3]);
+	fprintf(stderr, "numa: %s, nodes: %d, cpus: %d\n", numa_mode_name(topology->mode),
+			topology->nr_nodes, topology->nr_cpus);
+	if (scaled != job->image) {
+		numa_print_pages(topology, "input", job->image->data,
+						 (size_t)job->image->x * job->image->y * sizeof(ppm_pixel), stderr);
+	}
+	numa_print_bands(topology, "scaled image", scaled->data, scaled->x * row_size, row_size,
+					 scaled->x, config->step, job->nr_threads, stderr);
+	numa_print_bands(topology, "grid", grid->bits, grid->rows * grid_row_size, grid_row_size,
+					 scaled->x / config->step, 1, job->nr_threads, stderr);
+}
 
+// Processes the image of `job` with its threads and writes the result. With a topology, each
+// thread is pinned to its CPU.
+static void run_job(const config_t *config, image_job_t *job, contour_atlas_t *atlas,
+					pthread_barrier_t *barrier, const numa_topology_t *topology) {
 	int rc;
-	pthread_barrier_t barrier;
-	pthread_t tid[MAX_THREADS_NR];
-	thread_arg_t thread_args[MAX_THREADS_NR];
+	int nr_threads = job->nr_threads;
 
-	ppm_image *image = NULL;
-	ppm_image *scaled_image = NULL;
-	ppm_image **contour_map = NULL;
-	unsigned char **grid = NULL;
+	pthread_t *tid = (pthread_t *)malloc(nr_threads * sizeof(pthread_t));
+	thread_arg_t *thread_args = (thread_arg_t *)malloc(nr_threads * sizeof(thread_arg_t));
+	if (!tid || !thread_args) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
 
 	// initialize barrier
-	pthread_barrier_init(&barrier, NULL, nr_threads);
+	pthread_barrier_init(barrier, NULL, nr_threads);
 
-	// read image from file
-	image = read_ppm(argv[1]);
+	// set thread arguments
+	job_set_args(job, config, atlas, barrier, thread_args);
 
-	// allocate initial memory
-	init_mem(&scaled_image, &image, &contour_map, &grid);
+	// each thread writes its band of the result as soon as it is stamped
+	ppm_image file = image_to_file(config, job->scaled_image);
+	ppm_writer_t *writer = NULL;
+	ppm_writer_t **layers = NULL;
+	polyline_set_t *vectors = NULL;
+	if (config->vector) {
+		// each thread traces the isolines of its band, which are merged at the end
+		vectors = (polyline_set_t *)malloc(nr_threads * sizeof(polyline_set_t));
+		if (!vectors) {
+			fprintf(stderr, "Unable to allocate memory\n");
+			exit(1);
+		}
+
+		for (int i = 0; i < nr_threads; i++) {
+			polyline_set_init(&vectors[i]);
+			thread_args[i].vectors = &vectors[i];
+		}
+	} else if (config->layers) {
+		// every level is written in its own file instead
+		layers = (ppm_writer_t **)malloc(config->nr_levels * sizeof(ppm_writer_t *));
+		if (!layers) {
+			fprintf(stderr, "Unable to allocate memory\n");
+			exit(1);
+		}
+
+		for (int k = 0; k < config->nr_levels; k++) {
+			char *path = level_layer_path(config->out_file, config->levels[k]);
+			layers[k] = ppm_writer_open(path, &file);
+			free(path);
+		}
+		for (int i = 0; i < nr_threads; i++) {
+			thread_args[i].layers = layers;
+		}
+	} else if (!config->serial_write) {
+		writer = ppm_writer_open(config->out_file, &file);
+		for (int i = 0; i < nr_threads; i++) {
+			thread_args[i].writer = writer;
+		}
+	}
 
 	// create the threads
 	for (int i = 0; i < nr_threads; i++) {
-		// set thread arguments
-		thread_args[i].thread_id = i;
-		thread_args[i].nr_threads = nr_threads;
-		thread_args[i].barrier = &barrier;
-		thread_args[i].contour_map = contour_map;
-		thread_args[i].image = image;
-		thread_args[i].scaled_image = scaled_image;
-		thread_args[i].grid = grid;
-
-		// create the thread
-		rc = pthread_create(&tid[i], NULL, thread_function, &thread_args[i]);
+		pthread_attr_t attr;
+		pthread_attr_init(&attr);
+		if (topology) {
+			numa_pin_thread(topology, i, &attr);
+		}
+
+		rc = pthread_create(&tid[i], &attr, thread_function, &thread_args[i]);
+		pthread_attr_destroy(&attr);
 
 		// check if the thread was created successfully
 		if (rc) {
@@ -62,6 +143,8 @@ int main(int argc, char *argv[]) {
 	}
 
 	// join the threads
+	trace_mark_t mark;
+	trace_begin(&mark);
 	for (int i = 0; i < nr_threads; i++) {
 		rc = pthread_join(tid[i], NULL);
 
@@ -71,15 +154,128 @@ int main(int argc, char *argv[]) {
 			exit(1);
 		}
 	}
+	trace_end("join", TRACE_WAIT, &mark);
+
+	if (job->sched && config->stats) {
+		sched_print_stats(job->sched, stderr);
+	}
 
 	// write output
-	write_ppm(scaled_image, argv[2]);
+	trace_begin(&mark);
+	if (vectors) {
+		polyline_set_t merged;
+		polyline_set_init(&merged);
+		polyline_merge(vectors, nr_threads, &merged);
+		polyline_write(&merged, config->out_file, config->vector, job->scaled_image->y,
+					   job->scaled_image->x);
 
-	// free all the allocated memory
-	free_resources(scaled_image, image, contour_map, grid, STEP);
+		polyline_set_free(&merged);
+		for (int i = 0; i < nr_threads; i++) {
+			polyline_set_free(&vectors[i]);
+		}
+		free(vectors);
+	} else if (layers) {
+		for (int k = 0; k < config->nr_levels; k++) {
+			ppm_writer_close(layers[k]);
+		}
+		free(layers);
+	} else if (writer) {
+		ppm_writer_close(writer);
+	} else {
+		write_ppm(&file, config->out_file);
+	}
+	trace_end("write", TRACE_PHASE, &mark);
+
+	free(thread_args);
+	free(tid);
 
 	// destroy barrier
-	pthread_barrier_destroy(&barrier);
+	pthread_barrier_destroy(barrier);
+}
+
+// Processes the single image of `config->in_file`. Returns the exit status of the program.
+static int image_run(const config_t *config) {
+	pthread_barrier_t barrier;
+	image_job_t job;
+	trace_mark_t mark;
+
+	// load the contours of all the configurations
+	trace_begin(&mark);
+	contour_atlas_t *atlas = atlas_load("./contours", config->step);
+	trace_end("load atlas", TRACE_PHASE, &mark);
+
+	// map the image from the file
+	trace_begin(&mark);
+	ppm_image *image = ppm_map(config->in_file);
+	image_from_file(config, image);
+	trace_end("read", TRACE_PHASE, &mark);
+
+	// allocate the memory used while processing the image
+	trace_begin(&mark);
+	job_init(&job, config, image, available_cpus(), &barrier, NULL);
+	trace_end("init", TRACE_PHASE, &mark);
+	int nr_threads = job.nr_threads;
+	if (config->stats) {
+		fprintf(stderr, "threads: %d\n", nr_threads);
+		fprintf(stderr, "arena: %.1f MiB, %s\n", job.arena->size / 1048576.0,
+				arena_page_name(job.arena->backing));
+	}
+
+	// the pages of the bands are placed before the threads first touch them
+	numa_topology_t *topology = NULL;
+	if (config->numa) {
+		topology = numa_topology_create(config->numa);
+		place_job(config, topology, &job);
+	}
+
+	// with a cache of the previous run, only the squares which changed are stamped again
+	incremental_t *inc = config->incremental ? incremental_open(config, &job) : NULL;
+	if (!inc || !incremental_update(inc, atlas)) {
+		run_job(config, &job, atlas, &barrier, topology);
+	}
+	if (inc) {
+		incremental_save(inc);
+		incremental_close(inc);
+	}
+
+	if (topology) {
+		if (config->stats) {
+			print_placement(config, topology, &job);
+		}
+		numa_topology_destroy(topology);
+	}
+
+	// free all the allocated memory
+	job_destroy(&job);
+	atlas_destroy(atlas);
 
 	return 0;
-}
\ No newline at end of file
+}
+
+int main(int argc, char *argv[]) {
+	config_t config;
+	int status;
+
+	// read the command line arguments
+	parse_config(argc, argv, &config);
+
+	if (config.trace) {
+		trace_start(config.trace, config.trace_counters);
+	}
+
+	if (config.batch) {
+		status = batch_run(&config);
+	} else if (config.frames) {
+		status = frames_run(&config);
+	} else if (config.stream_budget) {
+		status = stream_run(&config);
+	} else {
+		status = image_run(&config);
+	}
+
+	if (config.trace) {
+		trace_stop(stderr);
+	}
+
+	return status;
+}
@@ -0,0 +1,350 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#include "trace.h"
+
+#include <linux/perf_event.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+typedef struct {
+	const char *name;
+	trace_kind_t kind;
+	uint64_t start, end;
+	uint64_t counters[TRACE_NR_COUNTERS];
+} trace_span_t;
+
+// Spans of a thread. Only the thread itself adds spans, so no lock is taken.
+struct trace_thread {
+	// the name of the thread, with its id if it is not negative, and the order of its first span
+	const char *name;
+	int id;
+	int index;
+	int fds[TRACE_NR_COUNTERS];
+	trace_span_t *spans;
+	size_t nr_spans, capacity;
+};
+
+typedef struct trace_thread trace_thread_t;
+
+struct trace {
+	char *path;
+	uint64_t start;
+	int counters;
+
+	// the threads which recorded spans, in the order of their first span
+	pthread_mutex_t lock;
+	trace_thread_t **threads;
+	int nr_threads, capacity;
+};
+
+static const uint64_t counter_events[TRACE_NR_COUNTERS] = {
+	PERF_COUNT_HW_CPU_CYCLES,
+	PERF_COUNT_HW_CACHE_MISSES,
+};
+
+static const char *const counter_names[TRACE_NR_COUNTERS] = {
+	"cycles",
+	"llc_misses",
+};
+
+trace_t *trace_active;
+
+// spans of the calling thread, registered at its first span
+static __thread trace_thread_t *local_thread;
+
+// name of the calling thread given before its first span, if any
+static __thread const char *local_name;
+static __thread int local_id;
+
+static uint64_t now_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Opens a counter of the calling thread, in user space. Returns -1 if the system does not
+// allow it.
+static int open_counter(uint64_t event) {
+	struct perf_event_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.size = sizeof(attr);
+	attr.config = event;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+
+	return (int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static uint64_t read_counter(int fd) {
+	uint64_t value = 0;
+
+	if (fd < 0 || read(fd, &value, sizeof(value)) != sizeof(value)) {
+		return 0;
+	}
+	return value;
+}
+
+// Registers the calling thread, opening its counters if they are enabled.
+static trace_thread_t *register_thread(trace_t *trace) {
+	trace_thread_t *thread = (trace_thread_t *)malloc(sizeof(trace_thread_t));
+	if (!thread) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	thread->nr_spans = 0;
+	thread->capacity = 256;
+	thread->spans = (trace_span_t *)malloc(thread->capacity * sizeof(trace_span_t));
+	if (!thread->spans) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	for (int k = 0; k < TRACE_NR_COUNTERS; k++) {
+		thread->fds[k] = trace->counters ? open_counter(counter_events[k]) : -1;
+	}
+
+	pthread_mutex_lock(&trace->lock);
+	// until it is named, a thread is known by the order of its first span
+	thread->name = trace->nr_threads ? "thread" : "main";
+	thread->id = trace->nr_threads ? trace->nr_threads : -1;
+	if (local_name) {
+		thread->name = local_name;
+		thread->id = local_id;
+	}
+	thread->index = trace->nr_threads;
+	if (trace->nr_threads == trace->capacity) {
+		trace->capacity = trace->capacity ? 2 * trace->capacity : 16;
+		trace->threads = (trace_thread_t **)realloc(trace->threads,
+													trace->capacity * sizeof(trace_thread_t *));
+		if (!trace->threads) {
+			fprintf(stderr, "Unable to allocate memory\n");
+			exit(1);
+		}
+	}
+	trace->threads[trace->nr_threads++] = thread;
+	pthread_mutex_unlock(&trace->lock);
+
+	return thread;
+}
+
+// Starts recording the spans of every thread, which are written in `path` as Chrome trace
+// events by `trace_stop`. With `counters`, the hardware counters of every span are read too,
+// with perf_event_open, if the system allows it. A process is traced at most once.
+void trace_start(const char *path, int counters) {
+	trace_t *trace = (trace_t *)malloc(sizeof(trace_t));
+	if (!trace) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+
+	trace->path = strdup(path);
+	if (!trace->path) {
+		fprintf(stderr, "Unable to allocate memory\n");
+		exit(1);
+	}
+	trace->counters = counters;
+	pthread_mutex_init(&trace->lock, NULL);
+	trace->threads = NULL;
+	trace->nr_threads = trace->capacity = 0;
+	trace->start = now_ns();
+
+	// the calling thread is the first one
+	local_thread = register_thread(trace);
+	if (counters && local_thread->fds[0] < 0) {
+		fprintf(stderr, "Hardware counters are not available, tracing without them\n");
+		trace->counters = 0;
+	}
+
+	trace_active = trace;
+}
+
+// Names the calling thread `name` followed by `id`, or `name` alone when `id` is negative, so
+// that it is found by its role (worker `id` being the thread of `thread_id` `id`) instead of by
+// the order of its first span, which is a race. The threads are listed by name, then by id;
+// `name` must outlive the trace.
+void trace_name_thread(const char *name, int id) {
+	local_name = name;
+	local_id = id;
+
+	// a thread without spans is only registered at its first one
+	if (local_thread) {
+		local_thread->name = name;
+		local_thread->id = id;
+	}
+}
+
+// Marks the beginning of a span of the calling thread.
+void trace_begin_span(trace_mark_t *mark) {
+	if (!local_thread) {
+		local_thread = register_thread(trace_active);
+	}
+
+	for (int k = 0; k < TRACE_NR_COUNTERS; k++) {
+		mark->counters[k] = read_counter(local_thread->fds[k]);
+	}
+	mark->start = now_ns();
+}
+
+// Records the span of the calling thread which began at `mark`.
+void trace_end_span(const char *name, trace_kind_t kind, const trace_mark_t *mark) {
+	uint64_t end = now_ns();
+	trace_thread_t *thread = local_thread;
+
+	if (thread->nr_spans == thread->capacity) {
+		thread->capacity *= 2;
+		thread->spans = (trace_span_t *)realloc(thread->spans,
+												thread->capacity * sizeof(trace_span_t));
+		if (!thread->spans) {
+			fprintf(stderr, "Unable to allocate memory\n");
+			exit(1);
+		}
+	}
+
+	trace_span_t *span = &thread->spans[thread->nr_spans++];
+	span->name = name;
+	span->kind = kind;
+	span->start = mark->start;
+	span->end = end;
+	for (int k = 0; k < TRACE_NR_COUNTERS; k++) {
+		span->counters[k] = read_counter(thread->fds[k]) - mark->counters[k];
+	}
+}
+
+// Orders the threads: the main one first, then by name, by id, and by their first span.
+static int compare_threads(const void *a, const void *b) {
+	const trace_thread_t *first = *(trace_thread_t *const *)a;
+	const trace_thread_t *second = *(trace_thread_t *const *)b;
+
+	if (!first->index || !second->index) {
+		return first->index - second->index;
+	}
+
+	int names = strcmp(first->name, second->name);
+	if (names) {
+		return names;
+	}
+	if (first->id != second->id) {
+		return first->id < second->id ? -1 : 1;
+	}
+
+	return first->index - second->index;
+}
+
+// Writes the name of a thread, as it is shown in the trace and in the summary.
+static void thread_label(const trace_thread_t *thread, char *label, size_t size) {
+	if (thread->id < 0) {
+		snprintf(label, size, "%s", thread->name);
+	} else {
+		snprintf(label, size, "%s %d", thread->name, thread->id);
+	}
+}
+
+// Writes the spans as complete events ("ph": "X"), in microseconds since the start of the
+// trace, each thread getting its name from a metadata event.
+static void write_events(const trace_t *trace) {
+	FILE *fp = fopen(trace->path, "w");
+	if (!fp) {
+		fprintf(stderr, "Unable to open file '%s'\n", trace->path);
+		exit(1);
+	}
+
+	fprintf(fp, "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [\n");
+
+	const char *sep = "";
+	for (int t = 0; t < trace->nr_threads; t++) {
+		const trace_thread_t *thread = trace->threads[t];
+
+		char label[64];
+		thread_label(thread, label, sizeof(label));
+		fprintf(fp, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+				"\"args\": {\"name\": \"%s\"}}", sep, t, label);
+		fprintf(fp, ",\n{\"name\": \"thread_sort_index\", \"ph\": \"M\", \"pid\": 1, "
+				"\"tid\": %d, \"args\": {\"sort_index\": %d}}", t, t);
+		sep = ",\n";
+
+		for (size_t s = 0; s < thread->nr_spans; s++) {
+			const trace_span_t *span = &thread->spans[s];
+
+			fprintf(fp, "%s{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": 1, "
+					"\"tid\": %d, \"ts\": %.3f, \"dur\": %.3f", sep, span->name,
+					span->kind == TRACE_WAIT ? "wait" : "phase", t,
+					(span->start - trace->start) / 1e3, (span->end - span->start) / 1e3);
+			if (trace->counters) {
+				fprintf(fp, ", \"args\": {");
+				for (int k = 0; k < TRACE_NR_COUNTERS; k++) {
+					fprintf(fp, "%s\"%s\": %llu", k ? ", " : "", counter_names[k],
+							(unsigned long long)span->counters[k]);
+				}
+				fprintf(fp, "}");
+			}
+			fprintf(fp, "}");
+		}
+	}
+
+	fprintf(fp, "\n]}\n");
+	if (fclose(fp)) {
+		fprintf(stderr, "Unable to write file '%s'\n", trace->path);
+		exit(1);
+	}
+}
+
+// Prints, for every thread, the time spent in the phases and waiting, the number of waits and
+// the share of the waits.
+static void print_summary(const trace_t *trace, FILE *file) {
+	fprintf(file, "%-10s %12s %8s %12s %8s\n", "thread", "phases (ms)", "waits", "wait (ms)",
+			"wait %");
+
+	for (int t = 0; t < trace->nr_threads; t++) {
+		const trace_thread_t *thread = trace->threads[t];
+		uint64_t busy = 0, wait = 0;
+		long nr_waits = 0;
+
+		for (size_t s = 0; s < thread->nr_spans; s++) {
+			const trace_span_t *span = &thread->spans[s];
+
+			if (span->kind == TRACE_WAIT) {
+				wait += span->end - span->start;
+				nr_waits++;
+			} else {
+				busy += span->end - span->start;
+			}
+		}
+
+		char name[64];
+		thread_label(thread, name, sizeof(name));
+		fprintf(file, "%-10s %12.3f %8ld %12.3f %7.1f%%\n", name, busy / 1e6, nr_waits,
+				wait / 1e6, busy + wait ? 100.0 * wait / (busy + wait) : 0.0);
+	}
+}
+
+// Writes the trace, prints the time every thread spent in the phases and waiting on `file`,
+// then frees the spans.
+void trace_stop(FILE *file) {
+	trace_t *trace = trace_active;
+
+	trace_active = NULL;
+	qsort(trace->threads, trace->nr_threads, sizeof(trace_thread_t *), compare_threads);
+	write_events(trace);
+	print_summary(trace, file);
+
+	for (int t = 0; t < trace->nr_threads; t++) {
+		trace_thread_t *thread = trace->threads[t];
+
+		for (int k = 0; k < TRACE_NR_COUNTERS; k++) {
+			if (thread->fds[k] >= 0) {
+				close(thread->fds[k]);
+			}
+		}
+		free(thread->spans);
+		free(thread);
+	}
+
+	pthread_mutex_destroy(&trace->lock);
+	free(trace->threads);
+	free(trace->path);
+	free(trace);
+}
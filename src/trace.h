@@ -0,0 +1,78 @@
+// Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+// Hardware counters read around every span, when they are enabled: the cycles and the last
+// level cache misses.
+#define TRACE_NR_COUNTERS 2
+
+// What a span measures: the work of a phase, or a wait for the other threads.
+typedef enum {
+	TRACE_PHASE,
+	TRACE_WAIT,
+} trace_kind_t;
+
+// Beginning of a span, filled by `trace_begin`.
+typedef struct {
+	uint64_t start;
+	uint64_t counters[TRACE_NR_COUNTERS];
+} trace_mark_t;
+
+typedef struct trace trace_t;
+
+// The running trace. When tracing is off, a span only costs a test of this pointer.
+extern trace_t *trace_active;
+
+// Starts recording the spans of every thread, which are written in `path` as Chrome trace
+// events by `trace_stop`. With `counters`, the hardware counters of every span are read too,
+// with perf_event_open, if the system allows it. A process is traced at most once.
+void trace_start(const char *path, int counters);
+
+// Writes the trace, prints the time every thread spent in the phases and waiting on `file`,
+// then frees the spans.
+void trace_stop(FILE *file);
+
+void trace_name_thread(const char *name, int id);
+
+void trace_begin_span(trace_mark_t *mark);
+
+void trace_end_span(const char *name, trace_kind_t kind, const trace_mark_t *mark);
+
+// Names the calling thread `name` followed by `id`, or `name` alone when `id` is negative, so
+// that it is found by its role (worker `id` being the thread of `thread_id` `id`) instead of by
+// the order of its first span, which is a race. The threads are listed by name, then by id;
+// `name` must outlive the trace.
+static inline void trace_set_thread(const char *name, int id) {
+	if (trace_active) {
+		trace_name_thread(name, id);
+	}
+}
+
+// Marks the beginning of a span of the calling thread.
+static inline void trace_begin(trace_mark_t *mark) {
+	if (trace_active) {
+		trace_begin_span(mark);
+	}
+}
+
+// Records the span of the calling thread which began at `mark`.
+static inline void trace_end(const char *name, trace_kind_t kind, const trace_mark_t *mark) {
+	if (trace_active) {
+		trace_end_span(name, kind, mark);
+	}
+}
+
+// Waits at `barrier`, recording the wait as a span named `name`.
+static inline void trace_barrier_wait(pthread_barrier_t *barrier, const char *name) {
+	trace_mark_t mark;
+
+	trace_begin(&mark);
+	pthread_barrier_wait(barrier);
+	trace_end(name, TRACE_WAIT, &mark);
+}
+
+#endif  // TRACE_H_
@@ -4,17 +4,67 @@
 
 #include <pthread.h>
 
+#include "arena.h"
+#include "atlas.h"
+#include "config.h"
+#include "grid.h"
 #include "helpers.h"
+#include "levels.h"
+#include "polyline.h"
+#include "ppm_io.h"
+#include "resample.h"
+#include "sched.h"
+
+// Tells which grid rows have been published by the threads in the fused mode. Each thread
+// publishes the first row of its band, which the previous thread needs for its last squares.
+typedef struct {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	unsigned char *ready;
+} band_sync_t;
 
 typedef struct {
 	int thread_id;
 	int nr_threads;
+	const config_t *config;
 	pthread_barrier_t *barrier;
-	ppm_image **contour_map;
+	contour_atlas_t *atlas;
 	ppm_image *image;
 	ppm_image *scaled_image;
-	unsigned char **grid;
-
+	resample_plan_t *plan;
+	grid_t *grid;
+	band_sync_t *sync;
+	scheduler_t *sched;
+	ppm_writer_t *writer;
+	level_grid_t *levels;
+	// writers of the layers of the levels, with --layers
+	ppm_writer_t **layers;
+	// isolines traced by the thread, with --vector
+	polyline_set_t *vectors;
+	// scratch of the thread: the configurations of a row of squares, and the rows of the
+	// scaled image it interpolates, in the slice of its rows of a buffer shared by the threads
+	unsigned char *cases;
+	int *rows;
 } thread_arg_t;
 
+// Everything the threads share while processing an image.
+typedef struct {
+	int nr_threads;
+	ppm_image *image;
+	ppm_image *scaled_image;
+	grid_t *grid;
+	resample_plan_t *plan;
+	band_sync_t *sync;
+	scheduler_t *sched;
+	level_grid_t *levels;
+
+	// the buffers above are carved out of the arena, which is only destroyed with the job if
+	// it was created for it
+	arena_t *arena;
+	int owns_arena;
+	unsigned char *cases;
+	size_t cases_size;
+	int *rows;
+} image_job_t;
+
 #endif // TYPES_H_
\ No newline at end of file
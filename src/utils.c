@@ -1,112 +1,212 @@
 // Copyright: Ionescu Matei-Stefan - 333CAb - 2023-2024
+// needed for sched_getaffinity
+#define _GNU_SOURCE
+
 #include "utils.h"
 
 #include <pthread.h>
+#include <sched.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
+#include "arena.h"
+#include "atlas.h"
+#include "grid.h"
 #include "helpers.h"
+#include "levels.h"
+#include "parallel_march.h"
+#include "ppm_io.h"
 #include "types.h"
 
-#define CONTOUR_CONFIG_COUNT 16
-#define FILENAME_MAX_SIZE 50
-#define STEP 8
-#define RESCALE_X 2048
-#define RESCALE_Y 2048
-
-// Allocates memory for the contour_map, grid and, if necessary, for the scaled image.
-void init_mem(ppm_image **scaled_image, ppm_image **image, ppm_image ***contour_map,
-			  unsigned char ***grid) {
-	// allocate memory for countour_map
-	*contour_map = (ppm_image **)malloc(CONTOUR_CONFIG_COUNT * sizeof(ppm_image *));
-	if (!(*contour_map)) {
-		fprintf(stderr, "Unable to allocate memory\n");
-		exit(1);
+// Size of the scaled image of `image`, which is the image itself when it is small enough.
+// Without an image, the size of the largest image the options can lead to.
+static void scaled_size(const config_t *config, const ppm_image *image, int *x, int *y) {
+	*x = config->rescale_x;
+	*y = config->rescale_y;
+
+	if (image && image->x <= config->rescale_x && image->y <= config->rescale_y) {
+		*x = image->x;
+		*y = image->y;
+	}
+}
+
+// Size of the arena which holds the buffers of a job on `image` with `nr_threads` threads, or
+// of a job on any image, without one.
+size_t job_arena_size(const config_t *config, const ppm_image *image, int nr_threads) {
+	int x, y;
+	scaled_size(config, image, &x, &y);
+
+	int rows = x / config->step + 1;
+	int cols = y / config->step + 1;
+	size_t size = grid_arena_size(rows, cols);
+
+	// the scaled image, unless the image is small enough to be used directly
+	if (!image || image->x > config->rescale_x || image->y > config->rescale_y) {
+		size += arena_block_size(sizeof(ppm_image)) +
+				arena_block_size((size_t)x * y * sizeof(ppm_pixel));
 	}
 
-	for (int i = 0; i < CONTOUR_CONFIG_COUNT; i++) {
-		char filename[FILENAME_MAX_SIZE];
-		sprintf(filename, "./contours/%d.ppm", i);
-		(*contour_map)[i] = read_ppm(filename);
+	if (config->nr_levels) {
+		size += level_grid_arena_size(rows, cols);
 	}
 
+	// the scratch of the threads
+	size += nr_threads * arena_block_size(cols);
+	size += arena_block_size((size_t)x * sizeof(int));
+
+	return size;
+}
+
+// Carves the grid and, if necessary, the scaled image out of `arena`.
+void alloc_image_mem(const config_t *config, arena_t *arena, ppm_image **scaled_image,
+					 ppm_image *image, grid_t **grid) {
 	// by default the scaled image is the same as the original image
-	*scaled_image = *image;
+	*scaled_image = image;
 
 	// if the the image exceeds the limits, allocate memory for the scaled image
-	if (!((*image)->x <= RESCALE_X && (*image)->y <= RESCALE_Y)) {
-		ppm_image *new_image = (ppm_image *)malloc(sizeof(ppm_image));
-		if (!new_image) {
-			fprintf(stderr, "Unable to allocate memory\n");
-			exit(1);
-		}
-		new_image->x = RESCALE_X;
-		new_image->y = RESCALE_Y;
-
-		new_image->data = (ppm_pixel *)malloc(new_image->x * new_image->y * sizeof(ppm_pixel));
-		if (!new_image) {
-			fprintf(stderr, "Unable to allocate memory\n");
-			exit(1);
-		}
+	if (!(image->x <= config->rescale_x && image->y <= config->rescale_y)) {
+		ppm_image *new_image = (ppm_image *)arena_alloc(arena, sizeof(ppm_image));
+		new_image->x = config->rescale_x;
+		new_image->y = config->rescale_y;
+		new_image->data = (ppm_pixel *)arena_alloc(arena, (size_t)new_image->x * new_image->y *
+														  sizeof(ppm_pixel));
 
 		*scaled_image = new_image;
 	}
 
 	// allocate memory for the grid
-	int grid_x_points_nr = (*scaled_image)->x / STEP;
-	int grid_y_points_nr = (*scaled_image)->y / STEP;
+	int grid_x_points_nr = (*scaled_image)->x / config->step;
+	int grid_y_points_nr = (*scaled_image)->y / config->step;
+
+	*grid = grid_create(arena, grid_x_points_nr + 1, grid_y_points_nr + 1);
+}
+
+// Allocates everything needed to process `image` with the options in `config`. The number of
+// threads is taken from the options or, for P=auto, picked from the size of the image, at
+// most `max_threads`. The buffers are carved out of `arena`, which is reset first and must be
+// at least `job_arena_size` large, or out of an arena created for the job when it is NULL. The
+// barrier is only stored, it must be initialized for `job->nr_threads` threads before they
+// are started.
+void job_init(image_job_t *job, const config_t *config, ppm_image *image, int max_threads,
+			  pthread_barrier_t *barrier, arena_t *arena) {
+	int rescale = image->x > config->rescale_x || image->y > config->rescale_y;
+	ppm_image scaled = {0, 0, NULL};
+	scaled_size(config, image, &scaled.x, &scaled.y);
+
+	job->nr_threads = config->nr_threads;
+	if (job->nr_threads == CONFIG_AUTO_THREADS) {
+		job->nr_threads = auto_thread_count(config, image, rescale ? &scaled : image,
+											max_threads);
+	}
+
+	// every buffer whose size is known from the image sizes
+	job->owns_arena = !arena;
+	if (!arena) {
+		arena = arena_create(job_arena_size(config, image, job->nr_threads), config->pages);
+	}
+	arena_reset(arena);
+	job->arena = arena;
+
+	job->image = image;
+	alloc_image_mem(config, arena, &job->scaled_image, image, &job->grid);
+
+	// the configurations of a row of squares, for each thread, and the scaled rows
+	job->cases_size = arena_block_size(job->grid->cols);
+	job->cases = (unsigned char *)arena_alloc(arena, job->nr_threads * job->cases_size);
+	job->rows = (int *)arena_alloc(arena, (size_t)job->scaled_image->x * sizeof(int));
+
+	// precompute the filter used for scaling
+	job->plan = create_rescale_plan(config, image, job->scaled_image);
 
-	*grid = (unsigned char **)malloc((grid_x_points_nr + 1) * sizeof(unsigned char *));
-	if (!(*grid)) {
-		fprintf(stderr, "Unable to allocate memory\n");
-		exit(1);
+	// the fused mode synchronizes neighbouring threads instead of using the barrier
+	job->sync = config->fused ? band_sync_create(job->grid->rows) : NULL;
+
+	// the luminance of the grid points, compared with every level
+	job->levels = NULL;
+	if (config->nr_levels) {
+		job->levels = level_grid_create(arena, job->grid->rows, job->grid->cols, config->levels,
+										config->nr_levels, config->saddle, config->isa);
 	}
 
-	for (int i = 0; i <= grid_x_points_nr; i++) {
-		(*grid)[i] = (unsigned char *)malloc((grid_y_points_nr + 1) * sizeof(unsigned char));
-		if (!(*grid)[i]) {
-			fprintf(stderr, "Unable to allocate memory\n");
-			exit(1);
-		}
+	// the tiles are distributed by the work-stealing scheduler
+	job->sched = NULL;
+	if (config->schedule == SCHEDULE_STEAL) {
+		job->sched = create_scheduler(config, job->nr_threads, job->scaled_image, barrier);
 	}
 }
 
-// Calls `free` method on the utilized resources.
-void free_resources(ppm_image *scaled_image, ppm_image *image, ppm_image **contour_map,
-					unsigned char **grid, int step_x) {
-	for (int i = 0; i < CONTOUR_CONFIG_COUNT; i++) {
-		free(contour_map[i]->data);
-		free(contour_map[i]);
+// Sets the arguments of the threads which process the job.
+void job_set_args(image_job_t *job, const config_t *config, contour_atlas_t *atlas,
+				  pthread_barrier_t *barrier, thread_arg_t *thread_args) {
+	for (int i = 0; i < job->nr_threads; i++) {
+		thread_args[i].thread_id = i;
+		thread_args[i].nr_threads = job->nr_threads;
+		thread_args[i].config = config;
+		thread_args[i].barrier = barrier;
+		thread_args[i].atlas = atlas;
+		thread_args[i].image = job->image;
+		thread_args[i].scaled_image = job->scaled_image;
+		thread_args[i].plan = job->plan;
+		thread_args[i].grid = job->grid;
+		thread_args[i].sync = job->sync;
+		thread_args[i].sched = job->sched;
+		thread_args[i].writer = NULL;
+		thread_args[i].levels = job->levels;
+		thread_args[i].layers = NULL;
+		thread_args[i].vectors = NULL;
+		thread_args[i].cases = job->cases + i * job->cases_size;
+		thread_args[i].rows = job->rows;
 	}
-	free(contour_map);
+}
 
-	for (int i = 0; i <= scaled_image->x / step_x; i++) {
-		free(grid[i]);
+// Frees everything allocated for the job, including the input image. The buffers carved out of
+// an arena given to `job_init` stay there until it is reset.
+void job_destroy(image_job_t *job) {
+	if (job->plan) {
+		resample_plan_destroy(job->plan);
+	}
+	if (job->sync) {
+		band_sync_destroy(job->sync);
+	}
+	if (job->sched) {
+		sched_destroy(job->sched);
 	}
-	free(grid);
+	if (job->owns_arena) {
+		arena_destroy(job->arena);
+	}
+
+	ppm_unmap(job->image);
+}
 
-	if (image != scaled_image) {
-		free(image->data);
-		free(image);
+// Turns an image read from a file into the view of the options: the files give the width
+// first, which is the number of rows of the reference view, while with `row_major` `x` is the
+// number of rows. The pixels are not moved.
+void image_from_file(const config_t *config, ppm_image *image) {
+	if (config->row_major) {
+		int rows = image->y;
+		image->y = image->x;
+		image->x = rows;
 	}
+}
 
-	free(scaled_image->data);
-	free(scaled_image);
+// Returns the size of `image` as it is written in a file, with the same pixels.
+ppm_image image_to_file(const config_t *config, const ppm_image *image) {
+	ppm_image file = *image;
+
+	image_from_file(config, &file);
+	return file;
 }
 
-// Updates a particular section of an image with the corresponding contour pixels.
-// Used to create the complete contour image.
-void update_image(ppm_image *image, ppm_image *contour, int x, int y) {
-	for (int i = 0; i < contour->x; i++) {
-		for (int j = 0; j < contour->y; j++) {
-			int contour_pixel_index = contour->x * i + j;
-			int image_pixel_index = (x + i) * image->y + y + j;
-
-			image->data[image_pixel_index].red = contour->data[contour_pixel_index].red;
-			image->data[image_pixel_index].green = contour->data[contour_pixel_index].green;
-			image->data[image_pixel_index].blue = contour->data[contour_pixel_index].blue;
-		}
+// Returns the number of CPUs the process is allowed to run on.
+int available_cpus(void) {
+	cpu_set_t set;
+
+	if (sched_getaffinity(0, sizeof(set), &set)) {
+		long online = sysconf(_SC_NPROCESSORS_ONLN);
+		return online > 0 ? (int)online : 1;
 	}
+
+	return CPU_COUNT(&set);
 }
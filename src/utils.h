@@ -2,18 +2,47 @@
 #ifndef UTILS_H_
 #define UTILS_H_
 
+#include "arena.h"
+#include "atlas.h"
+#include "grid.h"
+#include "config.h"
 #include "helpers.h"
+#include "types.h"
 
-// Allocates memory for the contour_map, grid and, if necessary, for the scaled image.
-void init_mem(ppm_image **scaled_image, ppm_image **image, ppm_image ***contour_map,
-			  unsigned char ***grid);
+// Size of the arena which holds the buffers of a job on `image` with `nr_threads` threads, or
+// of a job on any image, without one.
+size_t job_arena_size(const config_t *config, const ppm_image *image, int nr_threads);
 
-// Calls `free` method on the utilized resources.
-void free_resources(ppm_image *scaled_image, ppm_image *image, ppm_image **contour_map,
-					unsigned char **grid, int step_x);
+// Carves the grid and, if necessary, the scaled image out of `arena`.
+void alloc_image_mem(const config_t *config, arena_t *arena, ppm_image **scaled_image,
+					 ppm_image *image, grid_t **grid);
 
-// Updates a particular section of an image with the corresponding contour pixels.
-// Used to create the complete contour image.
-void update_image(ppm_image *image, ppm_image *contour, int x, int y);
+// Allocates everything needed to process `image` with the options in `config`. The number of
+// threads is taken from the options or, for P=auto, picked from the size of the image, at
+// most `max_threads`. The buffers are carved out of `arena`, which is reset first and must be
+// at least `job_arena_size` large, or out of an arena created for the job when it is NULL. The
+// barrier is only stored, it must be initialized for `job->nr_threads` threads before they
+// are started.
+void job_init(image_job_t *job, const config_t *config, ppm_image *image, int max_threads,
+			  pthread_barrier_t *barrier, arena_t *arena);
+
+// Sets the arguments of the threads which process the job.
+void job_set_args(image_job_t *job, const config_t *config, contour_atlas_t *atlas,
+				  pthread_barrier_t *barrier, thread_arg_t *thread_args);
+
+// Frees everything allocated for the job, including the input image. The buffers carved out of
+// an arena given to `job_init` stay there until it is reset.
+void job_destroy(image_job_t *job);
+
+// Turns an image read from a file into the view of the options: the files give the width
+// first, which is the number of rows of the reference view, while with `row_major` `x` is the
+// number of rows. The pixels are not moved.
+void image_from_file(const config_t *config, ppm_image *image);
+
+// Returns the size of `image` as it is written in a file, with the same pixels.
+ppm_image image_to_file(const config_t *config, const ppm_image *image);
+
+// Returns the number of CPUs the process is allowed to run on.
+int available_cpus(void);
 
 #endif  // UTILS_H_
\ No newline at end of file